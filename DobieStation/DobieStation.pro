@@ -13,6 +13,8 @@ QMAKE_CFLAGS_RELEASE -= -O3
 DEFINES += QT_DEPRECATED_WARNINGS
 DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000
 
+LIBS += -lz
+
 SOURCES += ../src/qt/main.cpp \
     ../src/core/errors.cpp \
     ../src/core/ee/emotion.cpp \
@@ -42,6 +44,8 @@ SOURCES += ../src/qt/main.cpp \
     ../src/core/iop/iop_timers.cpp \
     ../src/core/ee/intc.cpp \
     ../src/core/iop/cdvd.cpp \
+    ../src/core/iop/cso_reader.cpp \
+    ../src/core/iop/iso_reader.cpp \
     ../src/core/iop/sio2.cpp \
     ../src/core/ee/vu.cpp \
     ../src/core/ee/emotion_vu0.cpp \
@@ -51,6 +55,8 @@ SOURCES += ../src/qt/main.cpp \
     ../src/core/tests/iop/alu.cpp \
     ../src/core/ee/vif.cpp \
     ../src/core/ee/ipu/ipu.cpp \
+    ../src/core/ee/ipu/idct.cpp \
+    ../src/core/ee/ipu/csc.cpp \
     ../src/core/ee/ipu/vlc_table.cpp \
     ../src/core/ee/ipu/mac_addr_inc.cpp \
     ../src/core/ee/ipu/mac_i_pic.cpp \
@@ -66,7 +72,9 @@ SOURCES += ../src/qt/main.cpp \
     ../src/core/ee/ipu/codedblockpattern.cpp \
     ../src/core/ee/vu_interpreter.cpp \
     ../src/core/ee/vu_disasm.cpp \
-    ../src/core/gsmem.cpp
+    ../src/core/gsmem.cpp \
+    ../src/core/gscapture.cpp \
+    ../src/core/serialize.cpp
 
 HEADERS += \
     ../src/core/errors.hpp \
@@ -95,6 +103,9 @@ HEADERS += \
     ../src/core/iop/iop_timers.hpp \
     ../src/core/ee/intc.hpp \
     ../src/core/iop/cdvd.hpp \
+    ../src/core/iop/cdvd_container.hpp \
+    ../src/core/iop/cso_reader.hpp \
+    ../src/core/iop/iso_reader.hpp \
     ../src/core/iop/sio2.hpp \
     ../src/core/ee/vu.hpp \
     ../src/core/iop/gamepad.hpp \
@@ -103,6 +114,8 @@ HEADERS += \
     ../src/core/ee/vif.hpp \
     ../src/core/int128.hpp \
     ../src/core/ee/ipu/ipu.hpp \
+    ../src/core/ee/ipu/idct.hpp \
+    ../src/core/ee/ipu/csc.hpp \
     ../src/core/ee/ipu/vlc_table.hpp \
     ../src/core/ee/ipu/mac_addr_inc.hpp \
     ../src/core/ee/ipu/mac_i_pic.hpp \
@@ -118,4 +131,6 @@ HEADERS += \
     ../src/core/ee/ipu/codedblockpattern.hpp \
     ../src/core/ee/vu_interpreter.hpp \
     ../src/core/ee/vu_disasm.hpp \
-    ../src/core/gsmem.hpp
+    ../src/core/gsmem.hpp \
+    ../src/core/gscapture.hpp \
+    ../src/core/serialize.hpp
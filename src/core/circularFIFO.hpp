@@ -9,6 +9,7 @@ a single bigger queue if at all reasonable though
 
 #include <atomic>
 #include <cstddef>
+#include "errors.hpp"
 template<typename Element, size_t Size>
 class CircularFifo
 {
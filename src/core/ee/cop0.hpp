@@ -1,6 +1,7 @@
 #ifndef COP0_HPP
 #define COP0_HPP
 #include <cstdint>
+#include <fstream>
 
 enum COP0_REG
 {
@@ -52,6 +53,8 @@ class Cop0
         Cop0(DMAC* dmac);
 
         void reset();
+        void load_state(std::ifstream& state);
+        void save_state(std::ofstream& state);
 
         uint32_t mfc(int index);
         void mtc(int index, uint32_t value);
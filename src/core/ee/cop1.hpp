@@ -1,6 +1,7 @@
 #ifndef COP1_HPP
 #define COP1_HPP
 #include <cstdint>
+#include <fstream>
 
 struct COP1_CONTROL
 {
@@ -36,6 +37,8 @@ class Cop1
         Cop1();
 
         void reset();
+        void load_state(std::ifstream& state);
+        void save_state(std::ofstream& state);
 
         bool get_condition();
 
@@ -214,9 +214,20 @@ void DMAC::process_VIF1(int cycles)
         if (!mfifo_handler(VIF1))
             return;
         cycles--;
+
         if (channels[VIF1].quadword_count)
         {
-            vif1->feed_DMA(fetch128(channels[VIF1].address));
+            //With the direction set to memory, VIF1 carries data read back from the GS instead
+            if (!(channels[VIF1].control & 0x1))
+            {
+                //Until the GS has data for it (TRXDIR and BUSDIR set), the channel stalls and retries later
+                uint128_t data;
+                if (!gif->read_GS_image(data))
+                    return;
+                store128(channels[VIF1].address, data);
+            }
+            else
+                vif1->feed_DMA(fetch128(channels[VIF1].address));
 
             channels[VIF1].address += 16;
             channels[VIF1].quadword_count--;
@@ -1,6 +1,7 @@
 #ifndef DMAC_HPP
 #define DMAC_HPP
 #include <cstdint>
+#include <fstream>
 
 #include "../int128.hpp"
 
@@ -83,6 +84,8 @@ class DMAC
         DMAC(EmotionEngine* cpu, Emulator* e, GraphicsInterface* gif, ImageProcessingUnit* ipu, SubsystemInterface* sif,
              VectorInterface* vif0, VectorInterface* vif1);
         void reset(uint8_t* RDRAM, uint8_t* scratchpad);
+        void load_state(std::ifstream& state);
+        void save_state(std::ofstream& state);
         void run(int cycles);
         void start_DMA(int index);
 
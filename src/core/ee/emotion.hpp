@@ -1,6 +1,7 @@
 #ifndef EMOTION_HPP
 #define EMOTION_HPP
 #include <cstdint>
+#include <fstream>
 #include "cop0.hpp"
 #include "cop1.hpp"
 
@@ -50,6 +51,8 @@ class EmotionEngine
         static const char* REG(int id);
         static const char* SYSCALL(int id);
         void reset();
+        void load_state(std::ifstream& state);
+        void save_state(std::ofstream& state);
         int run(int cycles_to_run);
         void print_state();
         void set_disassembly(bool dis);
@@ -1,6 +1,7 @@
 #ifndef INTC_HPP
 #define INTC_HPP
 #include <cstdint>
+#include <fstream>
 
 class EmotionEngine;
 
@@ -34,6 +35,8 @@ class INTC
         INTC(EmotionEngine* cpu);
 
         void reset();
+        void load_state(std::ifstream& state);
+        void save_state(std::ofstream& state);
 
         uint32_t read_mask();
         uint32_t read_stat();
@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <emmintrin.h>
+#include "csc.hpp"
+
+static const int CONST_BITS = 14;
+static const int ROUND = 1 << (CONST_BITS - 1);
+
+//1.402, 0.34414, 0.71414 and 1.772 in 2.14
+static const int16_t R_CR = 22970;
+static const int16_t G_CB = -5638;
+static const int16_t G_CR = -11700;
+static const int16_t B_CB = 29032;
+
+static const int dither_matrix[4][4] =
+{
+    {-4, 0, -3, 1},
+    {2, -2, 3, -1},
+    {-3, 1, -4, 0},
+    {3, -1, 2, -2}
+};
+
+static inline int clamp8(int value)
+{
+    if (value < 0)
+        return 0;
+    if (value > 255)
+        return 255;
+    return value;
+}
+
+void CSC::RGB32_scalar(const uint8_t* block, uint32_t* out, uint16_t TH0, uint16_t TH1)
+{
+    const uint8_t* lum_block = block;
+    const uint8_t* cb_block = block + 0x100;
+    const uint8_t* cr_block = block + 0x140;
+
+    for (int i = 0; i < 16; i++)
+    {
+        for (int j = 0; j < 16; j++)
+        {
+            int index = j + (i * 16);
+            int chroma = (j / 2) + (i / 2) * 8;
+            int lum = lum_block[index];
+            int cb = cb_block[chroma] - 128;
+            int cr = cr_block[chroma] - 128;
+
+            int r = clamp8(lum + ((R_CR * cr + ROUND) >> CONST_BITS));
+            int g = clamp8(lum + ((G_CB * cb + G_CR * cr + ROUND) >> CONST_BITS));
+            int b = clamp8(lum + ((B_CB * cb + ROUND) >> CONST_BITS));
+
+            int brightest = std::max(r, std::max(g, b));
+            if (brightest < TH0)
+                out[index] = 0;
+            else
+            {
+                uint32_t alpha = (brightest < TH1) ? 0x40 : 0x80;
+                out[index] = r | (g << 8) | (b << 16) | (alpha << 24);
+            }
+        }
+    }
+}
+
+//Eight chroma terms from interleaved (Cb, Cr) pairs
+static inline __m128i chroma_term(__m128i lo, __m128i hi, __m128i coeffs, __m128i round)
+{
+    __m128i term_lo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(lo, coeffs), round), CONST_BITS);
+    __m128i term_hi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(hi, coeffs), round), CONST_BITS);
+    return _mm_packs_epi32(term_lo, term_hi);
+}
+
+//Adds a row's chroma terms, each covering two pixels, to its sixteen Y samples and saturates to bytes
+static inline __m128i add_chroma(__m128i lum_lo, __m128i lum_hi, __m128i term)
+{
+    return _mm_packus_epi16(_mm_add_epi16(lum_lo, _mm_unpacklo_epi16(term, term)),
+                            _mm_add_epi16(lum_hi, _mm_unpackhi_epi16(term, term)));
+}
+
+void CSC::RGB32_SSE2(const uint8_t* block, uint32_t* out, uint16_t TH0, uint16_t TH1)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi16(128);
+    const __m128i round = _mm_set1_epi32(ROUND);
+    const __m128i r_coeffs = _mm_set_epi16(R_CR, 0, R_CR, 0, R_CR, 0, R_CR, 0);
+    const __m128i g_coeffs = _mm_set_epi16(G_CR, G_CB, G_CR, G_CB, G_CR, G_CB, G_CR, G_CB);
+    const __m128i b_coeffs = _mm_set_epi16(0, B_CB, 0, B_CB, 0, B_CB, 0, B_CB);
+    const __m128i thresh0 = _mm_set1_epi16(TH0);
+    const __m128i thresh1 = _mm_set1_epi16(TH1);
+    const __m128i alpha_bits = _mm_set1_epi8((char)0xC0);
+    const __m128i opaque = _mm_set1_epi8((char)0x80);
+
+    for (int i = 0; i < 8; i++)
+    {
+        __m128i cb = _mm_loadl_epi64((const __m128i*)(block + 0x100 + (i * 8)));
+        __m128i cr = _mm_loadl_epi64((const __m128i*)(block + 0x140 + (i * 8)));
+        cb = _mm_sub_epi16(_mm_unpacklo_epi8(cb, zero), bias);
+        cr = _mm_sub_epi16(_mm_unpacklo_epi8(cr, zero), bias);
+        __m128i pairs_lo = _mm_unpacklo_epi16(cb, cr);
+        __m128i pairs_hi = _mm_unpackhi_epi16(cb, cr);
+
+        __m128i r_term = chroma_term(pairs_lo, pairs_hi, r_coeffs, round);
+        __m128i g_term = chroma_term(pairs_lo, pairs_hi, g_coeffs, round);
+        __m128i b_term = chroma_term(pairs_lo, pairs_hi, b_coeffs, round);
+
+        //Each chroma row covers two rows of Y
+        for (int row = i * 2; row < (i * 2) + 2; row++)
+        {
+            __m128i lum = _mm_loadu_si128((const __m128i*)(block + (row * 16)));
+            __m128i lum_lo = _mm_unpacklo_epi8(lum, zero);
+            __m128i lum_hi = _mm_unpackhi_epi8(lum, zero);
+
+            __m128i r = add_chroma(lum_lo, lum_hi, r_term);
+            __m128i g = add_chroma(lum_lo, lum_hi, g_term);
+            __m128i b = add_chroma(lum_lo, lum_hi, b_term);
+
+            //The thresholds are nine bits, so the comparisons are done on words
+            __m128i brightest = _mm_max_epu8(r, _mm_max_epu8(g, b));
+            __m128i brightest_lo = _mm_unpacklo_epi8(brightest, zero);
+            __m128i brightest_hi = _mm_unpackhi_epi8(brightest, zero);
+            __m128i below0 = _mm_packs_epi16(_mm_cmplt_epi16(brightest_lo, thresh0),
+                                             _mm_cmplt_epi16(brightest_hi, thresh0));
+            __m128i below1 = _mm_packs_epi16(_mm_cmplt_epi16(brightest_lo, thresh1),
+                                             _mm_cmplt_epi16(brightest_hi, thresh1));
+
+            //0x80 ^ 0xC0 gives 0x40 for pixels below TH1
+            __m128i alpha = _mm_andnot_si128(below0, _mm_xor_si128(opaque, _mm_and_si128(below1, alpha_bits)));
+            r = _mm_andnot_si128(below0, r);
+            g = _mm_andnot_si128(below0, g);
+            b = _mm_andnot_si128(below0, b);
+
+            __m128i rg_lo = _mm_unpacklo_epi8(r, g);
+            __m128i rg_hi = _mm_unpackhi_epi8(r, g);
+            __m128i ba_lo = _mm_unpacklo_epi8(b, alpha);
+            __m128i ba_hi = _mm_unpackhi_epi8(b, alpha);
+
+            __m128i* dest = (__m128i*)(out + (row * 16));
+            _mm_storeu_si128(dest + 0, _mm_unpacklo_epi16(rg_lo, ba_lo));
+            _mm_storeu_si128(dest + 1, _mm_unpackhi_epi16(rg_lo, ba_lo));
+            _mm_storeu_si128(dest + 2, _mm_unpacklo_epi16(rg_hi, ba_hi));
+            _mm_storeu_si128(dest + 3, _mm_unpackhi_epi16(rg_hi, ba_hi));
+        }
+    }
+}
+
+void CSC::RGB16_scalar(const uint32_t* in, uint16_t* out, bool dither)
+{
+    for (int i = 0; i < 16; i++)
+    {
+        for (int j = 0; j < 16; j++)
+        {
+            int index = j + (i * 16);
+            uint32_t pixel = in[index];
+            int offset = dither ? dither_matrix[i & 3][j & 3] : 0;
+
+            int r = clamp8((pixel & 0xFF) + offset) >> 3;
+            int g = clamp8(((pixel >> 8) & 0xFF) + offset) >> 3;
+            int b = clamp8(((pixel >> 16) & 0xFF) + offset) >> 3;
+            int a = (pixel >> 24) == 0x40;
+            out[index] = r | (g << 5) | (b << 10) | (a << 15);
+        }
+    }
+}
+
+//Four pixels in, four RGB16 pixels out in the low word of each dword
+static inline __m128i pack_RGB16(__m128i pixels, __m128i dither_lo, __m128i dither_hi)
+{
+    const __m128i zero = _mm_setzero_si128();
+    pixels = _mm_packus_epi16(_mm_add_epi16(_mm_unpacklo_epi8(pixels, zero), dither_lo),
+                              _mm_add_epi16(_mm_unpackhi_epi8(pixels, zero), dither_hi));
+
+    __m128i r = _mm_and_si128(_mm_srli_epi32(pixels, 3), _mm_set1_epi32(0x1F));
+    __m128i g = _mm_and_si128(_mm_srli_epi32(pixels, 6), _mm_set1_epi32(0x3E0));
+    __m128i b = _mm_and_si128(_mm_srli_epi32(pixels, 9), _mm_set1_epi32(0x7C00));
+    __m128i a = _mm_cmpeq_epi32(_mm_and_si128(pixels, _mm_set1_epi32(0xFF000000)), _mm_set1_epi32(0x40000000));
+    a = _mm_and_si128(a, _mm_set1_epi32(0x8000));
+    return _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, a));
+}
+
+//Sign-extending first keeps A from saturating in the signed pack
+static inline __m128i pack_words(__m128i lo, __m128i hi)
+{
+    lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+    hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+    return _mm_packs_epi32(lo, hi);
+}
+
+void CSC::RGB16_SSE2(const uint32_t* in, uint16_t* out, bool dither)
+{
+    //Every load holds pixels 0-3 of a four pixel stretch, so a row of the matrix lines up with each one
+    __m128i dither_lo[4], dither_hi[4];
+    for (int i = 0; i < 4; i++)
+    {
+        const int* d = dither_matrix[i];
+        if (dither)
+        {
+            dither_lo[i] = _mm_set_epi16(0, d[1], d[1], d[1], 0, d[0], d[0], d[0]);
+            dither_hi[i] = _mm_set_epi16(0, d[3], d[3], d[3], 0, d[2], d[2], d[2]);
+        }
+        else
+        {
+            dither_lo[i] = _mm_setzero_si128();
+            dither_hi[i] = _mm_setzero_si128();
+        }
+    }
+
+    for (int i = 0; i < 16; i++)
+    {
+        const __m128i* src = (const __m128i*)(in + (i * 16));
+        __m128i* dest = (__m128i*)(out + (i * 16));
+        __m128i d_lo = dither_lo[i & 3];
+        __m128i d_hi = dither_hi[i & 3];
+        for (int j = 0; j < 2; j++)
+        {
+            __m128i lo = pack_RGB16(_mm_loadu_si128(src + (j * 2)), d_lo, d_hi);
+            __m128i hi = pack_RGB16(_mm_loadu_si128(src + (j * 2) + 1), d_lo, d_hi);
+            _mm_storeu_si128(dest + j, pack_words(lo, hi));
+        }
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef CSC_HPP
+#define CSC_HPP
+#include <cstdint>
+
+/**
+  * YCbCr->RGB conversion for CSC.
+  * A macroblock is 16x16 Y followed by 8x8 Cb and 8x8 Cr. The conversion uses 14-bit fixed-point constants. Because
+  * Y is a whole number, each chroma term can be rounded on its own and added to Y afterwards, so every pixel is
+  * a 16-bit add and a saturate. The SSE2 kernels give the same output as the scalar ones.
+  * The SETTH rules: a pixel whose R, G and B are all below TH0 becomes transparent black. One whose R, G and B are
+  * all below TH1 gets alpha 0x40. Every other pixel gets 0x80.
+  **/
+class CSC
+{
+    public:
+        static void RGB32_scalar(const uint8_t* block, uint32_t* out, uint16_t TH0, uint16_t TH1);
+        static void RGB32_SSE2(const uint8_t* block, uint32_t* out, uint16_t TH0, uint16_t TH1);
+
+        //Reduces converted pixels to RGB16, optionally with the 4x4 ordered dither. A is set for alpha 0x40 pixels.
+        static void RGB16_scalar(const uint32_t* in, uint16_t* out, bool dither);
+        static void RGB16_SSE2(const uint32_t* in, uint16_t* out, bool dither);
+};
+
+#endif // CSC_HPP
@@ -0,0 +1,303 @@
+#include <cmath>
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include "idct.hpp"
+
+#ifndef PI
+#	ifdef M_PI
+#		define PI M_PI
+#	else
+#		define PI 3.14159265358979323846
+#	endif
+#endif
+
+#ifdef __GNUC__
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+static const int CONST_BITS = 15;
+static const int ROW_FRAC_BITS = 4;
+static const int ROW_SHIFT = CONST_BITS - ROW_FRAC_BITS;
+static const int COL_SHIFT = CONST_BITS + ROW_FRAC_BITS;
+
+/**
+  * basis[freq][time] is the IDCT basis. The SIMD kernels use _mm_madd_epi16, which multiplies pairs of 16-bit
+  * values and adds each pair, so their constants are laid out as pairs of adjacent frequencies:
+  * row_pairs[k][half] holds (C[2k][j], C[2k+1][j]) for the four outputs j of that half of a row, and
+  * col_pairs[i][k] holds (C[2k][i], C[2k+1][i]) repeated for every lane.
+  **/
+struct IDCT_Tables
+{
+    double basis[8][8];
+    int16_t coeffs[8][8];
+    alignas(16) int16_t row_pairs[4][2][8];
+    alignas(16) int16_t col_pairs[8][4][8];
+
+    IDCT_Tables()
+    {
+        for (int freq = 0; freq < 8; freq++)
+        {
+            double scale = (freq == 0) ? sqrt(0.125) : 0.5;
+            for (int time = 0; time < 8; time++)
+            {
+                basis[freq][time] = scale * cos((PI / 8.0) * freq * (time + 0.5));
+                coeffs[freq][time] = (int16_t)floor(basis[freq][time] * (1 << CONST_BITS) + 0.5);
+            }
+        }
+
+        for (int k = 0; k < 4; k++)
+        {
+            for (int j = 0; j < 8; j++)
+            {
+                row_pairs[k][j / 4][(j % 4) * 2] = coeffs[k * 2][j];
+                row_pairs[k][j / 4][(j % 4) * 2 + 1] = coeffs[k * 2 + 1][j];
+            }
+        }
+
+        for (int i = 0; i < 8; i++)
+        {
+            for (int k = 0; k < 4; k++)
+            {
+                for (int lane = 0; lane < 4; lane++)
+                {
+                    col_pairs[i][k][lane * 2] = coeffs[k * 2][i];
+                    col_pairs[i][k][lane * 2 + 1] = coeffs[k * 2 + 1][i];
+                }
+            }
+        }
+    }
+};
+
+static const IDCT_Tables tables;
+
+static inline int16_t saturate16(int32_t value)
+{
+    if (value > 32767)
+        return 32767;
+    if (value < -32768)
+        return -32768;
+    return value;
+}
+
+//IDCT code here taken from mpeg2decode
+//Copyright (C) 1996, MPEG Software Simulation Group. All Rights Reserved.
+void IDCT::reference(const int16_t* pUV, int16_t* pXY)
+{
+    int i, j, k, v;
+    double partial_product;
+    double tmp[64];
+
+    for (i=0; i<8; i++)
+    {
+        for (j=0; j<8; j++)
+        {
+            partial_product = 0.0;
+
+            for (k=0; k<8; k++)
+            {
+                partial_product+= tables.basis[k][j]*pUV[8*i+k];
+            }
+
+            tmp[8*i+j] = partial_product;
+        }
+    }
+
+  /* Transpose operation is integrated into address mapping by switching
+     loop order of i and j */
+
+    for (j=0; j<8; j++)
+    {
+        for (i=0; i<8; i++)
+        {
+            partial_product = 0.0;
+
+            for (k=0; k<8; k++)
+            {
+                partial_product+= tables.basis[k][i]*tmp[8*k+j];
+            }
+
+            v = (int) floor(partial_product+0.5);
+            pXY[8*i+j] = v;
+        }
+    }
+}
+//End IDCT code
+
+/**
+  * Sums are kept in uint32_t so that they wrap the way the SIMD adds do. Only corrupt streams get near that:
+  * dequantized coefficients are limited to 12 bits, and valid blocks keep the row pass well inside 16 bits.
+  **/
+void IDCT::scalar(const int16_t* in, int16_t* out)
+{
+    int16_t tmp[64];
+    for (int i = 0; i < 8; i++)
+    {
+        for (int j = 0; j < 8; j++)
+        {
+            uint32_t sum = 1 << (ROW_SHIFT - 1);
+            for (int k = 0; k < 8; k++)
+                sum += (uint32_t)(tables.coeffs[k][j] * in[i * 8 + k]);
+            tmp[i * 8 + j] = saturate16((int32_t)sum >> ROW_SHIFT);
+        }
+    }
+
+    for (int i = 0; i < 8; i++)
+    {
+        for (int j = 0; j < 8; j++)
+        {
+            uint32_t sum = 1 << (COL_SHIFT - 1);
+            for (int k = 0; k < 8; k++)
+                sum += (uint32_t)(tables.coeffs[k][i] * tmp[k * 8 + j]);
+            out[i * 8 + j] = saturate16((int32_t)sum >> COL_SHIFT);
+        }
+    }
+}
+
+void IDCT::SSE2(const int16_t* in, int16_t* out)
+{
+    const __m128i* row_pairs = (const __m128i*)tables.row_pairs;
+    const __m128i* col_pairs = (const __m128i*)tables.col_pairs;
+
+    //Row pass: every lane of pair k holds inputs 2k and 2k+1 of the row
+    __m128i tmp[8];
+    const __m128i row_round = _mm_set1_epi32(1 << (ROW_SHIFT - 1));
+    for (int i = 0; i < 8; i++)
+    {
+        __m128i row = _mm_loadu_si128((const __m128i*)&in[i * 8]);
+        __m128i pair0 = _mm_shuffle_epi32(row, _MM_SHUFFLE(0, 0, 0, 0));
+        __m128i pair1 = _mm_shuffle_epi32(row, _MM_SHUFFLE(1, 1, 1, 1));
+        __m128i pair2 = _mm_shuffle_epi32(row, _MM_SHUFFLE(2, 2, 2, 2));
+        __m128i pair3 = _mm_shuffle_epi32(row, _MM_SHUFFLE(3, 3, 3, 3));
+
+        __m128i lo = _mm_add_epi32(row_round, _mm_madd_epi16(pair0, row_pairs[0]));
+        lo = _mm_add_epi32(lo, _mm_madd_epi16(pair1, row_pairs[2]));
+        lo = _mm_add_epi32(lo, _mm_madd_epi16(pair2, row_pairs[4]));
+        lo = _mm_add_epi32(lo, _mm_madd_epi16(pair3, row_pairs[6]));
+
+        __m128i hi = _mm_add_epi32(row_round, _mm_madd_epi16(pair0, row_pairs[1]));
+        hi = _mm_add_epi32(hi, _mm_madd_epi16(pair1, row_pairs[3]));
+        hi = _mm_add_epi32(hi, _mm_madd_epi16(pair2, row_pairs[5]));
+        hi = _mm_add_epi32(hi, _mm_madd_epi16(pair3, row_pairs[7]));
+
+        tmp[i] = _mm_packs_epi32(_mm_srai_epi32(lo, ROW_SHIFT), _mm_srai_epi32(hi, ROW_SHIFT));
+    }
+
+    //Column pass: interleave rows 2k and 2k+1 so that each lane holds one column's pair
+    __m128i pairs_lo[4], pairs_hi[4];
+    for (int k = 0; k < 4; k++)
+    {
+        pairs_lo[k] = _mm_unpacklo_epi16(tmp[k * 2], tmp[k * 2 + 1]);
+        pairs_hi[k] = _mm_unpackhi_epi16(tmp[k * 2], tmp[k * 2 + 1]);
+    }
+
+    const __m128i col_round = _mm_set1_epi32(1 << (COL_SHIFT - 1));
+    for (int i = 0; i < 8; i++)
+    {
+        const __m128i* constants = &col_pairs[i * 4];
+        __m128i lo = col_round, hi = col_round;
+        for (int k = 0; k < 4; k++)
+        {
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(pairs_lo[k], constants[k]));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(pairs_hi[k], constants[k]));
+        }
+        __m128i result = _mm_packs_epi32(_mm_srai_epi32(lo, COL_SHIFT), _mm_srai_epi32(hi, COL_SHIFT));
+        _mm_storeu_si128((__m128i*)&out[i * 8], result);
+    }
+}
+
+//Same as SSE2, with two rows in flight at once: one in each 128-bit lane
+TARGET_AVX2 void IDCT::AVX2(const int16_t* in, int16_t* out)
+{
+    const __m128i* row_pairs = (const __m128i*)tables.row_pairs;
+    const __m128i* col_pairs = (const __m128i*)tables.col_pairs;
+
+    __m256i row_constants[8];
+    for (int i = 0; i < 8; i++)
+        row_constants[i] = _mm256_broadcastsi128_si256(_mm_load_si128(&row_pairs[i]));
+
+    alignas(32) int16_t tmp[64];
+    const __m256i row_round = _mm256_set1_epi32(1 << (ROW_SHIFT - 1));
+    for (int i = 0; i < 8; i += 2)
+    {
+        __m256i rows = _mm256_loadu_si256((const __m256i*)&in[i * 8]);
+        __m256i pair0 = _mm256_shuffle_epi32(rows, _MM_SHUFFLE(0, 0, 0, 0));
+        __m256i pair1 = _mm256_shuffle_epi32(rows, _MM_SHUFFLE(1, 1, 1, 1));
+        __m256i pair2 = _mm256_shuffle_epi32(rows, _MM_SHUFFLE(2, 2, 2, 2));
+        __m256i pair3 = _mm256_shuffle_epi32(rows, _MM_SHUFFLE(3, 3, 3, 3));
+
+        __m256i lo = _mm256_add_epi32(row_round, _mm256_madd_epi16(pair0, row_constants[0]));
+        lo = _mm256_add_epi32(lo, _mm256_madd_epi16(pair1, row_constants[2]));
+        lo = _mm256_add_epi32(lo, _mm256_madd_epi16(pair2, row_constants[4]));
+        lo = _mm256_add_epi32(lo, _mm256_madd_epi16(pair3, row_constants[6]));
+
+        __m256i hi = _mm256_add_epi32(row_round, _mm256_madd_epi16(pair0, row_constants[1]));
+        hi = _mm256_add_epi32(hi, _mm256_madd_epi16(pair1, row_constants[3]));
+        hi = _mm256_add_epi32(hi, _mm256_madd_epi16(pair2, row_constants[5]));
+        hi = _mm256_add_epi32(hi, _mm256_madd_epi16(pair3, row_constants[7]));
+
+        __m256i result = _mm256_packs_epi32(_mm256_srai_epi32(lo, ROW_SHIFT), _mm256_srai_epi32(hi, ROW_SHIFT));
+        _mm256_store_si256((__m256i*)&tmp[i * 8], result);
+    }
+
+    __m256i pairs_lo[4], pairs_hi[4];
+    for (int k = 0; k < 4; k++)
+    {
+        __m128i even = _mm_load_si128((const __m128i*)&tmp[k * 16]);
+        __m128i odd = _mm_load_si128((const __m128i*)&tmp[k * 16 + 8]);
+        pairs_lo[k] = _mm256_broadcastsi128_si256(_mm_unpacklo_epi16(even, odd));
+        pairs_hi[k] = _mm256_broadcastsi128_si256(_mm_unpackhi_epi16(even, odd));
+    }
+
+    const __m256i col_round = _mm256_set1_epi32(1 << (COL_SHIFT - 1));
+    for (int i = 0; i < 8; i += 2)
+    {
+        __m256i lo = col_round, hi = col_round;
+        for (int k = 0; k < 4; k++)
+        {
+            __m256i constants = _mm256_inserti128_si256(_mm256_castsi128_si256(col_pairs[i * 4 + k]),
+                                                        col_pairs[(i + 1) * 4 + k], 1);
+            lo = _mm256_add_epi32(lo, _mm256_madd_epi16(pairs_lo[k], constants));
+            hi = _mm256_add_epi32(hi, _mm256_madd_epi16(pairs_hi[k], constants));
+        }
+        __m256i result = _mm256_packs_epi32(_mm256_srai_epi32(lo, COL_SHIFT), _mm256_srai_epi32(hi, COL_SHIFT));
+        _mm256_storeu_si256((__m256i*)&out[i * 8], result);
+    }
+}
+
+static bool host_has_AVX2()
+{
+#if defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    //The OS has to save the YMM registers too
+    if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 0x6) != 0x6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return info[1] & (1 << 5);
+#else
+    return false;
+#endif
+}
+
+IDCT::Kernel IDCT::select(const char*& name)
+{
+    if (host_has_AVX2())
+    {
+        name = "AVX2";
+        return &IDCT::AVX2;
+    }
+    //SSE2 is part of x86-64, and the GS already relies on it
+    name = "SSE2";
+    return &IDCT::SSE2;
+}
@@ -0,0 +1,27 @@
+#ifndef IDCT_HPP
+#define IDCT_HPP
+#include <cstdint>
+
+/**
+  * 8x8 inverse DCTs for the IPU.
+  * reference is the double-precision separable transform the IPU used to run. The others are one fixed-point
+  * transform: each pass is a matrix multiply with the basis scaled to 15-bit constants, and the row pass keeps four
+  * fractional bits for the column pass. That passes the IEEE 1180 accuracy tests against reference. Because the
+  * math is plain 16x16->32 multiply-adds, the SSE2 and AVX2 kernels give bit-identical output to the scalar one, so
+  * which one runs never changes what a game sees.
+  **/
+class IDCT
+{
+    public:
+        typedef void (*Kernel)(const int16_t* in, int16_t* out);
+
+        static void reference(const int16_t* in, int16_t* out);
+        static void scalar(const int16_t* in, int16_t* out);
+        static void SSE2(const int16_t* in, int16_t* out);
+        static void AVX2(const int16_t* in, int16_t* out);
+
+        //Picks the fastest kernel the host CPU supports
+        static Kernel select(const char*& name);
+};
+
+#endif // IDCT_HPP
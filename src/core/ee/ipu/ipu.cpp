@@ -1,4 +1,3 @@
-#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -58,28 +57,60 @@ uint32_t ImageProcessingUnit::quantizer_nonlinear[0x20] =
 
 ImageProcessingUnit::ImageProcessingUnit(INTC* intc) : intc(intc)
 {
-    //Generate CrCb->RGB conversion map
-    for (unsigned int i = 0; i < 0x40; i += 0x8)
+    const char* IDCT_name;
+    IDCT_kernel = IDCT::select(IDCT_name);
+    printf("[IPU] Using %s IDCT\n", IDCT_name);
+
+    async = false;
+    speculating = false;
+    worker_stop = false;
+    worker_stepping = false;
+    ahead_dirty = false;
+    ahead_changed = false;
+}
+
+ImageProcessingUnit::~ImageProcessingUnit()
+{
+    set_async(false);
+}
+
+void ImageProcessingUnit::set_async(bool enabled)
+{
+    if (enabled == async)
+        return;
+
+    if (enabled)
     {
-        for (unsigned int j = 0; j < 0x10; j += 2)
+        ahead.reset(new ImageProcessingUnit(nullptr));
+        worker_stop = false;
+        worker_thread = std::thread(&ImageProcessingUnit::worker_loop, this);
+        async = true;
+        if (ctrl.busy && decodes_ahead(command))
+            start_ahead();
+    }
+    else
+    {
+        if (speculating)
+            stop_ahead();
         {
-            int index = j + (i * 4);
-            crcb_map[index + 0x00] = (j / 2) + i;
-            crcb_map[index + 0x01] = (j / 2) + i;
-
-            crcb_map[index + 0x10] = (j / 2) + i;
-            crcb_map[index + 0x11] = (j / 2) + i;
+            std::lock_guard<std::mutex> lock(worker_mutex);
+            worker_stop = true;
         }
+        worker_cv.notify_one();
+        worker_thread.join();
+        ahead.reset();
+        async = false;
     }
 }
 
 void ImageProcessingUnit::reset()
 {
+    if (speculating)
+        stop_ahead();
     dct_coeff = nullptr;
     VDEC_table = nullptr;
     in_FIFO.reset();
     out_FIFO.reset();
-    prepare_IDCT();
 
     ctrl.error_code = false;
     ctrl.start_code = false;
@@ -97,76 +128,84 @@ void ImageProcessingUnit::run()
 {
     if (ctrl.busy)
     {
-        switch (command)
-        {
-            case 0x00:
-                in_FIFO.reset();
+        if (speculating)
+            publish_ahead();
+        else
+            execute_command();
+    }
+}
+
+void ImageProcessingUnit::execute_command()
+{
+    switch (command)
+    {
+        case 0x00:
+            in_FIFO.reset();
+            ctrl.busy = false;
+            in_FIFO.bit_pointer = command_option & 0x7F;
+            break;
+        case 0x01:
+            finish_command();
+            break;
+        case 0x02:
+            if (in_FIFO.size())
+            {
+                if (process_BDEC())
+                    finish_command();
+            }
+            break;
+        case 0x03:
+            if (in_FIFO.size())
+                process_VDEC();
+            break;
+        case 0x04:
+            if (in_FIFO.size())
+                process_FDEC();
+            break;
+        case 0x05:
+            while (bytes_left && in_FIFO.size())
+            {
+                uint128_t quad = in_FIFO.front();
+                in_FIFO.pop();
+                int index = 64 - bytes_left;
+                if (command_option & (1 << 27))
+                    *(uint128_t*)&nonintra_IQ[index] = quad;
+                else
+                    *(uint128_t*)&intra_IQ[index] = quad;
+                bytes_left -= 16;
+            }
+            if (bytes_left <= 0)
                 ctrl.busy = false;
-                in_FIFO.bit_pointer = command_option & 0x7F;
-                break;
-            case 0x01:
-                finish_command();
-                break;
-            case 0x02:
-                if (in_FIFO.f.size())
-                {
-                    if (process_BDEC())
-                        finish_command();
-                }
-                break;
-            case 0x03:
-                if (in_FIFO.f.size())
-                    process_VDEC();
-                break;
-            case 0x04:
-                if (in_FIFO.f.size())
-                    process_FDEC();
-                break;
-            case 0x05:
-                while (bytes_left && in_FIFO.f.size())
-                {
-                    uint128_t quad = in_FIFO.f.front();
-                    in_FIFO.f.pop();
-                    int index = 64 - bytes_left;
-                    if (command_option & (1 << 27))
-                        *(uint128_t*)&nonintra_IQ[index] = quad;
-                    else
-                        *(uint128_t*)&intra_IQ[index] = quad;
-                    bytes_left -= 16;
-                }
-                if (bytes_left <= 0)
-                    ctrl.busy = false;
-                break;
-            case 0x06:
-                while (bytes_left && in_FIFO.f.size())
-                {
-                    uint128_t quad = in_FIFO.f.front();
-                    in_FIFO.f.pop();
-                    for (int i = 0; i < 8; i++)
-                    {
-                        int index = (32 - bytes_left) >> 1;
-                        VQCLUT[index] = quad._u16[index];
-                        bytes_left -= 2;
-                    }
-                }
-                if (bytes_left <= 0)
-                    ctrl.busy = false;
-                break;
-            case 0x07:
-                if (in_FIFO.f.size())
+            break;
+        case 0x06:
+            while (bytes_left && in_FIFO.size())
+            {
+                uint128_t quad = in_FIFO.front();
+                in_FIFO.pop();
+                for (int i = 0; i < 8; i++)
                 {
-                    if (process_CSC())
-                        finish_command();
+                    int index = (32 - bytes_left) >> 1;
+                    VQCLUT[index] = quad._u16[index];
+                    bytes_left -= 2;
                 }
-                break;
-            case 0x09:
-                TH0 = command_option & 0x1FF;
-                TH1 = (command_option >> 16) & 0x1FF;
-                finish_command();
-                break;
-            default:
-                Errors::die("[IPU] Unrecognized command $%02X\n", command);
-        }
+            }
+            if (bytes_left <= 0)
+                ctrl.busy = false;
+            break;
+        case 0x07:
+            if (in_FIFO.size())
+            {
+                if (process_CSC())
+                    finish_command();
+            }
+            break;
+        case 0x09:
+            TH0 = command_option & 0x1FF;
+            TH1 = (command_option >> 16) & 0x1FF;
+            finish_command();
+            break;
+        default:
+            Errors::die("[IPU] Unrecognized command $%02X\n", command);
     }
 }
 
@@ -174,7 +213,196 @@ void ImageProcessingUnit::finish_command()
 {
     ctrl.busy = false;
     command_decoding = false;
-    intc->assert_IRQ((int)Interrupt::IPU);
+    //ahead has no INTC, and neither does the IPU benchmark; ahead's IRQ is raised when its result is published
+    if (intc)
+        intc->assert_IRQ((int)Interrupt::IPU);
+}
+
+bool ImageProcessingUnit::decodes_ahead(uint8_t command)
+{
+    switch (command)
+    {
+        case 0x02:
+        case 0x03:
+        case 0x04:
+        case 0x07:
+            return true;
+        default:
+            return false;
+    }
+}
+
+//Everything the commands read or write, other than the output FIFO
+void ImageProcessingUnit::copy_decode_state(const ImageProcessingUnit& other)
+{
+    dct_coeff = nullptr;
+    if (other.dct_coeff == &other.dct_coeff0)
+        dct_coeff = &dct_coeff0;
+    else if (other.dct_coeff == &other.dct_coeff1)
+        dct_coeff = &dct_coeff1;
+
+    const VLC_Table* other_tables[] = {&other.macroblock_increment, &other.macroblock_I_pic, &other.macroblock_P_pic,
+                                       &other.macroblock_B_pic, &other.motioncode};
+    VLC_Table* tables[] = {&macroblock_increment, &macroblock_I_pic, &macroblock_P_pic, &macroblock_B_pic,
+                           &motioncode};
+    VDEC_table = nullptr;
+    for (int i = 0; i < 5; i++)
+    {
+        if (other.VDEC_table == other_tables[i])
+            VDEC_table = tables[i];
+    }
+
+    in_FIFO = other.in_FIFO;
+    memcpy(intra_IQ, other.intra_IQ, sizeof(intra_IQ));
+    memcpy(nonintra_IQ, other.nonintra_IQ, sizeof(nonintra_IQ));
+    memcpy(VQCLUT, other.VQCLUT, sizeof(VQCLUT));
+    TH0 = other.TH0;
+    TH1 = other.TH1;
+
+    ctrl = other.ctrl;
+    command_decoding = other.command_decoding;
+    command = other.command;
+    command_option = other.command_option;
+    command_output = other.command_output;
+    bytes_left = other.bytes_left;
+
+    bdec = other.bdec;
+    if (other.bdec.cur_block)
+        bdec.cur_block = bdec.blocks[(other.bdec.cur_block - other.bdec.blocks[0]) / 64];
+    vdec_state = other.vdec_state;
+    fdec_state = other.fdec_state;
+    csc = other.csc;
+}
+
+void ImageProcessingUnit::start_ahead()
+{
+    std::unique_lock<std::mutex> lock(worker_mutex);
+    worker_idle.wait(lock, [this] { return !worker_stepping; });
+    ahead->copy_decode_state(*this);
+    ahead->out_FIFO.reset();
+    worker_input.clear();
+    worker_error = nullptr;
+    //The FIFO may already hold enough to get going
+    ahead_dirty = true;
+    ahead_changed = false;
+    speculating = true;
+    worker_cv.notify_one();
+}
+
+//Drops whatever ahead has done. This IPU's state is still exactly what it would be without the worker.
+void ImageProcessingUnit::stop_ahead()
+{
+    std::unique_lock<std::mutex> lock(worker_mutex);
+    worker_idle.wait(lock, [this] { return !worker_stepping; });
+    speculating = false;
+    worker_input.clear();
+    worker_error = nullptr;
+}
+
+//Feeds ahead the input it hasn't seen and lets it decode. The caller must be the only thread touching ahead.
+void ImageProcessingUnit::step_ahead(std::vector<uint128_t>& input)
+{
+    for (size_t i = 0; i < input.size(); i++)
+        ahead->in_FIFO.push(input[i]);
+    input.clear();
+    if (ahead->ctrl.busy)
+        ahead->execute_command();
+}
+
+void ImageProcessingUnit::publish_ahead()
+{
+    std::unique_lock<std::mutex> lock(worker_mutex);
+    worker_idle.wait(lock, [this] { return !worker_stepping; });
+
+    //Finish off anything the worker hasn't got to yet
+    if (ahead_dirty && !worker_error)
+    {
+        ahead_dirty = false;
+        ahead_changed = true;
+        try
+        {
+            step_ahead(worker_input);
+        }
+        catch (...)
+        {
+            worker_error = std::current_exception();
+        }
+    }
+
+    //Errors surface here, where the synchronous IPU would have hit them
+    if (worker_error)
+    {
+        std::exception_ptr error = worker_error;
+        worker_error = nullptr;
+        speculating = false;
+        std::rethrow_exception(error);
+    }
+
+    if (!ahead_changed)
+        return;
+    ahead_changed = false;
+
+    copy_decode_state(*ahead);
+    while (ahead->out_FIFO.size())
+    {
+        out_FIFO.push(ahead->out_FIFO.front());
+        ahead->out_FIFO.pop();
+    }
+
+    if (!ctrl.busy)
+    {
+        speculating = false;
+        if (intc)
+            intc->assert_IRQ((int)Interrupt::IPU);
+    }
+}
+
+void ImageProcessingUnit::worker_loop()
+{
+    std::vector<uint128_t> input;
+    std::unique_lock<std::mutex> lock(worker_mutex);
+    while (true)
+    {
+        worker_cv.wait(lock, [this] { return worker_stop || (speculating && ahead_dirty && !worker_error); });
+        if (worker_stop)
+            return;
+
+        //Swapping keeps both buffers' capacity, so steady-state decoding doesn't allocate
+        input.swap(worker_input);
+        ahead_dirty = false;
+        worker_stepping = true;
+        lock.unlock();
+
+        std::exception_ptr error;
+        try
+        {
+            step_ahead(input);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+
+        lock.lock();
+        worker_stepping = false;
+        ahead_changed = true;
+        if (error)
+            worker_error = error;
+        worker_idle.notify_all();
+    }
+}
+
+//Waits for all of the FB bits to arrive before skipping them, like every other read from the FIFO
+bool ImageProcessingUnit::skip_FB()
+{
+    int bits = command_option & 0x3F;
+    if (bits > 32)
+        bits = 32;
+    uint32_t skipped;
+    if (!in_FIFO.get_bits(skipped, bits))
+        return false;
+    in_FIFO.advance_stream(bits);
+    return true;
 }
 
 bool ImageProcessingUnit::process_BDEC()
@@ -184,7 +412,8 @@ bool ImageProcessingUnit::process_BDEC()
         switch (bdec.state)
         {
             case BDEC_STATE::ADVANCE:
-                in_FIFO.advance_stream(command_option & 0x3F);
+                if (!skip_FB())
+                    return false;
                 bdec.state = BDEC_STATE::GET_CBP;
                 break;
             case BDEC_STATE::GET_CBP:
@@ -271,7 +500,7 @@ bool ImageProcessingUnit::process_BDEC()
 
                 int16_t temp[0x40];
                 memcpy(temp, bdec.cur_block, 0x40 * sizeof(int16_t));
-                perform_IDCT(temp, bdec.cur_block);
+                IDCT_kernel(temp, bdec.cur_block);
                 bdec.state = BDEC_STATE::LOAD_NEXT_BLOCK;
             }
                 break;
@@ -290,29 +519,29 @@ bool ImageProcessingUnit::process_BDEC()
                 for (int i = 0; i < 8; i++)
                 {
                     memcpy(quad._u8, bdec.blocks[0] + (i * 8), sizeof(int16_t) * 8);
-                    out_FIFO.f.push(quad);
+                    out_FIFO.push(quad);
                     memcpy(quad._u8, bdec.blocks[1] + (i * 8), sizeof(int16_t) * 8);
-                    out_FIFO.f.push(quad);
+                    out_FIFO.push(quad);
                 }
 
                 for (int i = 0; i < 8; i++)
                 {
                     memcpy(quad._u8, bdec.blocks[2] + (i * 8), sizeof(int16_t) * 8);
-                    out_FIFO.f.push(quad);
+                    out_FIFO.push(quad);
                     memcpy(quad._u8, bdec.blocks[3] + (i * 8), sizeof(int16_t) * 8);
-                    out_FIFO.f.push(quad);
+                    out_FIFO.push(quad);
                 }
 
                 for (int i = 0; i < 8; i++)
                 {
                     memcpy(quad._u8, bdec.blocks[4] + (i * 8), sizeof(int16_t) * 8);
-                    out_FIFO.f.push(quad);
+                    out_FIFO.push(quad);
                 }
 
                 for (int i = 0; i < 8; i++)
                 {
                     memcpy(quad._u8, bdec.blocks[5] + (i * 8), sizeof(int16_t) * 8);
-                    out_FIFO.f.push(quad);
+                    out_FIFO.push(quad);
                 }
 
                 if (/*check_start_code*/ true)
@@ -440,73 +669,6 @@ void ImageProcessingUnit::dequantize(int16_t *block)
     }
 }
 
-//IDCT code here taken from mpeg2decode
-//Copyright (C) 1996, MPEG Software Simulation Group. All Rights Reserved.
-
-#ifndef PI
-#	ifdef M_PI
-#		define PI M_PI
-#	else
-#		define PI 3.14159265358979323846
-#	endif
-#endif
-void ImageProcessingUnit::prepare_IDCT()
-{
-    int freq, time;
-    double scale;
-
-    for (freq=0; freq < 8; freq++)
-    {
-        scale = (freq == 0) ? sqrt(0.125) : 0.5;
-        for (time=0; time<8; time++)
-        {
-            IDCT_table[freq][time] = scale*cos((PI/8.0)*freq*(time + 0.5));
-        }
-    }
-}
-
-void ImageProcessingUnit::perform_IDCT(int16_t* pUV, int16_t* pXY)
-{
-    int i, j, k, v;
-    double partial_product;
-    double tmp[64];
-
-    for (i=0; i<8; i++)
-    {
-        for (j=0; j<8; j++)
-        {
-            partial_product = 0.0;
-
-            for (k=0; k<8; k++)
-            {
-                partial_product+= IDCT_table[k][j]*pUV[8*i+k];
-            }
-
-            tmp[8*i+j] = partial_product;
-        }
-    }
-
-  /* Transpose operation is integrated into address mapping by switching
-     loop order of i and j */
-
-    for (j=0; j<8; j++)
-    {
-        for (i=0; i<8; i++)
-        {
-            partial_product = 0.0;
-
-            for (k=0; k<8; k++)
-            {
-                partial_product+= IDCT_table[k][i]*tmp[8*k+j];
-            }
-
-            v = (int) floor(partial_product+0.5);
-            pXY[8*i+j] = v;
-        }
-    }
-}
-
-//End IDCT code
 
 bool ImageProcessingUnit::BDEC_read_coeffs()
 {
@@ -668,7 +830,8 @@ void ImageProcessingUnit::process_VDEC()
         switch (vdec_state)
         {
             case VDEC_STATE::ADVANCE:
-                in_FIFO.advance_stream(command_option & 0x3F);
+                if (!skip_FB())
+                    return;
                 vdec_state = VDEC_STATE::DECODE;
                 break;
             case VDEC_STATE::DECODE:
@@ -692,7 +855,8 @@ void ImageProcessingUnit::process_FDEC()
         switch (fdec_state)
         {
             case VDEC_STATE::ADVANCE:
-                in_FIFO.advance_stream(command_option & 0x3F);
+                if (!skip_FB())
+                    return;
                 fdec_state = VDEC_STATE::DECODE;
                 break;
             case VDEC_STATE::DECODE:
@@ -724,80 +888,34 @@ bool ImageProcessingUnit::process_CSC()
                     csc.state = CSC_STATE::DONE;
                 break;
             case CSC_STATE::READ:
-                if (csc.block_index == BLOCK_SIZE)
-                    csc.state = CSC_STATE::CONVERT;
-                else
-                {
-                    uint32_t value;
-                    if (!in_FIFO.get_bits(value, 8))
-                        return false;
-                    in_FIFO.advance_stream(8);
-                    csc.block[csc.block_index] = value & 0xFF;
-                    csc.block_index++;
-                }
+                csc.block_index += in_FIFO.read_bytes(csc.block + csc.block_index, BLOCK_SIZE - csc.block_index);
+                if (csc.block_index < BLOCK_SIZE)
+                    return false;
+                csc.state = CSC_STATE::CONVERT;
                 break;
             case CSC_STATE::CONVERT:
             {
                 uint32_t pixels[0x100];
+                CSC::RGB32_SSE2(csc.block, pixels, TH0, TH1);
 
-                uint8_t* lum_block = csc.block;
-                uint8_t* cb_block = csc.block + 0x100;
-                uint8_t* cr_block = csc.block + 0x140;
-
-                uint32_t alpha_thresh0 = (TH0 & 0xFF) | ((TH0 & 0xFF) << 8) | ((TH0 & 0xFF) << 16);
-                uint32_t alpha_thresh1 = (TH1 & 0xFF) | ((TH1 & 0xFF) << 8) | ((TH1 & 0xFF) << 16);
-
-                for (int i = 0; i < 16; i++)
+                uint128_t quad;
+                if (csc.use_RGB16)
                 {
-                    for (int j = 0; j < 16; j++)
+                    uint16_t packed[0x100];
+                    CSC::RGB16_SSE2(pixels, packed, csc.use_dithering);
+                    for (int i = 0; i < 0x100 / 8; i++)
                     {
-                        int index = j + (i * 16);
-                        float lum = lum_block[index];
-                        float cb = cb_block[crcb_map[index]];
-                        float cr = cr_block[crcb_map[index]];
-
-                        float r = lum + 1.402f * (cr - 128);
-                        float g = lum - 0.34414f * (cb - 128) - 0.71414f * (cr - 128);
-                        float b = lum + 1.772f * (cb - 128);
-
-                        if (r < 0)
-                            r = 0;
-                        if (r > 255)
-                            r = 255;
-                        if (g < 0)
-                            g = 0;
-                        if (g > 255)
-                            g = 255;
-                        if (b < 0)
-                            b = 0;
-                        if (b > 255)
-                            b = 255;
-
-                        uint32_t color = (uint8_t)r;
-                        color |= ((uint8_t)g) << 8;
-                        color |= ((uint8_t)b) << 16;
-
-                        uint32_t alpha;
-                        if (color < alpha_thresh0)
-                            alpha = 0;
-                        else if (color < alpha_thresh1)
-                            alpha = 1 << 30;
-                        else
-                            alpha = 1 << 31;
-
-                        pixels[index] = color | alpha;
-                        //printf("Pixel: $%08X (%d, %d)\n", pixels[index], i, j);
+                        memcpy(&quad, packed + (i * 8), sizeof(quad));
+                        out_FIFO.push(quad);
                     }
                 }
-
-                uint128_t quad;
-                for (int i = 0; i < 0x100 / 4; i++)
+                else
                 {
-                    for (int j = 0; j < 4; j++)
+                    for (int i = 0; i < 0x100 / 4; i++)
                     {
-                        quad._u32[j] = pixels[j + (i * 4)];
+                        memcpy(&quad, pixels + (i * 4), sizeof(quad));
+                        out_FIFO.push(quad);
                     }
-                    out_FIFO.f.push(quad);
                 }
                 csc.macroblocks--;
                 csc.state = CSC_STATE::BEGIN;
@@ -821,7 +939,7 @@ uint64_t ImageProcessingUnit::read_command()
 uint32_t ImageProcessingUnit::read_control()
 {
     uint32_t reg = 0;
-    reg |= in_FIFO.f.size();
+    reg |= in_FIFO.size();
     reg |= ctrl.coded_block_pattern << 8;
     reg |= ctrl.error_code << 14;
     reg |= ctrl.start_code << 15;
@@ -838,7 +956,7 @@ uint32_t ImageProcessingUnit::read_control()
 uint32_t ImageProcessingUnit::read_BP()
 {
     uint32_t reg = 0;
-    uint8_t fifo_size = in_FIFO.f.size();
+    uint8_t fifo_size = in_FIFO.size();
 
     //Check for FP bit
     if (in_FIFO.bit_pointer && fifo_size)
@@ -855,7 +973,7 @@ uint32_t ImageProcessingUnit::read_BP()
 uint64_t ImageProcessingUnit::read_top()
 {
     uint64_t reg = 0;
-    int max_bits = (in_FIFO.f.size() * 128) - in_FIFO.bit_pointer;
+    int max_bits = (in_FIFO.size() * 128) - in_FIFO.bit_pointer;
     if (max_bits > 32)
         max_bits = 32;
     uint32_t next_data;
@@ -912,11 +1030,14 @@ void ImageProcessingUnit::write_command(uint32_t value)
                 csc.state = CSC_STATE::BEGIN;
                 csc.macroblocks = command_option & 0x3FF;
                 csc.use_RGB16 = command_option & (1 << 27);
+                csc.use_dithering = command_option & (1 << 26);
                 break;
             case 0x09:
                 printf("[IPU] SETTH\n");
                 break;
         }
+        if (async && decodes_ahead(command))
+            start_ahead();
     }
     else
     {
@@ -927,6 +1048,9 @@ void ImageProcessingUnit::write_command(uint32_t value)
 void ImageProcessingUnit::write_control(uint32_t value)
 {
     printf("[IPU] Write control: $%08X\n", value);
+    //ahead decoded with the old settings, so it starts over from here
+    if (speculating)
+        stop_ahead();
     ctrl.intra_DC_precision = (value >> 16) & 0x3;
     ctrl.alternate_scan = value & (1 << 20);
     ctrl.intra_VLC_table = value & (1 << 21);
@@ -940,31 +1064,41 @@ void ImageProcessingUnit::write_control(uint32_t value)
         in_FIFO.bit_pointer = 0;
         bytes_left = 0;
     }
+    if (async && ctrl.busy && decodes_ahead(command))
+        start_ahead();
 }
 
 bool ImageProcessingUnit::can_read_FIFO()
 {
-    return out_FIFO.f.size() > 0;
+    return out_FIFO.size() > 0;
 }
 
 bool ImageProcessingUnit::can_write_FIFO()
 {
-    return in_FIFO.f.size() < 8;
+    return in_FIFO.size() < 8;
 }
 
 uint128_t ImageProcessingUnit::read_FIFO()
 {
-    uint128_t quad = out_FIFO.f.front();
-    out_FIFO.f.pop();
+    uint128_t quad = out_FIFO.front();
+    out_FIFO.pop();
     return quad;
 }
 
 void ImageProcessingUnit::write_FIFO(uint128_t quad)
 {
     printf("[IPU] Write FIFO: $%08X_%08X_%08X_%08X\n", quad._u32[3], quad._u32[2], quad._u32[1], quad._u32[0]);
-    if (in_FIFO.f.size() >= 8)
+    if (in_FIFO.size() >= 8)
     {
         Errors::die("[IPU] Error: data sent to IPU exceeding FIFO limit!\n");
     }
-    in_FIFO.f.push(quad);
+    in_FIFO.push(quad);
+
+    if (speculating)
+    {
+        std::lock_guard<std::mutex> lock(worker_mutex);
+        worker_input.push_back(quad);
+        ahead_dirty = true;
+        worker_cv.notify_one();
+    }
 }
@@ -1,7 +1,14 @@
 #ifndef IPU_HPP
 #define IPU_HPP
+#include <condition_variable>
 #include <cstdint>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
 #include <queue>
+#include <thread>
+#include <vector>
 
 #define BLOCK_SIZE 0x180
 
@@ -10,6 +17,8 @@
 #include "codedblockpattern.hpp"
 #include "dct_coeff_table0.hpp"
 #include "dct_coeff_table1.hpp"
+#include "csc.hpp"
+#include "idct.hpp"
 #include "lumtable.hpp"
 #include "mac_addr_inc.hpp"
 #include "mac_i_pic.hpp"
@@ -99,6 +108,7 @@ struct CSC_Command
     CSC_STATE state;
     int macroblocks;
     bool use_RGB16;
+    bool use_dithering;
 
     uint8_t block[BLOCK_SIZE];
     int block_index;
@@ -106,6 +116,16 @@ struct CSC_Command
 
 class INTC;
 
+/**
+  * In async mode, BDEC, VDEC, FDEC and CSC are decoded ahead on a worker thread, as soon as input reaches the FIFO.
+  * The worker runs a second IPU (ahead) that starts from a copy of this one's state and is fed the same quadwords.
+  * Nothing the EE can see changes until run(), the point where the synchronous IPU would have done the same work.
+  * There, the EE thread catches ahead up on any input the worker hasn't reached, then copies its state back.
+  * Because the state machines resume cleanly wherever the input runs out, decoding in smaller pieces gives the same
+  * result as doing it all at once, so busy, BP, the output FIFO and the IRQ all change exactly when they used to.
+  * This IPU's state stays authoritative throughout. A control write in the middle of a command throws away ahead's
+  * progress and starts it again from that state, and save states never see ahead at all.
+  **/
 class ImageProcessingUnit
 {
     private:
@@ -128,8 +148,6 @@ class ImageProcessingUnit
         uint16_t VQCLUT[16];
         uint32_t TH0, TH1;
 
-        unsigned int crcb_map[0x100];
-
         static uint32_t inverse_scan_zigzag[0x40];
         static uint32_t inverse_scan_alternate[0x40];
 
@@ -147,15 +165,33 @@ class ImageProcessingUnit
         VDEC_STATE vdec_state, fdec_state;
         CSC_Command csc;
 
-        double IDCT_table[8][8];
+        IDCT::Kernel IDCT_kernel;
+
+        //Async decoding. ahead and the worker_* members are guarded by worker_mutex.
+        bool async, speculating;
+        std::unique_ptr<ImageProcessingUnit> ahead;
+        std::thread worker_thread;
+        std::mutex worker_mutex;
+        std::condition_variable worker_cv, worker_idle;
+        std::vector<uint128_t> worker_input;
+        bool worker_stop, worker_stepping, ahead_dirty, ahead_changed;
+        std::exception_ptr worker_error;
 
+        void execute_command();
         void finish_command();
 
+        static bool decodes_ahead(uint8_t command);
+        void copy_decode_state(const ImageProcessingUnit& other);
+        void start_ahead();
+        void stop_ahead();
+        void publish_ahead();
+        void step_ahead(std::vector<uint128_t>& input);
+        void worker_loop();
+
+        bool skip_FB();
         bool process_BDEC();
         void inverse_scan(int16_t* block);
         void dequantize(int16_t* block);
-        void prepare_IDCT();
-        void perform_IDCT(int16_t* pUV, int16_t* pXY);
         bool BDEC_read_coeffs();
         bool BDEC_read_diff();
 
@@ -164,8 +200,12 @@ class ImageProcessingUnit
         bool process_CSC();
     public:
         ImageProcessingUnit(INTC* intc);
+        ~ImageProcessingUnit();
 
+        void set_async(bool enabled);
         void reset();
+        void load_state(std::ifstream& state);
+        void save_state(std::ofstream& state);
         void run();
 
         uint64_t read_command();
@@ -1,35 +1,107 @@
+#include <algorithm>
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
 #include "ipu_fifo.hpp"
 #include "../../errors.hpp"
 
+IPU_FIFO::IPU_FIFO() : ring(32)
+{
+    head = 0;
+    count = 0;
+    bit_pointer = 0;
+}
+
+void IPU_FIFO::push(const uint128_t& quad)
+{
+    if (count == ring.size())
+    {
+        //Unwrap the ring into the bottom half of one twice the size
+        std::vector<uint128_t> bigger(ring.size() * 2);
+        for (uint32_t i = 0; i < count; i++)
+            bigger[i] = ring[(head + i) & (ring.size() - 1)];
+        ring.swap(bigger);
+        head = 0;
+    }
+    ring[(head + count) & (ring.size() - 1)] = quad;
+    count++;
+}
+
+void IPU_FIFO::pop()
+{
+    head = (head + 1) & (ring.size() - 1);
+    count--;
+}
+
 bool IPU_FIFO::get_bits(uint32_t &data, int bits)
 {
-    int bits_available = (f.size() * 128) - bit_pointer;
+    int bits_available = (count * 128) - bit_pointer;
 
     if (bits_available < bits)
         return false;
+    if (!bits)
+    {
+        data = 0;
+        return true;
+    }
 
-    std::queue<uint128_t> temp_fifo = f;
-    uint8_t temp[32];
-    *(uint128_t*)&temp[0] = temp_fifo.front();
-    temp_fifo.pop();
-    *(uint128_t*)&temp[16] = temp_fifo.front();
-
-    uint8_t blorp[8];
-    int index = (bit_pointer & ~0x1F) / 8;
+    //Bytes past the end of the FIFO are never part of the result, so they can be left as zero
+    uint8_t window[8];
+    int byte_pos = bit_pointer >> 3;
+    const uint8_t* quad = ring[head]._u8;
+    if (byte_pos <= 8)
+        memcpy(window, quad + byte_pos, 8);
+    else
+    {
+        int first = 16 - byte_pos;
+        memcpy(window, quad + byte_pos, first);
+        if (count > 1)
+            memcpy(window + first, ring[(head + 1) & (ring.size() - 1)]._u8, 8 - first);
+        else
+            memset(window + first, 0, 8 - first);
+    }
 
     //MPEG is big-endian...
+    uint64_t word = 0;
     for (int i = 0; i < 8; i++)
+        word = (word << 8) | window[i];
+    data = (word << (bit_pointer & 0x7)) >> (64 - bits);
+
+    return true;
+}
+
+//Copies up to max bytes from the bit pointer onwards and returns how many were available
+int IPU_FIFO::read_bytes(uint8_t* dest, int max)
+{
+    int copied = 0;
+
+    //Streams that aren't byte-aligned have to be shifted into place a byte at a time
+    if (bit_pointer & 0x7)
     {
-        int fifo_index = index + i;
-        blorp[7 - i] = temp[fifo_index];
+        uint32_t value;
+        while (copied < max && get_bits(value, 8))
+        {
+            dest[copied] = value;
+            copied++;
+            advance_stream(8);
+        }
+        return copied;
     }
-    int shift = 64 - (bit_pointer % 32) - bits;
-    uint64_t mask = ~0x0ULL >> (64 - bits);
-    data = (*(uint64_t*)&blorp[0] >> shift) & mask;
 
-    return true;
+    while (copied < max && count)
+    {
+        int offset = bit_pointer >> 3;
+        int bytes = std::min(16 - offset, max - copied);
+        memcpy(dest + copied, ring[head]._u8 + offset, bytes);
+        copied += bytes;
+        bit_pointer += bytes * 8;
+        if (bit_pointer == 128)
+        {
+            bit_pointer = 0;
+            pop();
+        }
+    }
+    return copied;
 }
 
 void IPU_FIFO::advance_stream(uint8_t amount)
@@ -40,20 +112,20 @@ void IPU_FIFO::advance_stream(uint8_t amount)
     bit_pointer += amount;
     //printf("Advance stream: %d + %d = %d\n", bit_pointer - amount, amount, bit_pointer);
 
-    if (bit_pointer > (f.size() * 128))
+    if (bit_pointer > (count * 128))
     {
         Errors::die("[IPU] Bit pointer exceeds FIFO size!\n");
     }
     while (bit_pointer >= 128)
     {
         bit_pointer -= 128;
-        f.pop();
+        pop();
     }
 }
 
 void IPU_FIFO::reset()
 {
-    std::queue<uint128_t> empty;
-    f.swap(empty);
+    head = 0;
+    count = 0;
     bit_pointer = 0;
 }
@@ -1,18 +1,38 @@
 #ifndef IPU_FIFO_HPP
 #define IPU_FIFO_HPP
 #include <cstdint>
-#include <queue>
+#include <fstream>
+#include <vector>
 
 #include "../../int128.hpp"
 
+/**
+  * A ring of quadwords. The input FIFO never holds more than eight, but the output FIFO takes whole macroblocks at a
+  * time, so the ring doubles in size whenever it fills up. It never shrinks, so after the first few macroblocks no
+  * push allocates.
+  * get_bits reads up to 32 bits from the bit pointer onwards straight out of the ring, by loading the eight bytes
+  * around the bit pointer as one big-endian word.
+  **/
 struct IPU_FIFO
 {
-    std::queue<uint128_t> f;
+    std::vector<uint128_t> ring;
+    uint32_t head, count;
     int bit_pointer;
+
+    IPU_FIFO();
+
+    uint32_t size() const { return count; }
+    uint128_t& front() { return ring[head]; }
+    void push(const uint128_t& quad);
+    void pop();
+
     bool get_bits(uint32_t& data, int bits);
+    int read_bytes(uint8_t* dest, int max);
     void advance_stream(uint8_t amount);
 
     void reset();
+    void load_state(std::ifstream& state);
+    void save_state(std::ofstream& state);
 };
 
 #endif // IPU_FIFO_HPP
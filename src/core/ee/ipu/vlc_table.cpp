@@ -6,31 +6,83 @@
 VLC_Table::VLC_Table(VLC_Entry* table, int table_size, int max_bits) :
     table(table), table_size(table_size), max_bits(max_bits)
 {
-
+    build_lookup();
 }
 
-bool VLC_Table::peek_symbol(IPU_FIFO &FIFO, VLC_Entry &entry)
+void VLC_Table::build_lookup()
 {
-    uint32_t key;
-    for (int i = 0; i < max_bits; i++)
+    //Expand every code over a flat table covering every max_bits-bit pattern, shortest codes first
+    std::vector<int16_t> full(1 << max_bits, -1);
+    for (int bits = 1; bits <= max_bits; bits++)
     {
-        int bits = i + 1;
-        if (!FIFO.get_bits(key, bits))
-            return false;
-        for (int j = 0; j < table_size; j++)
+        for (int i = 0; i < table_size; i++)
         {
-            if (bits != table[j].bits)
+            if (table[i].bits != bits)
                 continue;
+            uint32_t start = table[i].key << (max_bits - bits);
+            uint32_t end = (table[i].key + 1) << (max_bits - bits);
+            for (uint32_t key = start; key < end; key++)
+            {
+                if (full[key] == -1)
+                    full[key] = i;
+            }
+        }
+    }
 
-            if (key == table[j].key)
+    //Then split it, keeping a secondary table only for the primary slots that don't resolve to a single symbol
+    primary_bits = (max_bits < PRIMARY_BITS) ? max_bits : PRIMARY_BITS;
+    secondary_bits = max_bits - primary_bits;
+    int secondary_size = 1 << secondary_bits;
+    primary_table.resize(1 << primary_bits);
+    secondary_tables.clear();
+    for (int prefix = 0; prefix < (1 << primary_bits); prefix++)
+    {
+        int16_t* slots = &full[prefix << secondary_bits];
+        bool single = true;
+        for (int i = 1; i < secondary_size; i++)
+        {
+            if (slots[i] != slots[0])
             {
-                entry = table[j];
-                return true;
+                single = false;
+                break;
             }
         }
+
+        if (single)
+            primary_table[prefix] = slots[0];
+        else
+        {
+            primary_table[prefix] = -2 - (int)(secondary_tables.size() >> secondary_bits);
+            secondary_tables.insert(secondary_tables.end(), slots, slots + secondary_size);
+        }
     }
-    Errors::die("[VLC Table] Symbol not found: $%08X\n", key);
-    return false;
+}
+
+bool VLC_Table::peek_symbol(IPU_FIFO &FIFO, VLC_Entry &entry)
+{
+    //Near the end of the FIFO, a short symbol can still be decoded from what's there
+    int bits = (int)(FIFO.size() * 128) - FIFO.bit_pointer;
+    if (bits > max_bits)
+        bits = max_bits;
+
+    uint32_t key;
+    if (bits <= 0 || !FIFO.get_bits(key, bits))
+        return false;
+    key <<= max_bits - bits;
+
+    int index = primary_table[key >> secondary_bits];
+    if (index < -1)
+        index = secondary_tables[((-2 - index) << secondary_bits) + (key & ((1 << secondary_bits) - 1))];
+
+    if (index < 0 || table[index].bits > bits)
+    {
+        //Either the symbol continues past the end of the FIFO, or the stream is corrupt
+        if (bits < max_bits)
+            return false;
+        Errors::die("[VLC Table] Symbol not found: $%08X\n", key);
+    }
+    entry = table[index];
+    return true;
 }
 
 bool VLC_Table::get_symbol(IPU_FIFO& FIFO, uint32_t &result)
@@ -2,6 +2,7 @@
 #define VLC_TABLE_HPP
 #include <cstdint>
 #include <queue>
+#include <vector>
 #include "ipu_fifo.hpp"
 
 struct VLC_Entry
@@ -11,11 +12,26 @@ struct VLC_Entry
     uint8_t bits;
 };
 
+/**
+  * Symbols are decoded with at most two lookups. The first PRIMARY_BITS bits of the stream index the primary table;
+  * codes longer than that continue into a secondary table indexed by the rest of the max_bits-bit window.
+  * Slots hold an index into table, -1 for no symbol, or -2 - n for secondary table n.
+  * Where several entries match, the shortest code wins, then the first in the table, the same way the tables were
+  * searched before.
+  **/
 class VLC_Table
 {
     private:
+        constexpr static int PRIMARY_BITS = 8;
+
         VLC_Entry* table;
         int table_size, max_bits;
+
+        int primary_bits, secondary_bits;
+        std::vector<int16_t> primary_table;
+        std::vector<int16_t> secondary_tables;
+
+        void build_lookup();
     protected:
         VLC_Table(VLC_Entry* table, int table_size, int max_bits);
     public:
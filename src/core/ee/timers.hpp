@@ -1,6 +1,7 @@
 #ifndef TIMERS_HPP
 #define TIMERS_HPP
 #include <cstdint>
+#include <fstream>
 
 struct TimerControl
 {
@@ -41,6 +42,8 @@ class EmotionTiming
         EmotionTiming(INTC* intc);
 
         void reset();
+        void load_state(std::ifstream& state);
+        void save_state(std::ofstream& state);
         void run();
         void run(int cycles);
 
@@ -1,6 +1,7 @@
 #ifndef VIF_HPP
 #define VIF_HPP
 #include <cstdint>
+#include <fstream>
 #include <queue>
 
 #include "vu.hpp"
@@ -72,6 +73,8 @@ class VectorInterface
         VectorInterface(GraphicsInterface* gif, VectorUnit* vu);
 
         void reset();
+        void load_state(std::ifstream& state);
+        void save_state(std::ofstream& state);
         void update();
 
         bool transfer_DMAtag(uint128_t tag);
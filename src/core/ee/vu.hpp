@@ -2,6 +2,7 @@
 #define VU_HPP
 #include <cstdint>
 #include <cstdio>
+#include <fstream>
 
 #include "../int128.hpp"
 
@@ -93,6 +94,8 @@ class VectorUnit
         void mscal(uint32_t addr);
         void end_execution();
         void reset();
+        void load_state(std::ifstream& state);
+        void save_state(std::ofstream& state);
 
         static float convert(uint32_t value);
 
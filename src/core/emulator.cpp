@@ -2,6 +2,7 @@
 #include <cstring>
 #include <cstdio>
 #include <cstdlib>
+#include <chrono>
 #include <sstream>
 #include "emulator.hpp"
 #include "errors.hpp"
@@ -21,6 +22,8 @@ Emulator::Emulator() :
     SPU_RAM = nullptr;
     ELF_file = nullptr;
     ELF_size = 0;
+    BIOS_hash = 0;
+    booting_from_cache = false;
     ee_log.open("ee_log.txt", std::ios::out);
 }
 
@@ -44,6 +47,7 @@ void Emulator::run()
 {
     gs.start_frame();
     instructions_run = 0;
+    frame_instructions = 0;
     VBLANK_sent = false;
     const int originalRounding = fegetround();
     fesetround(FE_TOWARDZERO);
@@ -51,6 +55,7 @@ void Emulator::run()
     {
         int cycles = cpu.run(8);
         instructions_run += cycles;
+        frame_instructions += cycles;
         cycles >>= 1;
         dmac.run(cycles);
         timers.run(cycles);
@@ -106,6 +111,8 @@ void Emulator::reset()
         SPU_RAM = new uint8_t[1024 * 1024 * 2];
 
     INTC_read_count = 0;
+    instructions_run = 0;
+    frame_instructions = 0;
     cdvd.reset();
     cp0.reset();
     cpu.reset();
@@ -155,6 +162,17 @@ uint32_t* Emulator::get_framebuffer()
     return gs.get_framebuffer();
 }
 
+//Instructions the EE interpreted during the last call to run(). Cycles skipped by the INTC idle hack don't count.
+uint32_t Emulator::get_frame_instructions()
+{
+    return frame_instructions;
+}
+
+uint32_t Emulator::get_frame_primitives()
+{
+    return gs.get_frame_primitives();
+}
+
 void Emulator::get_resolution(int &w, int &h)
 {
     gs.get_resolution(w, h);
@@ -165,11 +183,31 @@ void Emulator::get_inner_resolution(int &w, int &h)
     gs.get_inner_resolution(w, h);
 }
 
+//Captures should be started between frames, see gscapture.hpp
+bool Emulator::start_GS_capture(const std::string& path)
+{
+    return gs.start_capture(path);
+}
+
+void Emulator::stop_GS_capture()
+{
+    gs.stop_capture();
+}
+
 bool Emulator::skip_BIOS()
 {
     //hax
     if (skip_BIOS_hack != NONE)
     {
+        /**
+          * Up to here the boot doesn't depend on the program, so later boots can start from this point.
+          * This is the only state saved in the middle of a frame. That is safe because the GS save waits for the
+          * GS thread to drain its queue, and how far into the frame the EE got isn't part of a state. fast_boot
+          * loads the snapshot between frames, and skip_BIOS then replaces the EE's PC with the program's entry
+          * point. The rest of the saved frame is dropped and the next run() starts a fresh one.
+          **/
+        if (boot_cache_dir.length() && !booting_from_cache)
+            save_boot_snapshot();
         switch (skip_BIOS_hack)
         {
             case LOAD_ELF:
@@ -182,23 +220,18 @@ bool Emulator::skip_BIOS()
                 {
                     Errors::die("[Emulator] Failed to load SYSTEM.CNF!\n");
                 }
-                std::string exec_name = "";
                 //Search for cdrom0:
-                int pos = 0;
-                while (strncmp("cdrom0:", system_cnf + pos, 7))
-                    pos++;
+                std::string cnf(system_cnf, system_cnf_size);
+                delete[] system_cnf;
+                size_t pos = cnf.find("cdrom0:");
+                if (pos == std::string::npos)
+                    Errors::die("[Emulator] No boot path in SYSTEM.CNF!\n");
 
                 printf("[Emulator] Found 'cdrom0:'\n");
-                pos += 8;
 
-                //Search for end of file name
-                while (system_cnf[pos] != ';')
-                {
-                    exec_name += system_cnf[pos];
-                    pos++;
-                }
-                exec_name += ";1";
-                delete[] system_cnf;
+                //The path runs to the version suffix or the end of the line, and can name a subdirectory
+                size_t end = cnf.find_first_of(";\r\n", pos);
+                std::string exec_name = cnf.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
                 printf("[Emulator] Loading %s\n", exec_name.c_str());
                 uint8_t* file = cdvd.read_file(exec_name, ELF_size);
                 if (!file)
@@ -226,12 +259,80 @@ void Emulator::set_skip_BIOS_hack(SKIP_HACK type)
     skip_BIOS_hack = type;
 }
 
+/**
+  * With a boot cache directory set, the first boot that skips the BIOS saves the machine at the point the BIOS
+  * hands off to the program. Later boots with the same BIOS call fast_boot to load that snapshot and go straight
+  * to loading the program. ELF and disc boots are cached separately, since the drive state differs.
+  **/
+void Emulator::set_boot_cache(const std::string& dir)
+{
+    boot_cache_dir = dir;
+}
+
+void Emulator::set_IPU_async(bool enabled)
+{
+    ipu.set_async(enabled);
+}
+
+std::string Emulator::boot_snapshot_name()
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/boot_%016llx_%s.dsstate", (unsigned long long)BIOS_hash,
+             skip_BIOS_hack == LOAD_DISC ? "disc" : "elf");
+    return boot_cache_dir + name;
+}
+
+void Emulator::save_boot_snapshot()
+{
+    //Sessions may run side by side, so the snapshot only appears under its real name once it is complete
+    std::string name = boot_snapshot_name();
+    std::string temp_name = name + "." +
+            std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + ".tmp";
+    if (save_state(temp_name.c_str()) && !std::rename(temp_name.c_str(), name.c_str()))
+        printf("[Emulator] Saved boot snapshot %s\n", name.c_str());
+    else
+        std::remove(temp_name.c_str());
+}
+
+//Returns false if there is no usable snapshot, in which case the BIOS has to run as usual
+bool Emulator::fast_boot()
+{
+    if (!boot_cache_dir.length() || skip_BIOS_hack == NONE)
+        return false;
+
+    std::string name = boot_snapshot_name();
+    std::ifstream snapshot(name, std::ios::binary);
+    if (!snapshot.is_open())
+        return false;
+    snapshot.close();
+
+    //Snapshots from other versions are rejected before anything is loaded, and replaced at the next hand-off
+    SKIP_HACK hack = skip_BIOS_hack;
+    if (!load_state(name.c_str()))
+        return false;
+    printf("[Emulator] Loaded boot snapshot %s\n", name.c_str());
+
+    skip_BIOS_hack = hack;
+    booting_from_cache = true;
+    skip_BIOS();
+    booting_from_cache = false;
+    return true;
+}
+
 void Emulator::load_BIOS(uint8_t *BIOS_file)
 {
     if (!BIOS)
         BIOS = new uint8_t[1024 * 1024 * 4];
 
     memcpy(BIOS, BIOS_file, 1024 * 1024 * 4);
+
+    //64-bit FNV-1a over words, used to key boot snapshots
+    BIOS_hash = 0xCBF29CE484222325ULL;
+    for (int i = 0; i < 1024 * 1024 * 4; i += 8)
+    {
+        BIOS_hash ^= *(uint64_t*)&BIOS[i];
+        BIOS_hash *= 0x100000001B3ULL;
+    }
 }
 
 void Emulator::load_ELF(uint8_t *ELF, uint32_t size)
@@ -485,6 +586,12 @@ uint128_t Emulator::read128(uint32_t address)
         return *(uint128_t*)&RDRAM[address & 0x01FFFFFF];
     if (address >= 0x1FC00000 && address < 0x20000000)
         return *(uint128_t*)&BIOS[address & 0x3FFFFF];
+    if (address == 0x10005000)
+    {
+        uint128_t data = uint128_t::from_u32(0);
+        gif.read_GS_image(data);
+        return data;
+    }
     printf("Unrecognized read128 at physical addr $%08X\n", address);
     return uint128_t::from_u32(0);
 }
@@ -71,6 +71,8 @@ class Emulator
         uint8_t rdram_sdevid;
 
         uint32_t instructions_run;
+        //instructions_run is the frame's cycle budget and can jump ahead when the EE idles; this only counts real work
+        uint32_t frame_instructions;
 
         uint8_t IOP_POST;
         uint32_t IOP_I_STAT;
@@ -80,6 +82,13 @@ class Emulator
 
         SKIP_HACK skip_BIOS_hack;
 
+        //Snapshots of the machine at the BIOS hand-off, keyed by a hash of the BIOS
+        std::string boot_cache_dir;
+        uint64_t BIOS_hash;
+        bool booting_from_cache;
+        std::string boot_snapshot_name();
+        void save_boot_snapshot();
+
         uint8_t* ELF_file;
         uint32_t ELF_size;
 
@@ -93,13 +102,22 @@ class Emulator
         void release_button(PAD_BUTTON button);
         bool skip_BIOS();
         void set_skip_BIOS_hack(SKIP_HACK type);
+        void set_boot_cache(const std::string& dir);
+        void set_IPU_async(bool enabled);
+        bool fast_boot();
         void load_BIOS(uint8_t* BIOS);
         void load_ELF(uint8_t* ELF, uint32_t size);
         bool load_CDVD(const char* name);
         void execute_ELF();
         uint32_t* get_framebuffer();
+        uint32_t get_frame_instructions();
+        uint32_t get_frame_primitives();
         void get_resolution(int& w, int& h);
         void get_inner_resolution(int& w, int& h);
+        bool start_GS_capture(const std::string& path);
+        void stop_GS_capture();
+        bool save_state(const char* file_name);
+        bool load_state(const char* file_name);
 
         uint8_t read8(uint32_t address);
         uint16_t read16(uint32_t address);
@@ -3,11 +3,14 @@
 #include <string>
 void Errors::die(const char* format, ...)
 {
-    char* output = new char[ERROR_STRING_MAX_LENGTH];
-    va_list args;
+    char output[ERROR_STRING_MAX_LENGTH];
+    va_list args, copy;
     va_start(args, format);
+    //A va_list can only be walked once
+    va_copy(copy, args);
     vprintf(format, args);
-    vsnprintf(output, ERROR_STRING_MAX_LENGTH, format, args);
+    vsnprintf(output, ERROR_STRING_MAX_LENGTH, format, copy);
+    va_end(copy);
     va_end(args);
     std::string error_str(output);
     throw Emulation_error(error_str);
@@ -4,11 +4,19 @@
 
 GraphicsInterface::GraphicsInterface(GraphicsSynthesizer *gs) : gs(gs)
 {
+    image_data = nullptr;
+}
 
+GraphicsInterface::~GraphicsInterface()
+{
+    delete[] image_data;
 }
 
 void GraphicsInterface::reset()
 {
+    delete[] image_data;
+    image_data = nullptr;
+    image_size = 0;
     processing_GIF_prim = false;
     current_tag.data_left = 0;
     active_path = 0;
@@ -176,6 +184,12 @@ void GraphicsInterface::feed_GIF(uint128_t data)
 
         if (current_tag.output_PRIM && current_tag.format != 1)
             gs->write64(0, current_tag.PRIM);
+
+        if (current_tag.format >= 2 && current_tag.NLOOP)
+        {
+            image_data = new uint64_t[current_tag.NLOOP * 2];
+            image_size = 0;
+        }
     }
     else
     {
@@ -200,9 +214,14 @@ void GraphicsInterface::feed_GIF(uint128_t data)
                 break;
             case 2:
             case 3:
-                gs->write64(0x54, data1);
-                gs->write64(0x54, data2);
+                image_data[image_size++] = data1;
+                image_data[image_size++] = data2;
                 current_tag.data_left--;
+                if (!current_tag.data_left)
+                {
+                    gs->write_image(image_data, image_size);
+                    image_data = nullptr;
+                }
                 break;
             default:
                 printf("[GS] Unrecognized GIFtag format %d\n", current_tag.format);
@@ -262,3 +281,9 @@ void GraphicsInterface::send_PATH3(uint128_t data)
 {
     feed_GIF(data);
 }
+
+//Local-to-host transfers are read through VIF1 while BUSDIR is set. Returns false if there is nothing to read.
+bool GraphicsInterface::read_GS_image(uint128_t& quad)
+{
+    return gs->read_image(quad);
+}
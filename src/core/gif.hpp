@@ -1,6 +1,7 @@
 #ifndef GIF_HPP
 #define GIF_HPP
 #include <cstdint>
+#include <fstream>
 
 #include "int128.hpp"
 
@@ -30,12 +31,19 @@ class GraphicsInterface
         uint8_t active_path;
         uint8_t path_queue;
 
+        //IMAGE mode data is collected here and sent to the GS in one piece once the GIFtag ends
+        uint64_t* image_data;
+        uint32_t image_size;
+
         void process_PACKED(uint128_t quad);
         void process_REGLIST(uint128_t quad);
         void feed_GIF(uint128_t quad);
     public:
         GraphicsInterface(GraphicsSynthesizer* gs);
+        ~GraphicsInterface();
         void reset();
+        void load_state(std::ifstream& state);
+        void save_state(std::ofstream& state);
 
         bool path_active(int index);
 
@@ -49,6 +57,8 @@ class GraphicsInterface
         bool send_PATH1(uint128_t quad);
         void send_PATH2(uint32_t data[4]);
         void send_PATH3(uint128_t quad);
+
+        bool read_GS_image(uint128_t& quad);
 };
 
 inline bool GraphicsInterface::path_active(int index)
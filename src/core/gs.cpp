@@ -3,8 +3,11 @@
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
+#include <sstream>
+#include <vector>
 #include "ee/intc.hpp"
 #include "gs.hpp"
+#include "gscapture.hpp"
 #include "gsthread.hpp"
 #include "errors.hpp"
 using namespace std;
@@ -22,11 +25,14 @@ GraphicsSynthesizer::GraphicsSynthesizer(INTC* intc) : intc(intc)
     output_buffer2 = nullptr;
     message_queue = nullptr;
     return_queue = nullptr;
+    readback_buffer = nullptr;
+    capture = nullptr;
     gsthread_id = std::thread();//no thread/default constructor
 }
 
 GraphicsSynthesizer::~GraphicsSynthesizer()
 {
+    stop_capture();
     if (gsthread_id.joinable())
     {
         GS_message_payload payload;
@@ -42,10 +48,13 @@ GraphicsSynthesizer::~GraphicsSynthesizer()
         delete message_queue;
     if (return_queue)
         delete return_queue;
+    if (readback_buffer)
+        delete[] readback_buffer;
 }
 
 void GraphicsSynthesizer::reset()
 {
+    stop_capture();
     if (!output_buffer1)
         output_buffer1 = new uint32_t[1920 * 1280];
     if (!output_buffer2)
@@ -54,9 +63,16 @@ void GraphicsSynthesizer::reset()
         message_queue = new gs_fifo();
     if (!return_queue)
         return_queue = new gs_return_fifo();
+    if (!readback_buffer)
+        readback_buffer = new uint128_t[READBACK_QUADS];
+    readback_quads = 0;
+    readback_pos = 0;
+    readback_pending = false;
+    readback_ready = false;
     current_lock = std::unique_lock<std::mutex>();
     using_first_buffer = true;
     frame_count = 0;
+    frame_primitives = 0;
     set_CRT(false, 0x2, false);
     reg.reset();
     if (gsthread_id.joinable())
@@ -84,6 +100,51 @@ void GraphicsSynthesizer::memdump()
     message_queue->push({ GS_command::memdump_t,payload });
 }
 
+/**
+  * Starts writing every message sent to the GS thread to a capture file. The GS thread saves its whole state, the
+  * same way it does for save states, once it has processed everything sent before, and the EE waits for that.
+  * Returns false if the file could not be written.
+  **/
+bool GraphicsSynthesizer::start_capture(const std::string& path)
+{
+    stop_capture();
+
+    std::stringstream snapshot(std::ios::in | std::ios::out | std::ios::binary);
+    std::atomic<bool> ready(false);
+    GS_message_payload payload;
+    payload.save_state_payload = { &snapshot, &ready };
+    message_queue->push({ GS_command::save_state_t,payload });
+    while (!ready)
+        std::this_thread::yield();
+
+    capture = new GSCaptureWriter();
+    if (!capture->open(path, snapshot.str(), reg))
+    {
+        delete capture;
+        capture = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void GraphicsSynthesizer::stop_capture()
+{
+    if (capture)
+    {
+        capture->close();
+        delete capture;
+        capture = nullptr;
+    }
+}
+
+void GraphicsSynthesizer::send_message(GS_command type, const GS_message_payload& payload)
+{
+    GS_message message = { type, payload };
+    if (capture)
+        capture->record(message);
+    message_queue->push(message);
+}
+
 void GraphicsSynthesizer::start_frame()
 {
     frame_complete = false;
@@ -100,10 +161,11 @@ void GraphicsSynthesizer::set_CRT(bool interlaced, int mode, bool frame_mode)
 
     GS_message_payload payload;
     payload.crt_payload = { interlaced, mode, frame_mode };
-    message_queue->push({ GS_command::set_crt_t,payload });
+    send_message(GS_command::set_crt_t, payload);
 }
 
-void wait_for_return(gs_return_fifo *return_queue)
+//Returns the number of primitives the GS thread drew for the frame
+uint32_t wait_for_return(gs_return_fifo *return_queue)
 {
     GS_return_message data;
     while (true)
@@ -113,7 +175,7 @@ void wait_for_return(gs_return_fifo *return_queue)
             switch (data.type)
             {
                 case render_complete_t:
-                    return;
+                    return data.payload.render_complete_payload.primitives;
                 case death_error_t:
                 {
                     auto p = data.payload.death_error_payload;
@@ -138,7 +200,7 @@ void wait_for_return(gs_return_fifo *return_queue)
 uint32_t* GraphicsSynthesizer::get_framebuffer()
 {
     uint32_t* out;
-    wait_for_return(return_queue);
+    frame_primitives = wait_for_return(return_queue);
     if (using_first_buffer)
     {
         while (!output_buffer1_mutex.try_lock())
@@ -163,11 +225,17 @@ uint32_t* GraphicsSynthesizer::get_framebuffer()
     return out;
 }
 
+//Only valid once get_framebuffer has returned the frame
+uint32_t GraphicsSynthesizer::get_frame_primitives()
+{
+    return frame_primitives;
+}
+
 void GraphicsSynthesizer::set_VBLANK(bool is_VBLANK)
 {
     GS_message_payload payload;
     payload.vblank_payload = { is_VBLANK };
-    message_queue->push({ GS_command::set_vblank_t,payload });
+    send_message(GS_command::set_vblank_t, payload);
 
     reg.set_VBLANK(is_VBLANK);
 
@@ -190,7 +258,7 @@ void GraphicsSynthesizer::assert_FINISH()
 {
     GS_message_payload payload;
     payload.no_payload = { };
-    message_queue->push({ GS_command::assert_finish_t,payload });
+    send_message(GS_command::assert_finish_t, payload);
 
     if (reg.assert_FINISH())
         intc->assert_IRQ((int)Interrupt::GS);
@@ -203,7 +271,7 @@ void GraphicsSynthesizer::render_CRT()
         payload.render_payload = { output_buffer1, &output_buffer1_mutex };
     else
         payload.render_payload = { output_buffer2, &output_buffer2_mutex }; ;
-    message_queue->push({ GS_command::render_crt_t,payload });
+    send_message(GS_command::render_crt_t, payload);
 }
 
 void GraphicsSynthesizer::get_resolution(int &w, int &h)
@@ -220,16 +288,68 @@ void GraphicsSynthesizer::write64(uint32_t addr, uint64_t value)
 {
     GS_message_payload payload;
     payload.write64_payload = { addr, value };
-    message_queue->push({ GS_command::write64_t,payload });
+    send_message(GS_command::write64_t, payload);
 
     //also check for interrupt pre-processing
     reg.write64(addr, value);
+
+    //TRXDIR = 1 starts a local-to-host transfer
+    if (addr == 0x53 && (value & 0x3) == 1)
+        request_readback();
+}
+
+void GraphicsSynthesizer::request_readback()
+{
+    //The GS thread writes readback_buffer and readback_quads, so an earlier transfer it hasn't finished can't be
+    //cut short. Otherwise its readback_ready would be taken as this one's.
+    while (readback_pending && !readback_ready)
+        std::this_thread::yield();
+
+    readback_pending = true;
+    readback_ready = false;
+    readback_pos = 0;
+
+    GS_message_payload payload;
+    payload.readback_payload = { readback_buffer, READBACK_QUADS, &readback_quads, &readback_ready };
+    send_message(GS_command::readback_t, payload);
 }
+
+//Reads the next quadword of a local-to-host transfer, returning false if no transfer is in progress.
+//BUSDIR is what turns the host bus around, so nothing comes back until it is set.
+bool GraphicsSynthesizer::read_image(uint128_t& quad)
+{
+    if (!readback_pending || !(reg.BUSDIR & 0x1))
+        return false;
+
+    //The EE only waits for the GS thread here, when saving, and when a new transfer replaces an unfinished one
+    while (!readback_ready)
+        std::this_thread::yield();
+
+    if (readback_pos >= readback_quads)
+    {
+        readback_pending = false;
+        return false;
+    }
+    quad = readback_buffer[readback_pos];
+    readback_pos++;
+    if (readback_pos == readback_quads)
+        readback_pending = false;
+    return true;
+}
+
+//Sends a whole IMAGE mode payload to HWREG. The GS thread takes ownership of data and deletes it.
+void GraphicsSynthesizer::write_image(uint64_t* data, uint32_t count)
+{
+    GS_message_payload payload;
+    payload.image_payload = { data, count };
+    send_message(GS_command::write_image_t, payload);
+}
+
 void GraphicsSynthesizer::write64_privileged(uint32_t addr, uint64_t value)
 {
     GS_message_payload payload;
     payload.write64_payload = { addr, value };
-    message_queue->push({ GS_command::write64_privileged_t,payload });
+    send_message(GS_command::write64_privileged_t, payload);
 
     reg.write64_privileged(addr, value);
 }
@@ -237,7 +357,7 @@ void GraphicsSynthesizer::write32_privileged(uint32_t addr, uint32_t value)
 {
     GS_message_payload payload;
     payload.write32_payload = { addr, value };
-    message_queue->push({ GS_command::write32_privileged_t,payload });
+    send_message(GS_command::write32_privileged_t, payload);
 
     reg.write32_privileged(addr, value);
 }
@@ -254,29 +374,29 @@ void GraphicsSynthesizer::set_RGBA(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
 {
     GS_message_payload payload;
     payload.rgba_payload = { r, g, b, a };
-    message_queue->push({ GS_command::set_rgba_t,payload });
+    send_message(GS_command::set_rgba_t, payload);
 }
 void GraphicsSynthesizer::set_STQ(uint32_t s, uint32_t t, uint32_t q)
 {
     GS_message_payload payload;
     payload.stq_payload = { s, t, q };
-    message_queue->push({ GS_command::set_stq_t,payload });
+    send_message(GS_command::set_stq_t, payload);
 }
 void GraphicsSynthesizer::set_UV(uint16_t u, uint16_t v)
 {
     GS_message_payload payload;
     payload.uv_payload = { u, v };
-    message_queue->push({ GS_command::set_uv_t,payload });
+    send_message(GS_command::set_uv_t, payload);
 }
 void GraphicsSynthesizer::set_Q(float q)
 {
     GS_message_payload payload;
     payload.q_payload = { 1 };
-    message_queue->push({ GS_command::set_q_t,payload });
+    send_message(GS_command::set_q_t, payload);
 }
 void GraphicsSynthesizer::set_XYZ(uint32_t x, uint32_t y, uint32_t z, bool drawing_kick)
 {
     GS_message_payload payload;
     payload.xyz_payload = { x, y, z, drawing_kick };
-    message_queue->push({ GS_command::set_xyz_t,payload });
+    send_message(GS_command::set_xyz_t, payload);
 }
@@ -1,20 +1,26 @@
 #ifndef GS_HPP
 #define GS_HPP
+#include <atomic>
 #include <cstdint>
+#include <fstream>
 #include <thread>
 #include <mutex>
+#include <string>
+#include "int128.hpp"
 #include "gscontext.hpp"
 #include "gsregisters.hpp"
 #include "circularFIFO.hpp"
 
 
 class INTC;
+class GSCaptureWriter;
 
 enum GS_command:uint8_t 
 {
-	write64_t, write64_privileged_t, write32_privileged_t,
+	write64_t, write64_privileged_t, write32_privileged_t, write_image_t,
     set_rgba_t, set_stq_t, set_uv_t, set_xyz_t, set_q_t, set_crt_t,
-    render_crt_t, assert_finish_t, set_vblank_t, memdump_t, die_t
+    render_crt_t, assert_finish_t, set_vblank_t, memdump_t, readback_t,
+    save_state_t, load_state_t, die_t
 };
 
 union GS_message_payload 
@@ -29,6 +35,11 @@ union GS_message_payload
         uint32_t addr;
         uint32_t value;
     } write32_payload;
+    struct 
+	{
+        uint64_t* data;
+        uint32_t count;
+    } image_payload;
     struct 
 	{
         uint8_t r, g, b, a;
@@ -60,11 +71,28 @@ union GS_message_payload
 	{
         bool vblank;
     } vblank_payload;
+    struct 
+	{
+        uint128_t* target;
+        uint32_t capacity;
+        uint32_t* quads;
+        std::atomic<bool>* ready;
+    } readback_payload;
     struct 
 	{
         uint32_t* target;
         std::mutex* target_mutex;
     } render_payload;
+    struct
+    {
+        std::ostream* state;
+        std::atomic<bool>* ready;
+    } save_state_payload;
+    struct
+    {
+        std::istream* state;
+        std::atomic<bool>* ready;
+    } load_state_payload;
     struct 
 	{
         uint8_t BLANK; 
@@ -89,6 +117,10 @@ union GS_return_message_payload
         const char* error_str;
     } death_error_payload;
     struct
+    {
+        uint32_t primitives;
+    } render_complete_payload;
+    struct
     {
         uint8_t BLANK;
     } no_payload;//C++ doesn't like the empty struct
@@ -110,6 +142,7 @@ class GraphicsSynthesizer
         INTC* intc;
         bool frame_complete;
         int frame_count;
+        uint32_t frame_primitives;
         uint32_t* output_buffer1;
         uint32_t* output_buffer2;//double buffered to prevent mutex lock
         std::mutex output_buffer1_mutex, output_buffer2_mutex;
@@ -121,16 +154,36 @@ class GraphicsSynthesizer
         gs_fifo* message_queue;
         gs_return_fifo* return_queue;
 
+        //Local-to-host transfers are deswizzled by the GS thread straight into readback_buffer.
+        //The thread sets readback_ready once readback_quads is valid; the EE waits on it before reading a pending transfer
+        //and before starting another while one is still in flight.
+        static const uint32_t READBACK_QUADS = 1024 * 1024 * 4 / 16;
+        uint128_t* readback_buffer;
+        uint32_t readback_quads;
+        uint32_t readback_pos;
+        bool readback_pending;
+        std::atomic<bool> readback_ready;
+        void request_readback();
+
+        //Every message sent while a capture is open is also written to it
+        GSCaptureWriter* capture;
+        void send_message(GS_command type, const GS_message_payload& payload);
+
         std::thread gsthread_id;
 		
     public:
         GraphicsSynthesizer(INTC* intc);
         ~GraphicsSynthesizer();
         void reset();
+        void load_state(std::ifstream& state);
+        void save_state(std::ofstream& state);
         void memdump();
+        bool start_capture(const std::string& path);
+        void stop_capture();
         void start_frame();
         bool is_frame_complete();
         uint32_t* get_framebuffer();
+        uint32_t get_frame_primitives();
         void render_CRT();
         void get_resolution(int& w, int& h);
         void get_inner_resolution(int& w, int& h);
@@ -145,6 +198,8 @@ class GraphicsSynthesizer
         void write32_privileged(uint32_t addr, uint32_t value);
         void write64_privileged(uint32_t addr, uint64_t value);
         void write64(uint32_t addr, uint64_t value);
+        void write_image(uint64_t* data, uint32_t count);
+        bool read_image(uint128_t& quad);
 
         void set_RGBA(uint8_t r, uint8_t g, uint8_t b, uint8_t a);
         void set_STQ(uint32_t s, uint32_t t, uint32_t q);
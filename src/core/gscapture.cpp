@@ -0,0 +1,231 @@
+#include <cstring>
+#include "gscapture.hpp"
+
+using namespace std;
+
+static const char CAPTURE_MAGIC[8] = {'D', 'S', 'G', 'S', 'C', 'A', 'P', 0};
+
+const uint32_t GSCaptureWriter::VERSION;
+
+template <typename T> void GSCaptureWriter::write(const T& value)
+{
+    file.write((const char*)&value, sizeof(T));
+}
+
+bool GSCaptureWriter::open(const string& path, const string& state, const GS_REGISTERS& reg)
+{
+    file.open(path, ios::binary | ios::trunc);
+    if (!file.is_open())
+        return false;
+
+    file.write(CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+    write(VERSION);
+    write((uint32_t)state.size());
+    file.write(state.data(), state.size());
+    write((uint32_t)sizeof(GS_REGISTERS));
+    write(reg);
+    return file.good();
+}
+
+bool GSCaptureWriter::is_open()
+{
+    return file.is_open();
+}
+
+void GSCaptureWriter::close()
+{
+    if (file.is_open())
+        file.close();
+}
+
+void GSCaptureWriter::record(const GS_message& message)
+{
+    const GS_message_payload& p = message.payload;
+    switch (message.type)
+    {
+        case write64_t:
+        case write64_privileged_t:
+            write((uint8_t)message.type);
+            write(p.write64_payload.addr);
+            write(p.write64_payload.value);
+            break;
+        case write32_privileged_t:
+            write((uint8_t)message.type);
+            write(p.write32_payload.addr);
+            write(p.write32_payload.value);
+            break;
+        case write_image_t:
+            write((uint8_t)message.type);
+            write(p.image_payload.count);
+            file.write((const char*)p.image_payload.data, p.image_payload.count * sizeof(uint64_t));
+            break;
+        case set_rgba_t:
+            write((uint8_t)message.type);
+            write(p.rgba_payload);
+            break;
+        case set_stq_t:
+            write((uint8_t)message.type);
+            write(p.stq_payload.s);
+            write(p.stq_payload.t);
+            write(p.stq_payload.q);
+            break;
+        case set_uv_t:
+            write((uint8_t)message.type);
+            write(p.uv_payload.u);
+            write(p.uv_payload.v);
+            break;
+        case set_xyz_t:
+            write((uint8_t)message.type);
+            write(p.xyz_payload.x);
+            write(p.xyz_payload.y);
+            write(p.xyz_payload.z);
+            write((uint8_t)p.xyz_payload.drawing_kick);
+            break;
+        case set_q_t:
+            write((uint8_t)message.type);
+            write(p.q_payload.q);
+            break;
+        case set_crt_t:
+            write((uint8_t)message.type);
+            write((uint8_t)p.crt_payload.interlaced);
+            write((int32_t)p.crt_payload.mode);
+            write((uint8_t)p.crt_payload.frame_mode);
+            break;
+        case set_vblank_t:
+            write((uint8_t)message.type);
+            write((uint8_t)p.vblank_payload.vblank);
+            break;
+        case render_crt_t:
+        case assert_finish_t:
+        case readback_t:
+            write((uint8_t)message.type);
+            break;
+        default:
+            //Debugging and control messages aren't part of the command stream
+            break;
+    }
+}
+
+template <typename T> T GSCaptureReader::read()
+{
+    T value;
+    if (pos + sizeof(T) > data.size())
+    {
+        //Running off the end leaves pos past the data so that callers see the truncation
+        pos = data.size() + 1;
+        memset(&value, 0, sizeof(T));
+        return value;
+    }
+    memcpy(&value, &data[pos], sizeof(T));
+    pos += sizeof(T);
+    return value;
+}
+
+bool GSCaptureReader::open(const string& path)
+{
+    ifstream file(path, ios::binary | ios::ate);
+    if (!file.is_open())
+        return false;
+    data.resize(file.tellg());
+    file.seekg(0);
+    file.read((char*)data.data(), data.size());
+    file.close();
+
+    pos = 0;
+    char magic[sizeof(CAPTURE_MAGIC)];
+    for (size_t i = 0; i < sizeof(magic); i++)
+        magic[i] = read<char>();
+    if (pos > data.size() || memcmp(magic, CAPTURE_MAGIC, sizeof(magic)))
+        return false;
+    if (read<uint32_t>() != GSCaptureWriter::VERSION)
+        return false;
+    uint32_t state_size = read<uint32_t>();
+    if (pos + state_size > data.size())
+        return false;
+    state.assign((const char*)&data[pos], state_size);
+    pos += state_size;
+
+    //The GS thread state and the registers are plain copies of structs, so they are only valid for the same build
+    if (read<uint32_t>() != sizeof(GS_REGISTERS))
+        return false;
+    reg = read<GS_REGISTERS>();
+    messages_start = pos;
+    return pos <= data.size();
+}
+
+void GSCaptureReader::rewind()
+{
+    pos = messages_start;
+}
+
+bool GSCaptureReader::next_message(GS_message& message, vector<uint64_t>& image)
+{
+    if (pos >= data.size())
+        return false;
+
+    message.type = (GS_command)read<uint8_t>();
+    GS_message_payload& p = message.payload;
+    switch (message.type)
+    {
+        case write64_t:
+        case write64_privileged_t:
+            p.write64_payload.addr = read<uint32_t>();
+            p.write64_payload.value = read<uint64_t>();
+            break;
+        case write32_privileged_t:
+            p.write32_payload.addr = read<uint32_t>();
+            p.write32_payload.value = read<uint32_t>();
+            break;
+        case write_image_t:
+        {
+            uint32_t count = read<uint32_t>();
+            if (pos + count * sizeof(uint64_t) > data.size())
+                return false;
+            image.resize(count);
+            memcpy(image.data(), &data[pos], count * sizeof(uint64_t));
+            pos += count * sizeof(uint64_t);
+            p.image_payload.data = nullptr;
+            p.image_payload.count = count;
+        }
+            break;
+        case set_rgba_t:
+            p.rgba_payload.r = read<uint8_t>();
+            p.rgba_payload.g = read<uint8_t>();
+            p.rgba_payload.b = read<uint8_t>();
+            p.rgba_payload.a = read<uint8_t>();
+            break;
+        case set_stq_t:
+            p.stq_payload.s = read<uint32_t>();
+            p.stq_payload.t = read<uint32_t>();
+            p.stq_payload.q = read<uint32_t>();
+            break;
+        case set_uv_t:
+            p.uv_payload.u = read<uint16_t>();
+            p.uv_payload.v = read<uint16_t>();
+            break;
+        case set_xyz_t:
+            p.xyz_payload.x = read<uint32_t>();
+            p.xyz_payload.y = read<uint32_t>();
+            p.xyz_payload.z = read<uint32_t>();
+            p.xyz_payload.drawing_kick = read<uint8_t>();
+            break;
+        case set_q_t:
+            p.q_payload.q = read<float>();
+            break;
+        case set_crt_t:
+            p.crt_payload.interlaced = read<uint8_t>();
+            p.crt_payload.mode = read<int32_t>();
+            p.crt_payload.frame_mode = read<uint8_t>();
+            break;
+        case set_vblank_t:
+            p.vblank_payload.vblank = read<uint8_t>();
+            break;
+        case render_crt_t:
+        case assert_finish_t:
+        case readback_t:
+            break;
+        default:
+            return false;
+    }
+    return pos <= data.size();
+}
@@ -0,0 +1,53 @@
+#ifndef GSCAPTURE_HPP
+#define GSCAPTURE_HPP
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "gs.hpp"
+
+/**
+  * GS capture files hold the GS thread's whole state at the point the capture started, as saved by its save_state,
+  * followed by every message the EE sent to the GS thread from then on. The EE side's copy of the privileged
+  * registers is stored too, so that a replay can track the output resolution the way the EE does. Because the
+  * drawing state is part of the snapshot, a capture can start anywhere, and every replay starts out identical.
+  * Messages are stored as a type byte followed by only the fields that type uses. Pointers to EE-side buffers
+  * aren't stored; IMAGE data is stored inline instead.
+  **/
+class GSCaptureWriter
+{
+    private:
+        std::ofstream file;
+
+        template <typename T> void write(const T& value);
+    public:
+        static const uint32_t VERSION = 2;
+
+        bool open(const std::string& path, const std::string& state, const GS_REGISTERS& reg);
+        bool is_open();
+        void close();
+
+        void record(const GS_message& message);
+};
+
+class GSCaptureReader
+{
+    private:
+        std::vector<uint8_t> data;
+        size_t pos;
+        size_t messages_start;
+
+        template <typename T> T read();
+    public:
+        std::string state;
+        GS_REGISTERS reg;
+
+        bool open(const std::string& path);
+        void rewind();
+
+        //IMAGE payloads are returned in image, with a null data pointer in the message
+        bool next_message(GS_message& message, std::vector<uint64_t>& image);
+};
+
+#endif // GSCAPTURE_HPP
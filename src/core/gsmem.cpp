@@ -1,3 +1,4 @@
+#include <emmintrin.h>
 #include "gsmem.hpp"
 
 /**
@@ -224,3 +225,163 @@ const uint16_t columnTable4[16][32] =
       405, 413, 437, 445, 469, 477, 501, 509,
       407, 415, 439, 447, 471, 479, 503, 511 },
 };
+
+/**
+  * A block is made of four 64-byte columns, each covering two rows of 32-bit or 16-bit pixels.
+  * Within a column, every 16 bytes hold two pixel pairs from the upper row followed by the same pairs
+  * from the lower row, so rows can be separated with 64-bit unpacks. 16-bit columns additionally interleave
+  * pixels x and x + 8, which the shuffles below undo.
+  **/
+void unswizzle_block_32(const uint8_t* block, uint8_t* dest, uint32_t pitch)
+{
+    for (int column = 0; column < 4; column++)
+    {
+        const __m128i* src = (const __m128i*)(block + (column << 6));
+        __m128i g0 = _mm_loadu_si128(src);
+        __m128i g1 = _mm_loadu_si128(src + 1);
+        __m128i g2 = _mm_loadu_si128(src + 2);
+        __m128i g3 = _mm_loadu_si128(src + 3);
+
+        uint8_t* upper = dest + (column * 2) * pitch;
+        uint8_t* lower = upper + pitch;
+        _mm_storeu_si128((__m128i*)upper, _mm_unpacklo_epi64(g0, g1));
+        _mm_storeu_si128((__m128i*)(upper + 16), _mm_unpacklo_epi64(g2, g3));
+        _mm_storeu_si128((__m128i*)lower, _mm_unpackhi_epi64(g0, g1));
+        _mm_storeu_si128((__m128i*)(lower + 16), _mm_unpackhi_epi64(g2, g3));
+    }
+}
+
+void swizzle_block_32(uint8_t* block, const uint8_t* source, uint32_t pitch)
+{
+    for (int column = 0; column < 4; column++)
+    {
+        const uint8_t* upper = source + (column * 2) * pitch;
+        const uint8_t* lower = upper + pitch;
+        __m128i u0 = _mm_loadu_si128((const __m128i*)upper);
+        __m128i u1 = _mm_loadu_si128((const __m128i*)(upper + 16));
+        __m128i l0 = _mm_loadu_si128((const __m128i*)lower);
+        __m128i l1 = _mm_loadu_si128((const __m128i*)(lower + 16));
+
+        __m128i* dest = (__m128i*)(block + (column << 6));
+        _mm_storeu_si128(dest, _mm_unpacklo_epi64(u0, l0));
+        _mm_storeu_si128(dest + 1, _mm_unpackhi_epi64(u0, l0));
+        _mm_storeu_si128(dest + 2, _mm_unpacklo_epi64(u1, l1));
+        _mm_storeu_si128(dest + 3, _mm_unpackhi_epi64(u1, l1));
+    }
+}
+
+//Converts [0 8 1 9 2 10 3 11] into [0 1 2 3 8 9 10 11]
+static inline __m128i deinterleave_16(__m128i v)
+{
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 1, 2, 0));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(3, 1, 2, 0));
+    return _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+//Converts [0 1 2 3 8 9 10 11] back into [0 8 1 9 2 10 3 11]
+static inline __m128i interleave_16(__m128i v)
+{
+    v = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 1, 2, 0));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 1, 2, 0));
+    return _mm_shufflehi_epi16(v, _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+void unswizzle_block_16(const uint8_t* block, uint8_t* dest, uint32_t pitch)
+{
+    for (int column = 0; column < 4; column++)
+    {
+        const __m128i* src = (const __m128i*)(block + (column << 6));
+        __m128i g0 = _mm_loadu_si128(src);
+        __m128i g1 = _mm_loadu_si128(src + 1);
+        __m128i g2 = _mm_loadu_si128(src + 2);
+        __m128i g3 = _mm_loadu_si128(src + 3);
+
+        __m128i u0 = deinterleave_16(_mm_unpacklo_epi64(g0, g1));
+        __m128i u1 = deinterleave_16(_mm_unpacklo_epi64(g2, g3));
+        __m128i l0 = deinterleave_16(_mm_unpackhi_epi64(g0, g1));
+        __m128i l1 = deinterleave_16(_mm_unpackhi_epi64(g2, g3));
+
+        uint8_t* upper = dest + (column * 2) * pitch;
+        uint8_t* lower = upper + pitch;
+        _mm_storeu_si128((__m128i*)upper, _mm_unpacklo_epi64(u0, u1));
+        _mm_storeu_si128((__m128i*)(upper + 16), _mm_unpackhi_epi64(u0, u1));
+        _mm_storeu_si128((__m128i*)lower, _mm_unpacklo_epi64(l0, l1));
+        _mm_storeu_si128((__m128i*)(lower + 16), _mm_unpackhi_epi64(l0, l1));
+    }
+}
+
+void swizzle_block_16(uint8_t* block, const uint8_t* source, uint32_t pitch)
+{
+    for (int column = 0; column < 4; column++)
+    {
+        const uint8_t* upper = source + (column * 2) * pitch;
+        const uint8_t* lower = upper + pitch;
+        __m128i u_lo = _mm_loadu_si128((const __m128i*)upper);
+        __m128i u_hi = _mm_loadu_si128((const __m128i*)(upper + 16));
+        __m128i l_lo = _mm_loadu_si128((const __m128i*)lower);
+        __m128i l_hi = _mm_loadu_si128((const __m128i*)(lower + 16));
+
+        __m128i u0 = interleave_16(_mm_unpacklo_epi64(u_lo, u_hi));
+        __m128i u1 = interleave_16(_mm_unpackhi_epi64(u_lo, u_hi));
+        __m128i l0 = interleave_16(_mm_unpacklo_epi64(l_lo, l_hi));
+        __m128i l1 = interleave_16(_mm_unpackhi_epi64(l_lo, l_hi));
+
+        __m128i* dest = (__m128i*)(block + (column << 6));
+        _mm_storeu_si128(dest, _mm_unpacklo_epi64(u0, l0));
+        _mm_storeu_si128(dest + 1, _mm_unpackhi_epi64(u0, l0));
+        _mm_storeu_si128(dest + 2, _mm_unpacklo_epi64(u1, l1));
+        _mm_storeu_si128(dest + 3, _mm_unpackhi_epi64(u1, l1));
+    }
+}
+
+//8-bit and 4-bit columns alternate their row order and mix four rows per column, so these go through the column tables
+void unswizzle_block_8(const uint8_t* block, uint8_t* dest, uint32_t pitch)
+{
+    for (int y = 0; y < 16; y++)
+    {
+        uint8_t* row = dest + y * pitch;
+        for (int x = 0; x < 16; x++)
+            row[x] = block[columnTable8[y][x]];
+    }
+}
+
+void swizzle_block_8(uint8_t* block, const uint8_t* source, uint32_t pitch)
+{
+    for (int y = 0; y < 16; y++)
+    {
+        const uint8_t* row = source + y * pitch;
+        for (int x = 0; x < 16; x++)
+            block[columnTable8[y][x]] = row[x];
+    }
+}
+
+void unswizzle_block_4(const uint8_t* block, uint8_t* dest, uint32_t pitch)
+{
+    for (int y = 0; y < 16; y++)
+    {
+        uint8_t* row = dest + y * pitch;
+        for (int x = 0; x < 32; x += 2)
+        {
+            uint16_t even = columnTable4[y][x];
+            uint16_t odd = columnTable4[y][x + 1];
+            uint8_t lo = (block[even >> 1] >> ((even & 1) << 2)) & 0xF;
+            uint8_t hi = (block[odd >> 1] >> ((odd & 1) << 2)) & 0xF;
+            row[x >> 1] = lo | (hi << 4);
+        }
+    }
+}
+
+void swizzle_block_4(uint8_t* block, const uint8_t* source, uint32_t pitch)
+{
+    for (int y = 0; y < 16; y++)
+    {
+        const uint8_t* row = source + y * pitch;
+        for (int x = 0; x < 32; x++)
+        {
+            uint16_t addr = columnTable4[y][x];
+            uint8_t value = (row[x >> 1] >> ((x & 1) << 2)) & 0xF;
+            int shift = (addr & 1) << 2;
+            block[addr >> 1] = (block[addr >> 1] & ~(0xF << shift)) | (value << shift);
+        }
+    }
+}
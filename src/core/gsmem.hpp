@@ -15,4 +15,16 @@ extern const uint8_t columnTable16[8][16];
 extern const uint8_t columnTable8[16][16];
 extern const uint16_t columnTable4[16][32];
 
+//Whole-block conversion between a swizzled 256-byte GS block and a linear image with the given pitch in bytes.
+//Blocks are 8x8 pixels for 32-bit formats, 16x8 for 16-bit, 16x16 for 8-bit and 32x16 for 4-bit.
+//Linear 4-bit images store the even pixel of each pair in the low nibble.
+void unswizzle_block_32(const uint8_t* block, uint8_t* dest, uint32_t pitch);
+void unswizzle_block_16(const uint8_t* block, uint8_t* dest, uint32_t pitch);
+void unswizzle_block_8(const uint8_t* block, uint8_t* dest, uint32_t pitch);
+void unswizzle_block_4(const uint8_t* block, uint8_t* dest, uint32_t pitch);
+void swizzle_block_32(uint8_t* block, const uint8_t* source, uint32_t pitch);
+void swizzle_block_16(uint8_t* block, const uint8_t* source, uint32_t pitch);
+void swizzle_block_8(uint8_t* block, const uint8_t* source, uint32_t pitch);
+void swizzle_block_4(uint8_t* block, const uint8_t* source, uint32_t pitch);
+
 #endif // GSMEM_HPP
@@ -3,23 +3,25 @@
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
+#include <emmintrin.h>
 
 #include "gsthread.hpp"
 #include "gsmem.hpp"
+#include "serialize.hpp"
 #include "errors.hpp"
 
 using namespace std;
 
-//Swizzling tables - we declare these outside the class to prevent a stack overflow
-//Globals are allocated in a different memory segment of the executable
-static uint32_t page_PSMCT32[32][32][64];
-static uint32_t page_PSMCT32Z[32][32][64];
-static uint32_t page_PSMCT16[32][64][64];
-static uint32_t page_PSMCT16S[32][64][64];
-static uint32_t page_PSMCT16Z[32][64][64];
-static uint32_t page_PSMCT16SZ[32][64][64];
-static uint32_t page_PSMCT8[32][64][128];
-static uint32_t page_PSMCT4[32][128][128];
+//Swizzling tables - one page of each format, holding the offset of every pixel from the start of the page
+//in units of the format's pixel size. The starting block is added arithmetically, see the addr_* functions.
+static uint16_t page_PSMCT32[32][64];
+static uint16_t page_PSMCT32Z[32][64];
+static uint16_t page_PSMCT16[64][64];
+static uint16_t page_PSMCT16S[64][64];
+static uint16_t page_PSMCT16Z[64][64];
+static uint16_t page_PSMCT16SZ[64][64];
+static uint16_t page_PSMCT8[64][128];
+static uint16_t page_PSMCT4[128][128];
 
 #define printf(fmt, ...)(0)
 
@@ -51,15 +53,6 @@ T interpolate(int32_t x, T u1, int32_t x1, T u2, int32_t x2)
     return bark / (x2 - x1);
 }
 
-float interpolate_f(int32_t x, float u1, int32_t x1, float u2, int32_t x2)
-{
-    float bark = u1 * (x2 - x);
-    bark += u2 * (x - x1);
-    if (!(x2 - x1))
-        return u1;
-    return bark / (x2 - x1);
-}
-
 const unsigned int GraphicsSynthesizerThread::max_vertices[8] = {1, 2, 2, 3, 3, 3, 2, 0};
 
 GraphicsSynthesizerThread::GraphicsSynthesizerThread()
@@ -68,41 +61,38 @@ GraphicsSynthesizerThread::GraphicsSynthesizerThread()
     local_mem = nullptr;
 
     //Initialize swizzling tables
-    for (int block = 0; block < 32; block++)
+    for (int y = 0; y < 32; y++)
     {
-        for (int y = 0; y < 32; y++)
+        for (int x = 0; x < 64; x++)
         {
-            for (int x = 0; x < 64; x++)
-            {
-                uint32_t column = columnTable32[y & 0x7][x & 0x7];
-                page_PSMCT32[block][y][x] = (blockid_PSMCT32(block, 0, x, y) << 6) + column;
-                page_PSMCT32Z[block][y][x] = (blockid_PSMCT32Z(block, 0, x, y) << 6) + column;
-            }
+            uint32_t column = columnTable32[y & 0x7][x & 0x7];
+            page_PSMCT32[y][x] = (blockid_PSMCT32(0, 0, x, y) << 6) + column;
+            page_PSMCT32Z[y][x] = (blockid_PSMCT32Z(0, 0, x, y) << 6) + column;
         }
+    }
 
-        for (int y = 0; y < 64; y++)
+    for (int y = 0; y < 64; y++)
+    {
+        for (int x = 0; x < 64; x++)
         {
-            for (int x = 0; x < 64; x++)
-            {
-                uint32_t column = columnTable16[y & 0x7][x & 0xF];
-                page_PSMCT16[block][y][x] = (blockid_PSMCT16(block, 0, x, y) << 7) + column;
-                page_PSMCT16S[block][y][x] = (blockid_PSMCT16S(block, 0, x, y) << 7) + column;
-                page_PSMCT16Z[block][y][x] = (blockid_PSMCT16Z(block, 0, x, y) << 7) + column;
-                page_PSMCT16SZ[block][y][x] = (blockid_PSMCT16SZ(block, 0, x, y) << 7) + column;
-            }
+            uint32_t column = columnTable16[y & 0x7][x & 0xF];
+            page_PSMCT16[y][x] = (blockid_PSMCT16(0, 0, x, y) << 7) + column;
+            page_PSMCT16S[y][x] = (blockid_PSMCT16S(0, 0, x, y) << 7) + column;
+            page_PSMCT16Z[y][x] = (blockid_PSMCT16Z(0, 0, x, y) << 7) + column;
+            page_PSMCT16SZ[y][x] = (blockid_PSMCT16SZ(0, 0, x, y) << 7) + column;
         }
+    }
 
-        for (int y = 0; y < 64; y++)
-        {
-            for (int x = 0; x < 128; x++)
-                page_PSMCT8[block][y][x] = (blockid_PSMCT8(block, 0, x, y) << 8) + columnTable8[y & 0xF][x & 0xF];
-        }
+    for (int y = 0; y < 64; y++)
+    {
+        for (int x = 0; x < 128; x++)
+            page_PSMCT8[y][x] = (blockid_PSMCT8(0, 0, x, y) << 8) + columnTable8[y & 0xF][x & 0xF];
+    }
 
-        for (int y = 0; y < 128; y++)
-        {
-            for (int x = 0; x < 128; x++)
-                page_PSMCT4[block][y][x] = (blockid_PSMCT4(block, 0, x, y) << 9) + columnTable4[y & 0xF][x & 0x1F];
-        }
+    for (int y = 0; y < 128; y++)
+    {
+        for (int x = 0; x < 128; x++)
+            page_PSMCT4[y][x] = (blockid_PSMCT4(0, 0, x, y) << 9) + columnTable4[y & 0xF][x & 0x1F];
     }
 }
 
@@ -132,6 +122,20 @@ void GraphicsSynthesizerThread::event_loop(gs_fifo* fifo, gs_return_fifo* return
                     gs.write64(p.addr, p.value);
                     break;
                 }
+                case write_image_t:
+                {
+                    auto p = data.payload.image_payload;
+                    gs.write_HWREG_image(p.data, p.count);
+                    delete[] p.data;
+                    break;
+                }
+                case readback_t:
+                {
+                    auto p = data.payload.readback_payload;
+                    *p.quads = gs.local_to_host(p.target, p.capacity);
+                    p.ready->store(true);
+                    break;
+                }
                 case write64_privileged_t:
                 {
                     auto p = data.payload.write64_payload;
@@ -192,7 +196,8 @@ void GraphicsSynthesizerThread::event_loop(gs_fifo* fifo, gs_return_fifo* return
                     std::lock_guard<std::mutex> lock(*p.target_mutex, std::adopt_lock);
                     gs.render_CRT(p.target);
                     GS_return_message_payload return_payload;
-                    return_payload.no_payload = { 0 };
+                    return_payload.render_complete_payload = { gs.primitive_count };
+                    gs.primitive_count = 0;
                     return_fifo->push({ GS_return::render_complete_t,return_payload });
                     break;
                 }
@@ -208,6 +213,20 @@ void GraphicsSynthesizerThread::event_loop(gs_fifo* fifo, gs_return_fifo* return
                 case memdump_t:
                     gs.memdump();
                     break;
+                case save_state_t:
+                {
+                    auto p = data.payload.save_state_payload;
+                    gs.save_state(*p.state);
+                    p.ready->store(true);
+                    break;
+                }
+                case load_state_t:
+                {
+                    auto p = data.payload.load_state_payload;
+                    gs.load_state(*p.state);
+                    p.ready->store(true);
+                    break;
+                }
                 case die_t:
                     return;
                 }
@@ -235,12 +254,33 @@ void GraphicsSynthesizerThread::reset()
     pixels_transferred = 0;
     num_vertices = 0;
     frame_count = 0;
+    primitive_count = 0;
 
     reg.reset();
     context1.reset();
     context2.reset();
     PSMCT24_color = 0;
     PSMCT24_unpacked_count = 0;
+    DTHE = false;
+    COLCLAMP = false;
+    texture_cache.clear();
+    texcache_texels = 0;
+    texcache_time = 0;
+    write_epoch = 0;
+    memset(page_stamps, 0, sizeof(page_stamps));
+    for (int i = 0; i < 2; i++)
+    {
+        CRT_outputs[i].target = nullptr;
+        CRT_outputs[i].pages.clear();
+    }
+    current_texture = nullptr;
+    memset(depth_blocks, 0, sizeof(depth_blocks));
+    memset(CLUT_buffer, 0, sizeof(CLUT_buffer));
+    CBP0 = 0xFFFFFFFF;
+    CBP1 = 0xFFFFFFFF;
+    CLUT_palette_dirty = true;
+    palette_generation = 0;
+    memset(DIMX, 0, sizeof(DIMX));
     current_ctx = &context1;
 }
 
@@ -251,42 +291,249 @@ void GraphicsSynthesizerThread::memdump()
     file.close();
 }
 
+//Only the emulated state is saved; caches are rebuilt from local memory after loading. GS captures use this too.
+void GraphicsSynthesizerThread::save_state(std::ostream& state)
+{
+    save_state_memory(state, local_mem, 1024 * 1024 * 4);
+    state.write((char*)&frame_complete, sizeof(frame_complete));
+    state.write((char*)&frame_count, sizeof(frame_count));
+    state.write((char*)&CRT_mode, sizeof(CRT_mode));
+    state.write((char*)&IMR, sizeof(IMR));
+    state.write((char*)&context1, sizeof(context1));
+    state.write((char*)&context2, sizeof(context2));
+    bool second_ctx = current_ctx == &context2;
+    state.write((char*)&second_ctx, sizeof(second_ctx));
+
+    state.write((char*)&PRIM, sizeof(PRIM));
+    state.write((char*)&RGBAQ, sizeof(RGBAQ));
+    state.write((char*)&UV, sizeof(UV));
+    state.write((char*)&ST, sizeof(ST));
+    state.write((char*)&TEXA, sizeof(TEXA));
+    state.write((char*)&TEXCLUT, sizeof(TEXCLUT));
+    state.write((char*)&DTHE, sizeof(DTHE));
+    state.write((char*)&DIMX, sizeof(DIMX));
+    state.write((char*)&COLCLAMP, sizeof(COLCLAMP));
+    state.write((char*)&use_PRIM, sizeof(use_PRIM));
+
+    state.write((char*)&BITBLTBUF, sizeof(BITBLTBUF));
+    state.write((char*)&TRXPOS, sizeof(TRXPOS));
+    state.write((char*)&TRXREG, sizeof(TRXREG));
+    state.write((char*)&TRXDIR, sizeof(TRXDIR));
+    state.write((char*)&BUSDIR, sizeof(BUSDIR));
+    state.write((char*)&pixels_transferred, sizeof(pixels_transferred));
+    state.write((char*)&PSMCT24_color, sizeof(PSMCT24_color));
+    state.write((char*)&PSMCT24_unpacked_count, sizeof(PSMCT24_unpacked_count));
+
+    state.write((char*)&reg, sizeof(reg));
+    state.write((char*)&current_vtx, sizeof(current_vtx));
+    state.write((char*)&vtx_queue, sizeof(vtx_queue));
+    state.write((char*)&num_vertices, sizeof(num_vertices));
+
+    state.write((char*)&CLUT_buffer, sizeof(CLUT_buffer));
+    state.write((char*)&CBP0, sizeof(CBP0));
+    state.write((char*)&CBP1, sizeof(CBP1));
+}
+
+void GraphicsSynthesizerThread::load_state(std::istream& state)
+{
+    load_state_memory(state, local_mem, 1024 * 1024 * 4);
+    state.read((char*)&frame_complete, sizeof(frame_complete));
+    state.read((char*)&frame_count, sizeof(frame_count));
+    state.read((char*)&CRT_mode, sizeof(CRT_mode));
+    state.read((char*)&IMR, sizeof(IMR));
+    state.read((char*)&context1, sizeof(context1));
+    state.read((char*)&context2, sizeof(context2));
+    bool second_ctx;
+    state.read((char*)&second_ctx, sizeof(second_ctx));
+    current_ctx = second_ctx ? &context2 : &context1;
+
+    state.read((char*)&PRIM, sizeof(PRIM));
+    state.read((char*)&RGBAQ, sizeof(RGBAQ));
+    state.read((char*)&UV, sizeof(UV));
+    state.read((char*)&ST, sizeof(ST));
+    state.read((char*)&TEXA, sizeof(TEXA));
+    state.read((char*)&TEXCLUT, sizeof(TEXCLUT));
+    state.read((char*)&DTHE, sizeof(DTHE));
+    state.read((char*)&DIMX, sizeof(DIMX));
+    state.read((char*)&COLCLAMP, sizeof(COLCLAMP));
+    state.read((char*)&use_PRIM, sizeof(use_PRIM));
+
+    state.read((char*)&BITBLTBUF, sizeof(BITBLTBUF));
+    state.read((char*)&TRXPOS, sizeof(TRXPOS));
+    state.read((char*)&TRXREG, sizeof(TRXREG));
+    state.read((char*)&TRXDIR, sizeof(TRXDIR));
+    state.read((char*)&BUSDIR, sizeof(BUSDIR));
+    state.read((char*)&pixels_transferred, sizeof(pixels_transferred));
+    state.read((char*)&PSMCT24_color, sizeof(PSMCT24_color));
+    state.read((char*)&PSMCT24_unpacked_count, sizeof(PSMCT24_unpacked_count));
+
+    state.read((char*)&reg, sizeof(reg));
+    state.read((char*)&current_vtx, sizeof(current_vtx));
+    state.read((char*)&vtx_queue, sizeof(vtx_queue));
+    state.read((char*)&num_vertices, sizeof(num_vertices));
+
+    state.read((char*)&CLUT_buffer, sizeof(CLUT_buffer));
+    state.read((char*)&CBP0, sizeof(CBP0));
+    state.read((char*)&CBP1, sizeof(CBP1));
+
+    CLUT_palette_dirty = true;
+    current_texture = nullptr;
+    for (int i = 0; i < 512; i++)
+        stamp_page(i << 13);
+    memset(depth_blocks, 0, sizeof(depth_blocks));
+}
+
+/**
+  * Outputs the displayed framebuffer. The framebuffer is deswizzled a band of blocks at a time, and every output
+  * column takes its source column from a table built once per frame, so there is no per-pixel addressing or divide.
+  * The EE alternates between two output buffers. Each one remembers the display registers and framebuffer pages it
+  * was filled from, and is left untouched while none of them have changed.
+  **/
 void GraphicsSynthesizerThread::render_CRT(uint32_t* target)
 {
     printf("DISPLAY2: (%d, %d) wh: (%d, %d)\n", reg.DISPLAY2.x >> 2, reg.DISPLAY2.y, reg.DISPLAY2.width >> 2, reg.DISPLAY2.height);
-    DISPLAY &currentDisplay = reg.DISPLAY1;
-    DISPFB &currentFB = reg.DISPFB1;
-    if (reg.PMODE.circuit2 == false)
+    DISPLAY* display = &reg.DISPLAY1;
+    DISPFB* fb = &reg.DISPFB1;
+    if (reg.PMODE.circuit2)
     {
-        currentDisplay = reg.DISPLAY1;
-        currentFB = reg.DISPFB1;
+        display = &reg.DISPLAY2;
+        fb = &reg.DISPFB2;
     }
-    else
+
+    //Use the slot that last held target, otherwise whichever is free or not the other buffer
+    CRTOutput* output = &CRT_outputs[0];
+    if (CRT_outputs[0].target != target && (CRT_outputs[0].target || CRT_outputs[1].target == target))
+        output = &CRT_outputs[1];
+    if (CRT_output_current(*output, target, *fb, *display))
+        return;
+
+    int width = display->width >> 2;
+    int height = display->height;
+    bool double_lines = reg.SMODE2.frame_mode && reg.SMODE2.interlaced;
+
+    //Horizontal scaling
+    uint32_t block_width = (fb->format == 0x02 || fb->format == 0x0A) ? 16 : 8;
+    uint32_t max_column = 0;
+    bool unscaled = fb->x == 0 && fb->width == (uint32_t)width;
+    CRT_columns.resize(width);
+    for (int x = 0; x < width; x++)
     {
-        currentDisplay = reg.DISPLAY2;
-        currentFB = reg.DISPFB2;
+        CRT_columns[x] = ((fb->x + x) * fb->width) / width;
+        max_column = max(max_column, CRT_columns[x]);
     }
-    int width = currentDisplay.width >> 2;
-    for (int y = 0; y < currentDisplay.height; y++)
+    uint32_t band_width = (max_column + block_width) & ~(block_width - 1);
+    CRT_band.resize(band_width * 8);
+
+    bool page_used[512] = {};
+    uint32_t band_y = 0xFFFFFFFF;
+    for (int y = 0; y < height; y++)
     {
-        for (int x = 0; x < width; x++)
+        int pixel_y = y;
+        if (double_lines)
+            pixel_y *= 2;
+        if (pixel_y >= height)
+            break;
+
+        uint32_t scaled_y = fb->y + y;
+        if ((scaled_y & ~0x7) != band_y)
         {
-            int pixel_x = x;
-            int pixel_y = y;
+            band_y = scaled_y & ~0x7;
+            decode_CRT_band(*fb, band_y, page_used);
+        }
 
-            if (reg.SMODE2.frame_mode && reg.SMODE2.interlaced)
-                pixel_y *= 2;
-            if (pixel_x >= width || pixel_y >= currentDisplay.height)
-                continue;
-            uint32_t scaled_x = currentFB.x + x;
-            uint32_t scaled_y = currentFB.y + y;
-            scaled_x *= currentFB.width;
-            scaled_x /= width;
-            uint32_t value = read_PSMCT32_block(currentFB.frame_base * 4, currentFB.width, scaled_x, scaled_y);
-            target[pixel_x + (pixel_y * width)] = value | 0xFF000000;
-
-            if (reg.SMODE2.frame_mode && reg.SMODE2.interlaced)
-                target[pixel_x + ((pixel_y + 1)  * width)] = value | 0xFF000000;
+        const uint32_t* line = &CRT_band[(scaled_y & 0x7) * band_width];
+        uint32_t* out = &target[pixel_y * width];
+        if (unscaled)
+            memcpy(out, line, width * sizeof(uint32_t));
+        else
+        {
+            for (int x = 0; x < width; x++)
+                out[x] = line[CRT_columns[x]];
+        }
+
+        if (double_lines)
+            memcpy(out + width, out, width * sizeof(uint32_t));
+    }
+
+    output->target = target;
+    output->stamp = write_epoch;
+    write_epoch++;
+    output->PMODE = reg.PMODE;
+    output->SMODE2 = reg.SMODE2;
+    output->dispfb = *fb;
+    output->display = *display;
+    output->pages.clear();
+    for (uint16_t page = 0; page < 512; page++)
+    {
+        if (page_used[page])
+            output->pages.push_back(page);
+    }
+}
+
+//Returns true if output already holds what target would be filled with
+bool GraphicsSynthesizerThread::CRT_output_current(const CRTOutput& output, uint32_t* target, const DISPFB& fb,
+                                                   const DISPLAY& display)
+{
+    if (output.target != target)
+        return false;
+
+    //Register copies are compared bytewise. Padding can only cause a false mismatch, which just redraws.
+    if (memcmp(&output.PMODE, &reg.PMODE, sizeof(PMODE_REG)) || memcmp(&output.SMODE2, &reg.SMODE2, sizeof(SMODE)) ||
+            memcmp(&output.dispfb, &fb, sizeof(DISPFB)) || memcmp(&output.display, &display, sizeof(DISPLAY)))
+        return false;
+
+    for (unsigned int i = 0; i < output.pages.size(); i++)
+    {
+        if (page_stamps[output.pages[i]] > output.stamp)
+            return false;
+    }
+    return true;
+}
+
+//Deswizzles the 8 rows of the framebuffer starting at y into CRT_band as opaque RGBA32
+void GraphicsSynthesizerThread::decode_CRT_band(const DISPFB& fb, uint32_t y, bool* page_used)
+{
+    uint32_t band_width = CRT_band.size() / 8;
+    uint32_t base = fb.frame_base * 4;
+    const __m128i opaque = _mm_set1_epi32(0xFF000000);
+    if (fb.format == 0x02 || fb.format == 0x0A)
+    {
+        const __m128i mask = _mm_set1_epi32(0x1F);
+        uint16_t linear[128];
+        for (uint32_t x = 0; x < band_width; x += 16)
+        {
+            uint32_t addr = pixel_addr(fb.format, base, fb.width, x, y);
+            page_used[(addr >> 13) & 0x1FF] = true;
+            unswizzle_block_16(&local_mem[addr], (uint8_t*)linear, 32);
+            for (int row = 0; row < 8; row++)
+            {
+                for (int i = 0; i < 16; i += 4)
+                {
+                    __m128i color = _mm_loadl_epi64((const __m128i*)&linear[(row << 4) + i]);
+                    color = _mm_unpacklo_epi16(color, _mm_setzero_si128());
+                    __m128i r = _mm_slli_epi32(_mm_and_si128(color, mask), 3);
+                    __m128i g = _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(color, 5), mask), 11);
+                    __m128i b = _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(color, 10), mask), 19);
+                    __m128i rgba = _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, opaque));
+                    _mm_storeu_si128((__m128i*)&CRT_band[row * band_width + x + i], rgba);
+                }
+            }
+        }
+    }
+    else
+    {
+        //PSMCT32 and PSMCT24 share a layout, and the display ignores alpha
+        uint8_t format = (fb.format == 0x01) ? 0x01 : 0x00;
+        for (uint32_t x = 0; x < band_width; x += 8)
+        {
+            uint32_t addr = pixel_addr(format, base, fb.width, x, y);
+            page_used[(addr >> 13) & 0x1FF] = true;
+            unswizzle_block_32(&local_mem[addr], (uint8_t*)&CRT_band[x], band_width * 4);
+        }
+        for (uint32_t i = 0; i < CRT_band.size(); i += 4)
+        {
+            __m128i* pixels = (__m128i*)&CRT_band[i];
+            _mm_storeu_si128(pixels, _mm_or_si128(_mm_loadu_si128(pixels), opaque));
         }
     }
 }
@@ -404,9 +651,11 @@ void GraphicsSynthesizerThread::write64(uint32_t addr, uint64_t value)
             break;
         case 0x0006:
             context1.set_tex0(value);
+            load_CLUT(context1.tex0);
             break;
         case 0x0007:
             context2.set_tex0(value);
+            load_CLUT(context2.tex0);
             break;
         case 0x0008:
             context1.set_clamp(value);
@@ -425,9 +674,11 @@ void GraphicsSynthesizerThread::write64(uint32_t addr, uint64_t value)
             break;
         case 0x0016:
             context1.set_tex2(value);
+            load_CLUT(context1.tex0);
             break;
         case 0x0017:
             context2.set_tex2(value);
+            load_CLUT(context2.tex0);
             break;
         case 0x0018:
             context1.set_xyoffset(value);
@@ -472,6 +723,19 @@ void GraphicsSynthesizerThread::write64(uint32_t addr, uint64_t value)
         case 0x0043:
             context2.set_alpha(value);
             break;
+        case 0x0044:
+            //DIMX - 4x4 matrix of signed 3-bit dither offsets
+            for (int y = 0; y < 4; y++)
+            {
+                for (int x = 0; x < 4; x++)
+                {
+                    int8_t offset = (value >> ((y * 16) + (x * 4))) & 0x7;
+                    if (offset & 0x4)
+                        offset -= 8;
+                    DIMX[y][x] = offset;
+                }
+            }
+            break;
         case 0x0045:
             DTHE = value & 0x1;
             break;
@@ -540,6 +804,7 @@ void GraphicsSynthesizerThread::write64(uint32_t addr, uint64_t value)
                     host_to_host();
                     TRXDIR = 3;
                 }
+                //Local-to-host transfers are run by the readback message that the EE sends after this write
             }
             break;
         case 0x0054:
@@ -626,59 +891,63 @@ uint32_t GraphicsSynthesizerThread::blockid_PSMCT4(uint32_t block, uint32_t widt
     return block + ((y >> 2) & ~0x1F) * (width / 128) + ((x >> 2) & ~0x1F) + blockTable4[(y >> 4) & 7][(x >> 5) & 3];
 }
 
+/**
+  * A block number simply adds its offset to the address within the page, even past the end of the page,
+  * so the starting block is the start address (block * block size) and only one page of each table is needed.
+  **/
 uint32_t GraphicsSynthesizerThread::addr_PSMCT32(uint32_t block, uint32_t width, uint32_t x, uint32_t y)
 {
-    uint32_t page = ((block >> 5) + (y >> 5) * width + (x >> 6));
-    uint32_t addr = (page << 11) + page_PSMCT32[block & 0x1F][y & 0x1F][x & 0x3F];
+    uint32_t page = (y >> 5) * width + (x >> 6);
+    uint32_t addr = (block << 6) + (page << 11) + page_PSMCT32[y & 0x1F][x & 0x3F];
     return (addr << 2) & 0x003FFFFC;
 }
 
 uint32_t GraphicsSynthesizerThread::addr_PSMCT32Z(uint32_t block, uint32_t width, uint32_t x, uint32_t y)
 {
-    uint32_t page = ((block >> 5) + (y >> 5) * width + (x >> 6));
-    uint32_t addr = (page << 11) + page_PSMCT32Z[block & 0x1F][y & 0x1F][x & 0x3F];
+    uint32_t page = (y >> 5) * width + (x >> 6);
+    uint32_t addr = (block << 6) + (page << 11) + page_PSMCT32Z[y & 0x1F][x & 0x3F];
     return (addr << 2) & 0x003FFFFC;
 }
 
 uint32_t GraphicsSynthesizerThread::addr_PSMCT16(uint32_t block, uint32_t width, uint32_t x, uint32_t y)
 {
-    uint32_t page = ((block >> 5) + (y >> 6) * width + (x >> 6));
-    uint32_t addr = (page << 12) + page_PSMCT16[block & 0x1F][y & 0x3F][x & 0x3F];
+    uint32_t page = (y >> 6) * width + (x >> 6);
+    uint32_t addr = (block << 7) + (page << 12) + page_PSMCT16[y & 0x3F][x & 0x3F];
     return (addr << 1) & 0x003FFFFE;
 }
 
 uint32_t GraphicsSynthesizerThread::addr_PSMCT16S(uint32_t block, uint32_t width, uint32_t x, uint32_t y)
 {
-    uint32_t page = ((block >> 5) + (y >> 6) * width + (x >> 6));
-    uint32_t addr = (page << 12) + page_PSMCT16S[block & 0x1F][y & 0x3F][x & 0x3F];
+    uint32_t page = (y >> 6) * width + (x >> 6);
+    uint32_t addr = (block << 7) + (page << 12) + page_PSMCT16S[y & 0x3F][x & 0x3F];
     return (addr << 1) & 0x003FFFFE;
 }
 
 uint32_t GraphicsSynthesizerThread::addr_PSMCT16Z(uint32_t block, uint32_t width, uint32_t x, uint32_t y)
 {
-    uint32_t page = ((block >> 5) + (y >> 6) * width + (x >> 6));
-    uint32_t addr = (page << 12) + page_PSMCT16Z[block & 0x1F][y & 0x3F][x & 0x3F];
+    uint32_t page = (y >> 6) * width + (x >> 6);
+    uint32_t addr = (block << 7) + (page << 12) + page_PSMCT16Z[y & 0x3F][x & 0x3F];
     return (addr << 1) & 0x003FFFFE;
 }
 
 uint32_t GraphicsSynthesizerThread::addr_PSMCT16SZ(uint32_t block, uint32_t width, uint32_t x, uint32_t y)
 {
-    uint32_t page = ((block >> 5) + (y >> 6) * width + (x >> 6));
-    uint32_t addr = (page << 12) + page_PSMCT16SZ[block & 0x1F][y & 0x3F][x & 0x3F];
+    uint32_t page = (y >> 6) * width + (x >> 6);
+    uint32_t addr = (block << 7) + (page << 12) + page_PSMCT16SZ[y & 0x3F][x & 0x3F];
     return (addr << 1) & 0x003FFFFE;
 }
 
 uint32_t GraphicsSynthesizerThread::addr_PSMCT8(uint32_t block, uint32_t width, uint32_t x, uint32_t y)
 {
-    uint32_t page = ((block >> 5) + (y >> 6) * (width >> 1) + (x >> 7));
-    uint32_t addr = (page << 13) + page_PSMCT8[block & 0x1F][y & 0x3F][x & 0x7F];
+    uint32_t page = (y >> 6) * (width >> 1) + (x >> 7);
+    uint32_t addr = (block << 8) + (page << 13) + page_PSMCT8[y & 0x3F][x & 0x7F];
     return addr & 0x003FFFFF;
 }
 
 uint32_t GraphicsSynthesizerThread::addr_PSMCT4(uint32_t block, uint32_t width, uint32_t x, uint32_t y)
 {
-    uint32_t page = ((block >> 5) + (y >> 7) * (width >> 1) + (x >> 7));
-    uint32_t addr = (page << 14) + page_PSMCT4[block & 0x1F][y & 0x7F][x & 0x7F];
+    uint32_t page = (y >> 7) * (width >> 1) + (x >> 7);
+    uint32_t addr = (block << 9) + (page << 14) + page_PSMCT4[y & 0x7F][x & 0x7F];
     return addr & 0x007FFFFF;
 }
 
@@ -735,18 +1004,21 @@ uint8_t GraphicsSynthesizerThread::read_PSMCT4_block(uint32_t base, uint32_t wid
 void GraphicsSynthesizerThread::write_PSMCT32_block(uint32_t base, uint32_t width, uint32_t x, uint32_t y, uint32_t value)
 {
     uint32_t addr = addr_PSMCT32(base / 256, width / 64, x, y);
+    stamp_page(addr);
     *(uint32_t*)&local_mem[addr] = value;
 }
 
 void GraphicsSynthesizerThread::write_PSMCT32Z_block(uint32_t base, uint32_t width, uint32_t x, uint32_t y, uint32_t value)
 {
     uint32_t addr = addr_PSMCT32Z(base / 256, width / 64, x, y);
+    stamp_page(addr);
     *(uint32_t*)&local_mem[addr] = value;
 }
 
 void GraphicsSynthesizerThread::write_PSMCT24Z_block(uint32_t base, uint32_t width, uint32_t x, uint32_t y, uint32_t value)
 {
     uint32_t addr = addr_PSMCT32Z(base / 256, width / 64, x, y);
+    stamp_page(addr);
     uint32_t old_mem = *(uint32_t*)&local_mem[addr];
     *(uint32_t*)&local_mem[addr] = (old_mem & 0xFF000000) | value;
 }
@@ -754,40 +1026,46 @@ void GraphicsSynthesizerThread::write_PSMCT24Z_block(uint32_t base, uint32_t wid
 void GraphicsSynthesizerThread::write_PSMCT16_block(uint32_t base, uint32_t width, uint32_t x, uint32_t y, uint16_t value)
 {
     uint32_t addr = addr_PSMCT16(base / 256, width / 64, x, y);
+    stamp_page(addr);
     *(uint16_t*)&local_mem[addr] = value;
 }
 
 void GraphicsSynthesizerThread::write_PSMCT16S_block(uint32_t base, uint32_t width, uint32_t x, uint32_t y, uint16_t value)
 {
     uint32_t addr = addr_PSMCT16S(base / 256, width / 64, x, y);
+    stamp_page(addr);
     *(uint16_t*)&local_mem[addr] = value;
 }
 
 void GraphicsSynthesizerThread::write_PSMCT16Z_block(uint32_t base, uint32_t width, uint32_t x, uint32_t y, uint16_t value)
 {
     uint32_t addr = addr_PSMCT16Z(base / 256, width / 64, x, y);
+    stamp_page(addr);
     *(uint16_t*)&local_mem[addr] = value;
 }
 
 void GraphicsSynthesizerThread::write_PSMCT16SZ_block(uint32_t base, uint32_t width, uint32_t x, uint32_t y, uint16_t value)
 {
     uint32_t addr = addr_PSMCT16SZ(base / 256, width / 64, x, y);
+    stamp_page(addr);
     *(uint16_t*)&local_mem[addr] = value;
 }
 
 void GraphicsSynthesizerThread::write_PSMCT8_block(uint32_t base, uint32_t width, uint32_t x, uint32_t y, uint8_t value)
 {
     uint32_t addr = addr_PSMCT8(base / 256, width / 64, x, y);
+    stamp_page(addr);
     local_mem[addr] = value;
 }
 
 void GraphicsSynthesizerThread::write_PSMCT4_block(uint32_t base, uint32_t width, uint32_t x, uint32_t y, uint8_t value)
 {
     uint32_t addr = addr_PSMCT4(base / 256, width / 64, x, y);
+    stamp_page(addr >> 1);
     if (addr & 0x1)
     {
         local_mem[addr >> 1] &= ~0xF0;
-        local_mem[addr >> 1] |= value & 0xF0;
+        local_mem[addr >> 1] |= (value & 0xF) << 4;
     }
     else
     {
@@ -872,6 +1150,9 @@ void GraphicsSynthesizerThread::vertex_kick(bool drawing_kick)
 
 void GraphicsSynthesizerThread::render_primitive()
 {
+    primitive_count++;
+    if (PRIM.texture_mapping)
+        current_texture = get_texture();
     switch (PRIM.prim_type)
     {
         case 0:
@@ -892,294 +1173,438 @@ void GraphicsSynthesizerThread::render_primitive()
     }
 }
 
-bool GraphicsSynthesizerThread::depth_test(int32_t x, int32_t y, uint32_t z)
+static inline uint32_t pack_RGBA(const RGBAQ_REG& color)
+{
+    return color.r | (color.g << 8) | (color.b << 16) | (color.a << 24);
+}
+
+//Same as the modulate case of tex_lookup on a packed RGBA32 texel
+static inline uint32_t modulate_texel(uint32_t texel, const RGBAQ_REG& color)
+{
+    uint32_t r = (((texel & 0xFF) * color.r) >> 7) & 0xFF;
+    uint32_t g = ((((texel >> 8) & 0xFF) * color.g) >> 7) & 0xFF;
+    uint32_t b = ((((texel >> 16) & 0xFF) * color.b) >> 7) & 0xFF;
+    uint32_t a = (((texel >> 24) * color.a) >> 7) & 0xFF;
+    return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+//Selects an input of the alpha blending formula: 0 = source color, 1 = framebuffer color, 2 = zero
+static inline __m128i blend_input(uint8_t spec, __m128i source, __m128i dest)
 {
-    uint32_t base = current_ctx->zbuf.base_pointer;
-    uint32_t width = current_ctx->frame.width;
-    switch (current_ctx->test.depth_method)
+    switch (spec)
     {
-        case 0: //FAIL
-            return false;
-        case 1: //PASS
-            return true;
-        case 2: //GEQUAL
-            switch (current_ctx->zbuf.format)
-            {
-                case 0x00:
-                    return z >= read_PSMCT32Z_block(base, width, x, y);
-                case 0x01:
-                    z = min(z, 0xFFFFFFU);
-                    return z >= (read_PSMCT32Z_block(base, width, x, y) & 0xFFFFFF);
-                case 0x02:
-                    z = min(z, 0xFFFFU);
-                    return z >= read_PSMCT16Z_block(base, width, x, y);
-                case 0x0A:
-                    z = min(z, 0xFFFFU);
-                    return z >= read_PSMCT16SZ_block(base, width, x, y);
-                default:
-                    Errors::die("[GS_t] Unrecognized zbuf format $%02X\n", current_ctx->zbuf.format);
-            }
-            break;
-        case 3: //GREATER
-            switch (current_ctx->zbuf.format)
-            {
-                case 0x00:
-                    return z > read_PSMCT32Z_block(base, width, x, y);
-                case 0x01:
-                    z = min(z, 0xFFFFFFU);
-                    return z > (read_PSMCT32Z_block(base, width, x, y) & 0xFFFFFF);
-                case 0x02:
-                    z = min(z, 0xFFFFU);
-                    return z > read_PSMCT16Z_block(base, width, x, y);
-                case 0x0A:
-                    z = min(z, 0xFFFFU);
-                    return z > read_PSMCT16SZ_block(base, width, x, y);
-                default:
-                    Errors::die("[GS_t] Unrecognized zbuf format $%02X\n", current_ctx->zbuf.format);
-            }
-            break;
+        case 0:
+            return source;
+        case 1:
+            return dest;
+        default:
+            return _mm_setzero_si128();
     }
-    return false;
+}
+
+//Unsigned 32-bit a > b
+static inline __m128i cmpgt_epu32(__m128i a, __m128i b)
+{
+    const __m128i sign = _mm_set1_epi32(0x80000000);
+    return _mm_cmpgt_epi32(_mm_xor_si128(a, sign), _mm_xor_si128(b, sign));
+}
+
+static inline uint32_t expand_PSMCT16(uint16_t color)
+{
+    uint32_t r = (color & 0x1F) << 3;
+    uint32_t g = ((color >> 5) & 0x1F) << 3;
+    uint32_t b = ((color >> 10) & 0x1F) << 3;
+    uint32_t a = (color & 0x8000) ? 0x80 : 0x00;
+    return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+static inline uint16_t compress_PSMCT16(uint32_t color)
+{
+    uint16_t r = (color >> 3) & 0x1F;
+    uint16_t g = (color >> 11) & 0x1F;
+    uint16_t b = (color >> 19) & 0x1F;
+    uint16_t a = (color >> 16) & 0x8000;
+    return r | (g << 5) | (b << 10) | a;
 }
 
 void GraphicsSynthesizerThread::draw_pixel(int32_t x, int32_t y, uint32_t z, RGBAQ_REG& color, bool alpha_blending)
 {
     x >>= 4;
     y >>= 4;
+    uint32_t quad_z[4] = {0, 0, 0, 0};
+    RGBAQ_REG quad_color[4] = {};
+    int lane = (x & 0x1) | ((y & 0x1) << 1);
+    quad_z[lane] = z;
+    quad_color[lane] = color;
+    draw_quad(x & ~0x1, y & ~0x1, 1 << lane, quad_z, quad_color, alpha_blending);
+}
+
+/**
+  * Draws the fragments of the 2x2 quad whose top-left pixel is (x, y). x and y are whole pixels and must be even.
+  * Lane i is the pixel (x + (i & 1), y + (i >> 1)) and is only considered if bit i of coverage is set.
+  * An aligned quad occupies four consecutive words of a PSMCT32/PSMCT32Z column, so the tests, blending,
+  * dithering, clamping and FBMSK are done on all lanes at once and written back with one store.
+  **/
+void GraphicsSynthesizerThread::draw_quad(int32_t x, int32_t y, uint8_t coverage, const uint32_t* z,
+                                          const RGBAQ_REG* colors, bool alpha_blending)
+{
     TEST* test = &current_ctx->test;
-    bool update_frame = true;
-    bool update_alpha = true;
-    bool update_z = !current_ctx->zbuf.no_update;
+    FRAME* frame = &current_ctx->frame;
+    ZBUF* zbuf = &current_ctx->zbuf;
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi32(-1);
+    const __m128i lane_bits = _mm_set_epi32(8, 4, 2, 1);
+
+    __m128i frame_lanes = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(coverage), lane_bits), lane_bits);
+    __m128i z_lanes = (test->depth_test && !zbuf->no_update) ? frame_lanes : zero;
+    __m128i alpha_locked = zero;
+
+    __m128i source = _mm_set_epi32(pack_RGBA(colors[3]), pack_RGBA(colors[2]),
+                                   pack_RGBA(colors[1]), pack_RGBA(colors[0]));
 
     if (test->alpha_test)
     {
-        bool fail = false;
+        __m128i source_alpha = _mm_srli_epi32(source, 24);
+        __m128i ref = _mm_set1_epi32(test->alpha_ref);
+        __m128i pass;
         switch (test->alpha_method)
         {
             case 0: //NEVER
-                fail = true;
+                pass = zero;
                 break;
             case 1: //ALWAYS
+                pass = ones;
                 break;
             case 2: //LESS
-                if (color.a >= test->alpha_ref)
-                    fail = true;
+                pass = _mm_cmplt_epi32(source_alpha, ref);
                 break;
             case 3: //LEQUAL
-                if (color.a > test->alpha_ref)
-                    fail = true;
+                pass = _mm_andnot_si128(_mm_cmpgt_epi32(source_alpha, ref), ones);
                 break;
             case 4: //EQUAL
-                if (color.a != test->alpha_ref)
-                    fail = true;
+                pass = _mm_cmpeq_epi32(source_alpha, ref);
                 break;
             case 5: //GEQUAL
-                if (color.a < test->alpha_ref)
-                    fail = true;
+                pass = _mm_andnot_si128(_mm_cmplt_epi32(source_alpha, ref), ones);
                 break;
             case 6: //GREATER
-                if (color.a <= test->alpha_ref)
-                    fail = true;
+                pass = _mm_cmpgt_epi32(source_alpha, ref);
                 break;
-            case 7: //NOTEQUAL
-                if (color.a == test->alpha_ref)
-                    fail = true;
+            default: //NOTEQUAL
+                pass = _mm_andnot_si128(_mm_cmpeq_epi32(source_alpha, ref), ones);
                 break;
         }
-        if (fail)
+        switch (test->alpha_fail_method)
         {
-            switch (test->alpha_fail_method)
-            {
-                case 0: //KEEP - Update nothing
-                    return;
-                case 1: //FB_ONLY - Only update framebuffer
-                    update_z = false;
-                    break;
-                case 2: //ZB_ONLY - Only update z-buffer
-                    update_frame = false;
-                    break;
-                case 3: //RGB_ONLY - Same as FB_ONLY, but ignore alpha
-                    update_z = false;
-                    update_alpha = false;
-                    break;
-            }
+            case 0: //KEEP - Update nothing
+                frame_lanes = _mm_and_si128(frame_lanes, pass);
+                z_lanes = _mm_and_si128(z_lanes, pass);
+                break;
+            case 1: //FB_ONLY - Only update framebuffer
+                z_lanes = _mm_and_si128(z_lanes, pass);
+                break;
+            case 2: //ZB_ONLY - Only update z-buffer
+                frame_lanes = _mm_and_si128(frame_lanes, pass);
+                break;
+            case 3: //RGB_ONLY - Same as FB_ONLY, but ignore alpha
+                z_lanes = _mm_and_si128(z_lanes, pass);
+                alpha_locked = _mm_andnot_si128(pass, ones);
+                break;
         }
     }
 
-    bool pass_depth_test = true;
+    bool z_32bit = zbuf->format == 0x00 || zbuf->format == 0x01;
+    uint32_t z_addr = addr_PSMCT32Z(zbuf->base_pointer / 256, frame->width / 64, x, y);
+    __m128i z_source = _mm_loadu_si128((__m128i*)z);
+    __m128i z_dest = zero;
+    bool z_dest_loaded = false;
     if (test->depth_test)
-        pass_depth_test = depth_test(x, y, z);
-    else
-        update_z = false;
+    {
+        switch (test->depth_method)
+        {
+            case 0: //FAIL
+                return;
+            case 1: //PASS
+                break;
+            case 2: //GEQUAL
+            case 3: //GREATER
+            {
+                //Errors::die throws, but the compiler can't tell that the default case never falls through
+                __m128i z_test = zero, z_buffer = zero;
+                switch (zbuf->format)
+                {
+                    case 0x00:
+                        z_dest = _mm_loadu_si128((__m128i*)&local_mem[z_addr]);
+                        z_dest_loaded = true;
+                        z_test = z_source;
+                        z_buffer = z_dest;
+                        break;
+                    case 0x01:
+                    {
+                        const __m128i max_z = _mm_set1_epi32(0xFFFFFF);
+                        z_dest = _mm_loadu_si128((__m128i*)&local_mem[z_addr]);
+                        z_dest_loaded = true;
+                        __m128i over = cmpgt_epu32(z_source, max_z);
+                        z_test = _mm_or_si128(_mm_andnot_si128(over, z_source), _mm_and_si128(over, max_z));
+                        z_buffer = _mm_and_si128(z_dest, max_z);
+                    }
+                        break;
+                    case 0x02:
+                    case 0x0A:
+                    {
+                        uint32_t test_values[4], buffer_values[4];
+                        for (int i = 0; i < 4; i++)
+                        {
+                            int32_t lane_x = x + (i & 0x1);
+                            int32_t lane_y = y + (i >> 1);
+                            test_values[i] = min(z[i], 0xFFFFU);
+                            if (zbuf->format == 0x02)
+                                buffer_values[i] = read_PSMCT16Z_block(zbuf->base_pointer, frame->width, lane_x, lane_y);
+                            else
+                                buffer_values[i] = read_PSMCT16SZ_block(zbuf->base_pointer, frame->width, lane_x, lane_y);
+                        }
+                        z_test = _mm_loadu_si128((__m128i*)test_values);
+                        z_buffer = _mm_loadu_si128((__m128i*)buffer_values);
+                    }
+                        break;
+                    default:
+                        Errors::die("[GS_t] Unrecognized zbuf format $%02X\n", zbuf->format);
+                }
+                __m128i pass;
+                if (test->depth_method == 2)
+                    pass = _mm_andnot_si128(cmpgt_epu32(z_buffer, z_test), ones);
+                else
+                    pass = cmpgt_epu32(z_test, z_buffer);
+                frame_lanes = _mm_and_si128(frame_lanes, pass);
+                z_lanes = _mm_and_si128(z_lanes, pass);
+            }
+                break;
+        }
+    }
 
-    if (!pass_depth_test)
+    if (!_mm_movemask_epi8(_mm_or_si128(frame_lanes, z_lanes)))
         return;
 
-    uint32_t frame_color = read_PSMCT32_block(current_ctx->frame.base_pointer, current_ctx->frame.width, x, y);
-    uint32_t final_color = 0;
-
-    if (test->dest_alpha_test)
+    bool frame_16bit = frame->format == 0x02 || frame->format == 0x0A;
+    uint32_t frame_addr = 0;
+    __m128i dest;
+    if (frame_16bit)
     {
-        if (test->dest_alpha_method && !(frame_color & (1 << 31)))
-            return;
-        else if (!test->dest_alpha_method && (frame_color & (1 << 31)))
-            return;
+        uint32_t values[4];
+        for (int i = 0; i < 4; i++)
+        {
+            int32_t lane_x = x + (i & 0x1);
+            int32_t lane_y = y + (i >> 1);
+            uint16_t color;
+            if (frame->format == 0x02)
+                color = read_PSMCT16_block(frame->base_pointer, frame->width, lane_x, lane_y);
+            else
+                color = read_PSMCT16S_block(frame->base_pointer, frame->width, lane_x, lane_y);
+            values[i] = expand_PSMCT16(color);
+        }
+        dest = _mm_loadu_si128((__m128i*)values);
     }
-
-    if (alpha_blending)
+    else
     {
-        uint32_t r1, g1, b1;
-        uint32_t r2, g2, b2;
-        uint32_t cr, cg, cb;
-        uint32_t alpha;
+        frame_addr = addr_PSMCT32(frame->base_pointer / 256, frame->width / 64, x, y);
+        dest = _mm_loadu_si128((__m128i*)&local_mem[frame_addr]);
+    }
 
-        switch (current_ctx->alpha.spec_A)
+    if (test->dest_alpha_test)
+    {
+        __m128i alpha_set = _mm_srai_epi32(dest, 31);
+        if (test->dest_alpha_method)
         {
-            case 0:
-                r1 = color.r;
-                g1 = color.g;
-                b1 = color.b;
-                break;
-            case 1:
-                r1 = frame_color & 0xFF;
-                g1 = (frame_color >> 8) & 0xFF;
-                b1 = (frame_color >> 16) & 0xFF;
-                break;
-            case 2:
-            case 3:
-                r1 = 0;
-                g1 = 0;
-                b1 = 0;
-                break;
+            frame_lanes = _mm_and_si128(frame_lanes, alpha_set);
+            z_lanes = _mm_and_si128(z_lanes, alpha_set);
         }
-
-        switch (current_ctx->alpha.spec_B)
+        else
         {
-            case 0:
-                r2 = color.r;
-                g2 = color.g;
-                b2 = color.b;
-                break;
-            case 1:
-                r2 = frame_color & 0xFF;
-                g2 = (frame_color >> 8) & 0xFF;
-                b2 = (frame_color >> 16) & 0xFF;
-                break;
-            case 2:
-            case 3:
-                r2 = 0;
-                g2 = 0;
-                b2 = 0;
-                break;
+            frame_lanes = _mm_andnot_si128(alpha_set, frame_lanes);
+            z_lanes = _mm_andnot_si128(alpha_set, z_lanes);
         }
+    }
 
+    bool dither = DTHE && frame_16bit;
+    __m128i final_color = source;
+    if (alpha_blending || dither)
+    {
+        const __m128i mask_FF = _mm_set1_epi32(0xFF);
+
+        //PSMCT24 has no alpha channel in memory; the GS treats destination alpha as 0x80
+        __m128i blend_dest = dest;
+        if (frame->format == 0x01)
+            blend_dest = _mm_or_si128(_mm_and_si128(dest, _mm_set1_epi32(0x00FFFFFF)), _mm_set1_epi32(0x80000000));
+
+        __m128i alpha;
         switch (current_ctx->alpha.spec_C)
         {
             case 0:
-                alpha = color.a;
+                alpha = _mm_srli_epi32(source, 24);
                 break;
             case 1:
-                alpha = frame_color >> 24;
+                alpha = _mm_srli_epi32(blend_dest, 24);
                 break;
-            case 2:
-            case 3:
-                alpha = current_ctx->alpha.fixed_alpha;
+            default:
+                alpha = _mm_set1_epi32(current_ctx->alpha.fixed_alpha);
                 break;
         }
 
-        switch (current_ctx->alpha.spec_D)
+        __m128i dither_offset = zero;
+        if (dither)
         {
-            case 0:
-                cr = color.r;
-                cg = color.g;
-                cb = color.b;
-                break;
-            case 1:
-                cr = frame_color & 0xFF;
-                cg = (frame_color >> 8) & 0xFF;
-                cb = (frame_color >> 16) & 0xFF;
-                break;
-            case 2:
-            case 3:
-                cr = 0;
-                cg = 0;
-                cb = 0;
-                break;
+            dither_offset = _mm_set_epi32(DIMX[(y + 1) & 0x3][(x + 1) & 0x3], DIMX[(y + 1) & 0x3][x & 0x3],
+                                          DIMX[y & 0x3][(x + 1) & 0x3], DIMX[y & 0x3][x & 0x3]);
         }
 
-        int fb = (int)b1 - (int)b2;
-        int fg = (int)g1 - (int)g2;
-        int fr = (int)r1 - (int)r2;
+        __m128i channels[3];
+        for (int i = 0; i < 3; i++)
+        {
+            __m128i cs = _mm_and_si128(_mm_srli_epi32(source, i * 8), mask_FF);
+            __m128i cd = _mm_and_si128(_mm_srli_epi32(blend_dest, i * 8), mask_FF);
+            __m128i c = cs;
+            if (alpha_blending)
+            {
+                //((A - B) * C >> 7) + D
+                //A - B fits in the low 16 bits and the high half of alpha is zero, so madd is a signed 16x16 multiply
+                __m128i diff = _mm_sub_epi32(blend_input(current_ctx->alpha.spec_A, cs, cd),
+                                             blend_input(current_ctx->alpha.spec_B, cs, cd));
+                c = _mm_srai_epi32(_mm_madd_epi16(diff, alpha), 7);
+                c = _mm_add_epi32(c, blend_input(current_ctx->alpha.spec_D, cs, cd));
+            }
+            c = _mm_add_epi32(c, dither_offset);
+            if (!COLCLAMP)
+                c = _mm_and_si128(c, mask_FF);
+            channels[i] = c;
+        }
 
-        fb = (((fb * (int)alpha) >> 7) + cb);
-        fg = (((fg * (int)alpha) >> 7) + cg);
-        fr = (((fr * (int)alpha) >> 7) + cr);
+        //Saturating packs perform COLCLAMP, then transpose the planar channels back into RGBA pixels
+        __m128i rb = _mm_packs_epi32(channels[0], channels[2]);
+        __m128i ga = _mm_packs_epi32(channels[1], _mm_srli_epi32(source, 24));
+        __m128i planar = _mm_packus_epi16(rb, ga);
+        __m128i interleaved = _mm_unpacklo_epi8(planar, _mm_srli_si128(planar, 8));
+        final_color = _mm_unpacklo_epi16(interleaved, _mm_srli_si128(interleaved, 8));
+    }
 
-        if (COLCLAMP)
+    //Bits set in keep_mask retain their value from the framebuffer
+    uint32_t fb_mask = frame->mask;
+    if (frame->format == 0x01)
+        fb_mask |= 0xFF000000;
+    __m128i keep_mask = _mm_set1_epi32(fb_mask);
+    keep_mask = _mm_or_si128(keep_mask, _mm_and_si128(alpha_locked, _mm_set1_epi32(0xFF000000)));
+    keep_mask = _mm_or_si128(keep_mask, _mm_andnot_si128(frame_lanes, ones));
+    final_color = _mm_or_si128(_mm_andnot_si128(keep_mask, final_color), _mm_and_si128(keep_mask, dest));
+
+    int frame_write_mask = _mm_movemask_ps(_mm_castsi128_ps(frame_lanes));
+    if (frame_write_mask)
+    {
+        if (frame_16bit)
         {
-            if (fb < 0)
-                fb = 0;
-            if (fg < 0)
-                fg = 0;
-            if (fr < 0)
-                fr = 0;
-            if (fb > 0xFF)
-                fb = 0xFF;
-            if (fg > 0xFF)
-                fg = 0xFF;
-            if (fr > 0xFF)
-                fr = 0xFF;
+            uint32_t values[4];
+            _mm_storeu_si128((__m128i*)values, final_color);
+            for (int i = 0; i < 4; i++)
+            {
+                if (!(frame_write_mask & (1 << i)))
+                    continue;
+                int32_t lane_x = x + (i & 0x1);
+                int32_t lane_y = y + (i >> 1);
+                if (frame->format == 0x02)
+                    write_PSMCT16_block(frame->base_pointer, frame->width, lane_x, lane_y, compress_PSMCT16(values[i]));
+                else
+                    write_PSMCT16S_block(frame->base_pointer, frame->width, lane_x, lane_y, compress_PSMCT16(values[i]));
+            }
         }
         else
         {
-            fb &= 0xFF;
-            fg &= 0xFF;
-            fr &= 0xFF;
+            _mm_storeu_si128((__m128i*)&local_mem[frame_addr], final_color);
+            stamp_page(frame_addr);
         }
-
-        final_color |= alpha << 24;
-        final_color |= fb << 16;
-        final_color |= fg << 8;
-        final_color |= fr;
-    }
-    else
-    {
-        final_color |= color.a << 24;
-        final_color |= color.b << 16;
-        final_color |= color.g << 8;
-        final_color |= color.r;
     }
 
-    if (!update_frame)
-        final_color = frame_color;
-    uint8_t alpha = frame_color >> 24;
-    if (update_alpha && current_ctx->frame.format != 1)
-        alpha = final_color >> 24;
-    final_color &= 0x00FFFFFF;
-    final_color |= alpha << 24;
-
-    //printf("[GS_t] Write $%08X (%d, %d)\n", final_color, x, y);
-    write_PSMCT32_block(current_ctx->frame.base_pointer, current_ctx->frame.width, x, y, final_color);
-    if (update_z)
+    int z_write_mask = _mm_movemask_ps(_mm_castsi128_ps(z_lanes));
+    if (z_write_mask)
     {
-        switch (current_ctx->zbuf.format)
+        if (z_32bit)
         {
-            case 0x00:
-                write_PSMCT32Z_block(current_ctx->zbuf.base_pointer, current_ctx->frame.width, x, y, z);
-                break;
-            case 0x01:
-                write_PSMCT24Z_block(current_ctx->zbuf.base_pointer, current_ctx->frame.width, x, y, z & 0xFFFFFF);
-                break;
-            case 0x02:
-                write_PSMCT16Z_block(current_ctx->zbuf.base_pointer, current_ctx->frame.width, x, y, z & 0xFFFF);
-                break;
-            case 0x0A:
-                write_PSMCT16SZ_block(current_ctx->zbuf.base_pointer, current_ctx->frame.width, x, y, z & 0xFFFF);
-                break;
+            if (!z_dest_loaded)
+                z_dest = _mm_loadu_si128((__m128i*)&local_mem[z_addr]);
+            __m128i new_z = z_source;
+            if (zbuf->format == 0x01)
+            {
+                const __m128i mask_24 = _mm_set1_epi32(0xFFFFFF);
+                new_z = _mm_or_si128(_mm_and_si128(z_source, mask_24), _mm_andnot_si128(mask_24, z_dest));
+            }
+            new_z = _mm_or_si128(_mm_and_si128(z_lanes, new_z), _mm_andnot_si128(z_lanes, z_dest));
+            _mm_storeu_si128((__m128i*)&local_mem[z_addr], new_z);
+
+            //Lower the block's minimum Z instead of letting the write invalidate it
+            DepthBlock summary = depth_blocks[(z_addr >> 8) & 0x3FFF];
+            stamp_page(z_addr);
+            if (summary.valid && summary.format == zbuf->format)
+            {
+                uint32_t values[4];
+                _mm_storeu_si128((__m128i*)values, new_z);
+                for (int i = 0; i < 4; i++)
+                {
+                    uint32_t value = (zbuf->format == 0x01) ? values[i] & 0xFFFFFF : values[i];
+                    summary.min_z = min(summary.min_z, value);
+                }
+                depth_blocks[(z_addr >> 8) & 0x3FFF] = summary;
+            }
+        }
+        else
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                if (!(z_write_mask & (1 << i)))
+                    continue;
+                int32_t lane_x = x + (i & 0x1);
+                int32_t lane_y = y + (i >> 1);
+                if (zbuf->format == 0x02)
+                    write_PSMCT16Z_block(zbuf->base_pointer, frame->width, lane_x, lane_y, z[i] & 0xFFFF);
+                else if (zbuf->format == 0x0A)
+                    write_PSMCT16SZ_block(zbuf->base_pointer, frame->width, lane_x, lane_y, z[i] & 0xFFFF);
+            }
         }
     }
 }
 
+/**
+  * Coarse depth test. Every 256-byte block of local memory can carry the smallest of the 32-bit or 24-bit Z values
+  * stored in it. It is computed the first time a block is tested, lowered by draw_quad's Z writes and
+  * dropped by any other write to the block through stamp_page.
+  * Returns true if a quad whose largest Z value is max_z at pixel (x, y) fails the depth test for every pixel.
+  **/
+bool GraphicsSynthesizerThread::depth_block_rejects(int32_t x, int32_t y, uint32_t max_z)
+{
+    TEST* test = &current_ctx->test;
+    ZBUF* zbuf = &current_ctx->zbuf;
+    if (!test->depth_test || (test->depth_method != 2 && test->depth_method != 3))
+        return false;
+    if (zbuf->format != 0x00 && zbuf->format != 0x01)
+        return false;
+
+    uint32_t z_addr = addr_PSMCT32Z(zbuf->base_pointer / 256, current_ctx->frame.width / 64, x, y);
+    DepthBlock& summary = depth_blocks[(z_addr >> 8) & 0x3FFF];
+    if (!summary.valid || summary.format != zbuf->format)
+    {
+        const uint32_t* block = (const uint32_t*)&local_mem[z_addr & ~0xFF];
+        uint32_t mask = (zbuf->format == 0x01) ? 0xFFFFFF : 0xFFFFFFFF;
+        summary.min_z = 0xFFFFFFFF;
+        for (int i = 0; i < 64; i++)
+            summary.min_z = min(summary.min_z, block[i] & mask);
+        summary.format = zbuf->format;
+        summary.valid = true;
+    }
+
+    if (zbuf->format == 0x01)
+        max_z = min(max_z, 0xFFFFFFU);
+    if (test->depth_method == 2)
+        return max_z < summary.min_z;
+    return max_z <= summary.min_z;
+}
+
 void GraphicsSynthesizerThread::render_point()
 {
     Vertex v1 = vtx_queue[0]; v1.to_relative(current_ctx->xyoffset);
@@ -1323,8 +1748,12 @@ void GraphicsSynthesizerThread::render_triangle()
     max_x = min(max_x, (int32_t)current_ctx->scissor.x2);
     max_y = min(max_y, (int32_t)current_ctx->scissor.y2);
 
-    //We'll process the pixels in blocks, set the blocksize
-    const int32_t BLOCKSIZE = 1 << 4; // Must be power of 2
+    //We'll process the pixels in blocks of 2x2 pixel quads, set the blocksize
+    const int32_t BLOCKSIZE = 1 << 5; // Must be power of 2
+
+    //Pixels outside of the scissored bounding box are masked out of each quad
+    int32_t clip_min_x = min_x & ~0xF;
+    int32_t clip_min_y = min_y & ~0xF;
 
     //Round down to make starting corner's coordinates a multiple of BLOCKSIZE with bitwise magic
     min_x &= ~(BLOCKSIZE - 1);
@@ -1366,6 +1795,46 @@ void GraphicsSynthesizerThread::render_triangle()
 
     RGBAQ_REG vtx_color, tex_color;
 
+    /**
+      * S, T and Q are affine in screen space. Their values at the starting corner and their per-pixel steps are
+      * computed once, so that only the perspective divide is left per pixel, done for a whole quad with one
+      * reciprocal. The barycentric scale cancels out in S/Q and T/Q, so the weights aren't normalized.
+      **/
+    bool use_STQ = PRIM.texture_mapping && !PRIM.use_UV;
+    __m128 s_quad = _mm_setzero_ps(), t_quad = _mm_setzero_ps(), q_quad = _mm_setzero_ps();
+    __m128 s_dx = _mm_setzero_ps(), t_dx = _mm_setzero_ps(), q_dx = _mm_setzero_ps();
+    __m128 s_dy = _mm_setzero_ps(), t_dy = _mm_setzero_ps(), q_dy = _mm_setzero_ps();
+    __m128 tex_scale_u = _mm_set1_ps(current_ctx->tex0.tex_width);
+    __m128 tex_scale_v = _mm_set1_ps(current_ctx->tex0.tex_height);
+    if (use_STQ)
+    {
+        const __m128 lane_x = _mm_set_ps(1.0f, 0.0f, 1.0f, 0.0f);
+        const __m128 lane_y = _mm_set_ps(1.0f, 1.0f, 0.0f, 0.0f);
+        float s_step_x = (v1.s * A23 + v2.s * A31 + v3.s * A12) * 16.0f;
+        float t_step_x = (v1.t * A23 + v2.t * A31 + v3.t * A12) * 16.0f;
+        float q_step_x = (v1.rgbaq.q * A23 + v2.rgbaq.q * A31 + v3.rgbaq.q * A12) * 16.0f;
+        float s_step_y = (v1.s * B23 + v2.s * B31 + v3.s * B12) * 16.0f;
+        float t_step_y = (v1.t * B23 + v2.t * B31 + v3.t * B12) * 16.0f;
+        float q_step_y = (v1.rgbaq.q * B23 + v2.rgbaq.q * B31 + v3.rgbaq.q * B12) * 16.0f;
+
+        //Lanes of the quad at the starting corner
+        s_quad = _mm_set1_ps(v1.s * w1_row + v2.s * w2_row + v3.s * w3_row);
+        t_quad = _mm_set1_ps(v1.t * w1_row + v2.t * w2_row + v3.t * w3_row);
+        q_quad = _mm_set1_ps(v1.rgbaq.q * w1_row + v2.rgbaq.q * w2_row + v3.rgbaq.q * w3_row);
+        s_quad = _mm_add_ps(s_quad, _mm_add_ps(_mm_mul_ps(lane_x, _mm_set1_ps(s_step_x)),
+                                               _mm_mul_ps(lane_y, _mm_set1_ps(s_step_y))));
+        t_quad = _mm_add_ps(t_quad, _mm_add_ps(_mm_mul_ps(lane_x, _mm_set1_ps(t_step_x)),
+                                               _mm_mul_ps(lane_y, _mm_set1_ps(t_step_y))));
+        q_quad = _mm_add_ps(q_quad, _mm_add_ps(_mm_mul_ps(lane_x, _mm_set1_ps(q_step_x)),
+                                               _mm_mul_ps(lane_y, _mm_set1_ps(q_step_y))));
+        s_dx = _mm_set1_ps(s_step_x);
+        t_dx = _mm_set1_ps(t_step_x);
+        q_dx = _mm_set1_ps(q_step_x);
+        s_dy = _mm_set1_ps(s_step_y);
+        t_dy = _mm_set1_ps(t_step_y);
+        q_dy = _mm_set1_ps(q_step_y);
+    }
+
     //TODO: Parallelize this
     //Iterate through the bounding rectangle using BLOCKSIZE * BLOCKSIZE large blocks
     //This way we can throw out blocks which are totally outside the triangle way faster
@@ -1419,87 +1888,121 @@ void GraphicsSynthesizerThread::render_triangle()
             //TODO: In the case where all corners lie inside the triangle the code below could be slightly simplified
             if (w1_mask != 0 && w2_mask != 0 && w3_mask != 0)
             {
-                //Process a BLOCKSIZE * BLOCKSIZE block as normal
-                int32_t w1_row = w1_block;
-                int32_t w2_row = w2_block;
-                int32_t w3_row = w3_block;
-                for (int32_t y = y_block; y < y_block + BLOCKSIZE; y += 0x10)
+                //Find the covered pixels of the quad and their depth first
+                uint8_t coverage = 0;
+                uint32_t quad_z[4];
+                int32_t quad_w[4][3];
+                uint32_t max_z = 0;
+                for (int lane = 0; lane < 4; lane++)
                 {
-                    int32_t w1 = w1_row;
-                    int32_t w2 = w2_row;
-                    int32_t w3 = w3_row;
-                    for (int32_t x = x_block; x < x_block + BLOCKSIZE; x += 0x10)
+                    int32_t x = x_block + ((lane & 0x1) << 4);
+                    int32_t y = y_block + ((lane >> 1) << 4);
+                    if (x < clip_min_x || x >= max_x || y < clip_min_y || y >= max_y)
+                        continue;
+
+                    int32_t w1 = w1_block;
+                    int32_t w2 = w2_block;
+                    int32_t w3 = w3_block;
+                    if (lane & 0x1)
                     {
-                        //Is inside triangle?
-                        if ((w1 | w2 | w3) >= 0)
-                        {
-                            //Interpolate Z
-                            float z = (float) v1.z * w1 + (float) v2.z * w2 + (float) v3.z * w3;
-                            z /= divider;
-
-                            //Gourand shading calculations
-                            float r = (float) v1.rgbaq.r * w1 + (float) v2.rgbaq.r * w2 + (float) v3.rgbaq.r * w3;
-                            float g = (float) v1.rgbaq.g * w1 + (float) v2.rgbaq.g * w2 + (float) v3.rgbaq.g * w3;
-                            float b = (float) v1.rgbaq.b * w1 + (float) v2.rgbaq.b * w2 + (float) v3.rgbaq.b * w3;
-                            float a = (float) v1.rgbaq.a * w1 + (float) v2.rgbaq.a * w2 + (float) v3.rgbaq.a * w3;
-                            vtx_color.r = r / divider;
-                            vtx_color.g = g / divider;
-                            vtx_color.b = b / divider;
-                            vtx_color.a = a / divider;
-
-                            if (PRIM.texture_mapping)
-                            {
-                                uint32_t u, v;
-                                if (!PRIM.use_UV)
-                                {
-                                    float s, t, q;
-                                    s = v1.s * w1 + v2.s * w2 + v3.s * w3;
-                                    t = v1.t * w1 + v2.t * w2 + v3.t * w3;
-                                    q = v1.rgbaq.q * w1 + v2.rgbaq.q * w2 + v3.rgbaq.q * w3;
-
-                                    //We don't divide s and t by "divider" because dividing by Q effectively
-                                    //cancels that out
-                                    s /= q;
-                                    t /= q;
-                                    u = s * current_ctx->tex0.tex_width;
-                                    v = t * current_ctx->tex0.tex_height;
-                                }
-                                else
-                                {
-                                    float temp_u = (float) v1.uv.u * w1 + (float) v2.uv.u * w2 + (float) v3.uv.u * w3;
-                                    float temp_v = (float) v1.uv.v * w1 + (float) v2.uv.v * w2 + (float) v3.uv.v * w3;
-                                    temp_u /= divider;
-                                    temp_v /= divider;
-                                    u = (uint32_t) temp_u >> 4;
-                                    v = (uint32_t) temp_v >> 4;
-                                }
-                                tex_lookup(u, v, vtx_color, tex_color);
-                                draw_pixel(x, y, (uint32_t) z, tex_color, PRIM.alpha_blend);
-                            }
-                            else
-                            {
-                                draw_pixel(x, y, (uint32_t) z, vtx_color, PRIM.alpha_blend);
-                            }
-                        }
                         //Horizontal step
                         w1 += A23 << 4;
                         w2 += A31 << 4;
                         w3 += A12 << 4;
                     }
-                    //Vertical step
-                    w1_row += B23 << 4;
-                    w2_row += B31 << 4;
-                    w3_row += B12 << 4;
-                }
-            }
+                    if (lane & 0x2)
+                    {
+                        //Vertical step
+                        w1 += B23 << 4;
+                        w2 += B31 << 4;
+                        w3 += B12 << 4;
+                    }
 
-            w1_block += BLOCKSIZE * A23;
-            w2_block += BLOCKSIZE * A31;
-            w3_block += BLOCKSIZE * A12;
+                    //Is inside triangle?
+                    if ((w1 | w2 | w3) < 0)
+                        continue;
 
-        }
-        w1_row_block += BLOCKSIZE * B23;
-        w2_row_block += BLOCKSIZE * B31;
+                    //Interpolate Z
+                    float z = (float) v1.z * w1 + (float) v2.z * w2 + (float) v3.z * w3;
+                    z /= divider;
+                    quad_z[lane] = (uint32_t) z;
+                    max_z = max(max_z, quad_z[lane]);
+
+                    quad_w[lane][0] = w1;
+                    quad_w[lane][1] = w2;
+                    quad_w[lane][2] = w3;
+                    coverage |= 1 << lane;
+                }
+
+                //Skip shading quads that are entirely behind what is already in the Z buffer
+                if (coverage && !depth_block_rejects(x_block >> 4, y_block >> 4, max_z))
+                {
+                    RGBAQ_REG quad_color[4];
+                    float quad_u[4], quad_v[4];
+                    if (use_STQ)
+                    {
+                        __m128 quad_x = _mm_set1_ps((x_block - min_x) >> 4);
+                        __m128 quad_y = _mm_set1_ps((y_block - min_y) >> 4);
+                        __m128 s = _mm_add_ps(s_quad, _mm_add_ps(_mm_mul_ps(quad_x, s_dx), _mm_mul_ps(quad_y, s_dy)));
+                        __m128 t = _mm_add_ps(t_quad, _mm_add_ps(_mm_mul_ps(quad_x, t_dx), _mm_mul_ps(quad_y, t_dy)));
+                        __m128 q = _mm_add_ps(q_quad, _mm_add_ps(_mm_mul_ps(quad_x, q_dx), _mm_mul_ps(quad_y, q_dy)));
+                        __m128 inv_q = _mm_div_ps(_mm_set1_ps(1.0f), q);
+                        _mm_storeu_ps(quad_u, _mm_mul_ps(_mm_mul_ps(s, inv_q), tex_scale_u));
+                        _mm_storeu_ps(quad_v, _mm_mul_ps(_mm_mul_ps(t, inv_q), tex_scale_v));
+                    }
+
+                    for (int lane = 0; lane < 4; lane++)
+                    {
+                        if (!(coverage & (1 << lane)))
+                            continue;
+                        int32_t w1 = quad_w[lane][0];
+                        int32_t w2 = quad_w[lane][1];
+                        int32_t w3 = quad_w[lane][2];
+
+                        //Gourand shading calculations
+                        float r = (float) v1.rgbaq.r * w1 + (float) v2.rgbaq.r * w2 + (float) v3.rgbaq.r * w3;
+                        float g = (float) v1.rgbaq.g * w1 + (float) v2.rgbaq.g * w2 + (float) v3.rgbaq.g * w3;
+                        float b = (float) v1.rgbaq.b * w1 + (float) v2.rgbaq.b * w2 + (float) v3.rgbaq.b * w3;
+                        float a = (float) v1.rgbaq.a * w1 + (float) v2.rgbaq.a * w2 + (float) v3.rgbaq.a * w3;
+                        vtx_color.r = r / divider;
+                        vtx_color.g = g / divider;
+                        vtx_color.b = b / divider;
+                        vtx_color.a = a / divider;
+
+                        if (PRIM.texture_mapping)
+                        {
+                            uint32_t u, v;
+                            if (use_STQ)
+                            {
+                                u = quad_u[lane];
+                                v = quad_v[lane];
+                            }
+                            else
+                            {
+                                float temp_u = (float) v1.uv.u * w1 + (float) v2.uv.u * w2 + (float) v3.uv.u * w3;
+                                float temp_v = (float) v1.uv.v * w1 + (float) v2.uv.v * w2 + (float) v3.uv.v * w3;
+                                temp_u /= divider;
+                                temp_v /= divider;
+                                u = (uint32_t) temp_u >> 4;
+                                v = (uint32_t) temp_v >> 4;
+                            }
+                            tex_lookup(u, v, vtx_color, tex_color);
+                            quad_color[lane] = tex_color;
+                        }
+                        else
+                            quad_color[lane] = vtx_color;
+                    }
+                    draw_quad(x_block >> 4, y_block >> 4, coverage, quad_z, quad_color, PRIM.alpha_blend);
+                }
+            }
+
+            w1_block += BLOCKSIZE * A23;
+            w2_block += BLOCKSIZE * A31;
+            w3_block += BLOCKSIZE * A12;
+
+        }
+        w1_row_block += BLOCKSIZE * B23;
+        w2_row_block += BLOCKSIZE * B31;
         w3_row_block += BLOCKSIZE * B12;
     }
 
@@ -1527,27 +2030,265 @@ void GraphicsSynthesizerThread::render_sprite()
 
     printf("Coords: (%d, %d) (%d, %d)\n", v1.x >> 4, v1.y >> 4, v2.x >> 4, v2.y >> 4);
 
-    for (int32_t y = min_y; y < max_y; y += 0x10)
+    if (min_x >= max_x || min_y >= max_y)
+        return;
+
+    //Sample positions start at (min_x, min_y) and step by one pixel
+    int32_t first_px = min_x >> 4, first_py = min_y >> 4;
+    int32_t end_px = first_px + ((max_x - min_x + 0xF) >> 4);
+    int32_t end_py = first_py + ((max_y - min_y + 0xF) >> 4);
+    uint32_t sprite_width = end_px - first_px;
+    uint32_t sprite_height = end_py - first_py;
+
+    //Texture coordinates of a sprite only depend on the column or the row
+    if (PRIM.texture_mapping)
+    {
+        sprite_u.resize(sprite_width);
+        sprite_v.resize(sprite_height);
+        //S and T are linear across a sprite, so they only need one division each for their slopes
+        float s_step = (v2.s - v1.s) / (v2.x - v1.x);
+        float t_step = (v2.t - v1.t) / (v2.y - v1.y);
+        for (uint32_t i = 0; i < sprite_width; i++)
+        {
+            int32_t x = min_x + (i << 4);
+            if (!PRIM.use_UV)
+                sprite_u[i] = (v1.s + (x - v1.x) * s_step) * current_ctx->tex0.tex_width;
+            else
+                sprite_u[i] = interpolate(x, v1.uv.u, v1.x, v2.uv.u, v2.x) >> 4;
+        }
+        for (uint32_t i = 0; i < sprite_height; i++)
+        {
+            int32_t y = min_y + (i << 4);
+            if (!PRIM.use_UV)
+                sprite_v[i] = (v1.t + (y - v1.y) * t_step) * current_ctx->tex0.tex_height;
+            else
+                sprite_v[i] = interpolate(y, v1.uv.v, v1.y, v2.uv.v, v2.y) >> 4;
+        }
+    }
+
+    if (draw_sprite_direct(first_px, first_py, sprite_width, sprite_height, v2.z, vtx_color))
+        return;
+
+    //Everything else goes through the pixel pipeline in aligned 2x2 pixel quads
+    for (int32_t quad_y = first_py & ~0x1; quad_y < end_py; quad_y += 2)
     {
-        float pix_t = interpolate_f(y, v1.t, v1.y, v2.t, v2.y);
-        uint16_t pix_v = interpolate(y, v1.uv.v, v1.y, v2.uv.v, v2.y) >> 4;
-        for (int32_t x = min_x; x < max_x; x += 0x10)
+        for (int32_t quad_x = first_px & ~0x1; quad_x < end_px; quad_x += 2)
         {
-            float pix_s = interpolate_f(x, v1.s, v1.x, v2.s, v2.x);
-            uint16_t pix_u = interpolate(x, v1.uv.u, v1.x, v2.uv.u, v2.x) >> 4;
-            if (PRIM.texture_mapping)
+            if (depth_block_rejects(quad_x, quad_y, v2.z))
+                continue;
+
+            uint8_t coverage = 0;
+            uint32_t quad_z[4];
+            RGBAQ_REG quad_color[4];
+            for (int lane = 0; lane < 4; lane++)
             {
-                if (!PRIM.use_UV)
+                int32_t px = quad_x + (lane & 0x1);
+                int32_t py = quad_y + (lane >> 1);
+                if (px < first_px || px >= end_px || py < first_py || py >= end_py)
+                    continue;
+
+                if (PRIM.texture_mapping)
                 {
-                    pix_v = pix_t * current_ctx->tex0.tex_height;
-                    pix_u = pix_s * current_ctx->tex0.tex_width;
+                    tex_lookup(sprite_u[px - first_px], sprite_v[py - first_py], vtx_color, tex_color);
+                    quad_color[lane] = tex_color;
                 }
-                tex_lookup(pix_u, pix_v, vtx_color, tex_color);
-                draw_pixel(x, y, v2.z, tex_color, PRIM.alpha_blend);
+                else
+                    quad_color[lane] = vtx_color;
+                quad_z[lane] = v2.z;
+                coverage |= 1 << lane;
             }
-            else
+            if (coverage)
+                draw_quad(quad_x, quad_y, coverage, quad_z, quad_color, PRIM.alpha_blend);
+        }
+    }
+}
+
+/**
+  * Sprites that pass every test unconditionally and do not blend write their colors and Z straight into memory.
+  * Most of these are clears and 2D blits, so whole blocks are filled or swizzled at once instead of going through
+  * draw_quad. Returns false if the sprite needs the full pixel pipeline.
+  **/
+bool GraphicsSynthesizerThread::draw_sprite_direct(int32_t x, int32_t y, uint32_t width, uint32_t height,
+                                                   uint32_t z, const RGBAQ_REG& vtx_color)
+{
+    TEST* test = &current_ctx->test;
+    FRAME* frame = &current_ctx->frame;
+    ZBUF* zbuf = &current_ctx->zbuf;
+    bool frame_16bit = frame->format == 0x02 || frame->format == 0x0A;
+    bool z_write = test->depth_test && !zbuf->no_update;
+
+    if (PRIM.alpha_blend || (DTHE && frame_16bit) || test->dest_alpha_test)
+        return false;
+    if (test->alpha_test && test->alpha_method != 1)
+        return false;
+    if (test->depth_test && test->depth_method != 1)
+        return false;
+    //16-bit pixels are masked after expansion to 32 bits
+    if (frame_16bit && frame->mask)
+        return false;
+    //draw_quad interleaves frame and Z writes, which only matters when the buffers alias
+    if (z_write && zbuf->base_pointer == frame->base_pointer)
+        return false;
+
+    uint8_t frame_format = frame_16bit ? frame->format : 0x00;
+    uint32_t frame_keep = frame->mask;
+    if (frame->format == 0x01)
+        frame_keep |= 0xFF000000;
+
+    if (!PRIM.texture_mapping)
+    {
+        uint32_t color = pack_RGBA(vtx_color);
+        if (frame_16bit)
+            color = compress_PSMCT16(color);
+        write_sprite_rect(frame_format, frame->base_pointer, frame->width, x, y, width, height, &color, 0, frame_keep);
+    }
+    else
+    {
+        uint32_t tex_width = current_ctx->tex0.tex_width;
+        bool modulate = current_ctx->tex0.color_function == 0;
+        for (uint32_t i = 0; i < width; i++)
+            sprite_u[i] = clamp_u(sprite_u[i]);
+        for (uint32_t i = 0; i < height; i++)
+            sprite_v[i] = clamp_v(sprite_v[i]);
+
+        //A 1:1 mapping that does not wrap can be swizzled straight out of the decoded texture
+        bool linear = !modulate && !frame_16bit;
+        for (uint32_t i = 1; linear && i < width; i++)
+            linear = sprite_u[i] == sprite_u[0] + i;
+        for (uint32_t i = 1; linear && i < height; i++)
+            linear = sprite_v[i] == sprite_v[0] + i;
+
+        if (linear)
+        {
+            const uint32_t* texels = &current_texture[sprite_u[0] + sprite_v[0] * tex_width];
+            write_sprite_rect(frame_format, frame->base_pointer, frame->width, x, y, width, height,
+                              texels, tex_width, frame_keep);
+        }
+        else
+        {
+            sprite_buffer.resize(width * height);
+            uint32_t* dest = sprite_buffer.data();
+            for (uint32_t j = 0; j < height; j++)
             {
-                draw_pixel(x, y, v2.z, vtx_color, PRIM.alpha_blend);
+                const uint32_t* row = &current_texture[sprite_v[j] * tex_width];
+                for (uint32_t i = 0; i < width; i++)
+                {
+                    uint32_t color = row[sprite_u[i]];
+                    if (modulate)
+                        color = modulate_texel(color, vtx_color);
+                    if (frame_16bit)
+                        color = compress_PSMCT16(color);
+                    *dest++ = color;
+                }
+            }
+            write_sprite_rect(frame_format, frame->base_pointer, frame->width, x, y, width, height,
+                              sprite_buffer.data(), width, frame_keep);
+        }
+    }
+
+    if (z_write)
+    {
+        switch (zbuf->format)
+        {
+            case 0x00:
+                write_sprite_rect(0x30, zbuf->base_pointer, frame->width, x, y, width, height, &z, 0, 0);
+                break;
+            case 0x01:
+            {
+                uint32_t z24 = z & 0xFFFFFF;
+                write_sprite_rect(0x30, zbuf->base_pointer, frame->width, x, y, width, height, &z24, 0, 0xFF000000);
+            }
+                break;
+            case 0x02:
+            case 0x0A:
+            {
+                uint32_t z16 = z & 0xFFFF;
+                write_sprite_rect(zbuf->format | 0x30, zbuf->base_pointer, frame->width, x, y, width, height,
+                                  &z16, 0, 0);
+            }
+                break;
+        }
+    }
+    return true;
+}
+
+/**
+  * Writes a rectangle of 32-bit or 16-bit values, one per word of values. A pitch of 0 fills the rectangle with
+  * values[0]. Bits set in keep_mask retain their value in memory; it must be 0 for 16-bit formats.
+  * Fully covered blocks are filled or swizzled whole, the edges are written a pixel at a time.
+  **/
+void GraphicsSynthesizerThread::write_sprite_rect(uint8_t format, uint32_t base, uint32_t width, uint32_t x,
+                                                  uint32_t y, uint32_t rect_width, uint32_t rect_height,
+                                                  const uint32_t* values, uint32_t pitch, uint32_t keep_mask)
+{
+    if (keep_mask == 0xFFFFFFFF)
+        return;
+
+    bool is_16bit = (format & 0xF) == 0x02 || (format & 0xF) == 0x0A;
+    uint32_t block_width = is_16bit ? 16 : 8;
+    uint32_t end_x = x + rect_width, end_y = y + rect_height;
+
+    for (uint32_t by = y & ~0x7; by < end_y; by += 8)
+    {
+        for (uint32_t bx = x & ~(block_width - 1); bx < end_x; bx += block_width)
+        {
+            if (bx >= x && by >= y && bx + block_width <= end_x && by + 8 <= end_y)
+            {
+                uint32_t addr = pixel_addr(format, base, width, bx, by);
+                uint8_t* block = &local_mem[addr];
+                const uint32_t* source = &values[(by - y) * pitch + (bx - x)];
+                stamp_page(addr);
+                if (is_16bit)
+                {
+                    if (!pitch)
+                        std::fill_n((uint16_t*)block, 128, (uint16_t)values[0]);
+                    else
+                    {
+                        uint16_t linear[128];
+                        for (uint32_t j = 0; j < 8; j++)
+                        {
+                            for (uint32_t i = 0; i < 16; i++)
+                                linear[j * 16 + i] = source[j * pitch + i];
+                        }
+                        swizzle_block_16(block, (uint8_t*)linear, 32);
+                    }
+                }
+                else if (!keep_mask)
+                {
+                    if (!pitch)
+                        std::fill_n((uint32_t*)block, 64, values[0]);
+                    else
+                        swizzle_block_32(block, (const uint8_t*)source, pitch * 4);
+                }
+                else
+                {
+                    uint32_t words[64];
+                    if (!pitch)
+                        std::fill_n(words, 64, values[0]);
+                    else
+                        swizzle_block_32((uint8_t*)words, (const uint8_t*)source, pitch * 4);
+                    uint32_t* dest = (uint32_t*)block;
+                    for (int i = 0; i < 64; i++)
+                        dest[i] = (dest[i] & keep_mask) | (words[i] & ~keep_mask);
+                }
+                continue;
+            }
+
+            for (uint32_t py = std::max(by, y); py < std::min(by + 8, end_y); py++)
+            {
+                for (uint32_t px = std::max(bx, x); px < std::min(bx + block_width, end_x); px++)
+                {
+                    uint32_t value = pitch ? values[(py - y) * pitch + (px - x)] : values[0];
+                    uint32_t addr = pixel_addr(format, base, width, px, py);
+                    stamp_page(addr);
+                    if (is_16bit)
+                        *(uint16_t*)&local_mem[addr] = value;
+                    else
+                    {
+                        uint32_t* dest = (uint32_t*)&local_mem[addr];
+                        *dest = (*dest & keep_mask) | (value & ~keep_mask);
+                    }
+                }
             }
         }
     }
@@ -1605,88 +2346,30 @@ void GraphicsSynthesizerThread::write_HWREG(uint64_t data)
         switch (BITBLTBUF.dest_format)
         {
             case 0x00:
-                write_PSMCT32_block(BITBLTBUF.dest_base, BITBLTBUF.dest_width, TRXPOS.int_dest_x, TRXPOS.dest_y, (data >> (i * 32)) & 0xFFFFFFFF);
+                write_HWREG_pixel(TRXPOS.int_dest_x, TRXPOS.dest_y, (data >> (i * 32)) & 0xFFFFFFFF);
                 pixels_transferred++;
                 TRXPOS.int_dest_x++;
-                //printf("[GS_t] Write to $%08X of ", BITBLTBUF.dest_base + (dest_addr * 4));
-                //printf("$%08X\n", (data >> (i * 32)) & 0xFFFFFFFF);
                 break;
             case 0x01:
                 unpack_PSMCT24(data, i, false);
                 break;
             case 0x02:
-                write_PSMCT16_block(BITBLTBUF.dest_base, BITBLTBUF.dest_width, TRXPOS.int_dest_x, TRXPOS.dest_y, (data >> (i * 16)) & 0xFFFF);
+                write_HWREG_pixel(TRXPOS.int_dest_x, TRXPOS.dest_y, (data >> (i * 16)) & 0xFFFF);
                 pixels_transferred++;
                 TRXPOS.int_dest_x++;
                 break;
             case 0x13:
-                write_PSMCT8_block(BITBLTBUF.dest_base, BITBLTBUF.dest_width, TRXPOS.int_dest_x, TRXPOS.dest_y,
-                                   (data >> (i * 8)) & 0xFF);
-                //printf("[GS_t] Write to $%08X\n", dest_addr);
-                pixels_transferred++;
-                TRXPOS.int_dest_x++;
-                break;
-            case 0x14:
-                write_PSMCT4_block(BITBLTBUF.dest_base, BITBLTBUF.dest_width, TRXPOS.int_dest_x, TRXPOS.dest_y,
-                                   data >> ((i >> 1) << 3));
-                pixels_transferred++;
-                TRXPOS.int_dest_x++;
-                break;
             case 0x1B:
-            {
-                uint32_t value = (data >> (i << 3)) & 0xFF;
-                value <<= 24;
-                value |= read_PSMCT32_block(BITBLTBUF.dest_base, BITBLTBUF.dest_width, TRXPOS.int_dest_x, TRXPOS.dest_y)
-                        & 0x00FFFFFF;
-                write_PSMCT32_block(BITBLTBUF.dest_base, BITBLTBUF.dest_width, TRXPOS.int_dest_x, TRXPOS.dest_y, value);
-                //printf("[GS_t] Write to $%08X of ", BITBLTBUF.dest_base + (dest_addr * 4));
+                write_HWREG_pixel(TRXPOS.int_dest_x, TRXPOS.dest_y, (data >> (i * 8)) & 0xFF);
                 pixels_transferred++;
                 TRXPOS.int_dest_x++;
-            }
                 break;
+            case 0x14:
             case 0x24:
-            {
-                uint32_t value;
-                if (i & 0x1)
-                {
-                    value = (data >> ((i >> 1) << 3)) & 0xF0;
-                    value <<= 20;
-                }
-                else
-                {
-                    value = (data >> ((i >> 1) << 3)) & 0xF;
-                    value <<= 24;
-                }
-                value |= read_PSMCT32_block(BITBLTBUF.dest_base, BITBLTBUF.dest_width, TRXPOS.int_dest_x, TRXPOS.dest_y)
-                        & 0xF0FFFFFF;
-                write_PSMCT32_block(BITBLTBUF.dest_base, BITBLTBUF.dest_width, TRXPOS.int_dest_x, TRXPOS.dest_y, value);
-                //printf("[GS_t] Write to $%08X of ", BITBLTBUF.dest_base + (dest_addr * 4));
-                //printf("$%08X\n", value);
-                pixels_transferred++;
-                TRXPOS.int_dest_x++;
-            }
-                break;
             case 0x2C:
-            {
-                uint32_t value;
-                if (i & 0x1)
-                {
-                    value = (data >> ((i >> 1) << 3)) & 0xF0;
-                    value <<= 24;
-                }
-                else
-                {
-                    value = (data >> ((i >> 1) << 3)) & 0xF;
-                    value <<= 28;
-                }
-                value |= read_PSMCT32_block(BITBLTBUF.dest_base, BITBLTBUF.dest_width, TRXPOS.int_dest_x, TRXPOS.dest_y)
-                        & 0x0FFFFFFF;
-                write_PSMCT32_block(BITBLTBUF.dest_base, BITBLTBUF.dest_width, TRXPOS.int_dest_x, TRXPOS.dest_y, value);
-                //printf("[GS_t] Write to $%08X of ", BITBLTBUF.dest_base + (dest_addr * 4));
-                //printf("$%08X\n", value);
+                write_HWREG_pixel(TRXPOS.int_dest_x, TRXPOS.dest_y, (data >> (i * 4)) & 0xF);
                 pixels_transferred++;
                 TRXPOS.int_dest_x++;
-            }
                 break;
             case 0x31:
                 unpack_PSMCT24(data, i, true);
@@ -1699,6 +2382,11 @@ void GraphicsSynthesizerThread::write_HWREG(uint64_t data)
         }
     }
 
+    end_HWREG_transfer();
+}
+
+void GraphicsSynthesizerThread::end_HWREG_transfer()
+{
     uint32_t max_pixels = TRXREG.width * TRXREG.height;
     if (pixels_transferred >= max_pixels)
     {
@@ -1709,218 +2397,715 @@ void GraphicsSynthesizerThread::write_HWREG(uint64_t data)
     }
 }
 
-void GraphicsSynthesizerThread::unpack_PSMCT24(uint64_t data, int offset, bool z_format)
+void GraphicsSynthesizerThread::write_HWREG_pixel(uint32_t x, uint32_t y, uint32_t value)
 {
-    int bytes_unpacked = 0;
-    for (int i = offset * 24; bytes_unpacked < 3 && i < 64; i += 8)
+    write_PSM_pixel(BITBLTBUF.dest_format, BITBLTBUF.dest_base, BITBLTBUF.dest_width, x, y, value);
+}
+
+//Size in bits of the memory taken by a pixel of format, or 0 if the format is unknown
+static int PSM_storage_bits(uint8_t format)
+{
+    switch (format)
     {
-        PSMCT24_color |= ((data >> i) & 0xFF) << (PSMCT24_unpacked_count * 8);
-        PSMCT24_unpacked_count++;
-        bytes_unpacked++;
-        if (PSMCT24_unpacked_count == 3)
-        {
-            if (z_format)
-                write_PSMCT24Z_block(BITBLTBUF.dest_base, BITBLTBUF.dest_width, TRXPOS.int_dest_x,
-                                     TRXPOS.dest_y, PSMCT24_color);
-            else
-                write_PSMCT32_block(BITBLTBUF.dest_base, BITBLTBUF.dest_width, TRXPOS.int_dest_x,
-                                    TRXPOS.dest_y, PSMCT24_color);
-            PSMCT24_color = 0;
-            PSMCT24_unpacked_count = 0;
-            TRXPOS.int_dest_x++;
-            pixels_transferred++;
-        }
+        case 0x00:
+        case 0x01:
+        case 0x1B:
+        case 0x24:
+        case 0x2C:
+        case 0x30:
+        case 0x31:
+            return 32;
+        case 0x02:
+        case 0x0A:
+        case 0x32:
+        case 0x3A:
+            return 16;
+        case 0x13:
+            return 8;
+        case 0x14:
+            return 4;
+        default:
+            return 0;
     }
 }
 
-void GraphicsSynthesizerThread::host_to_host()
+//Size in bits of a pixel of format as seen by the host
+static int PSM_transfer_bits(uint8_t format)
 {
-    Errors::die("host_to_host not implemented!");
-    int ppd = 2; //pixels per doubleword
-    uint32_t source_addr = (TRXPOS.source_x + (TRXPOS.source_y * BITBLTBUF.source_width)) << 1;
-    source_addr += BITBLTBUF.source_base;
-    uint32_t max_pixels = TRXREG.width * TRXREG.height;
-    printf("TRXPOS Source: (%d, %d) Dest: (%d, %d)\n", TRXPOS.source_x, TRXPOS.source_y, TRXPOS.dest_x, TRXPOS.dest_y);
-    printf("TRXREG: (%d, %d)\n", TRXREG.width, TRXREG.height);
-    printf("Base: $%08X\n", BITBLTBUF.source_base);
-    /*printf("Source addr: $%08X Dest addr: $%08X\n", source_addr, transfer_addr);
-    while (pixels_transferred < max_pixels)
-    {
-        printf("Host-host transfer from $%08X to $%08X\n", source_addr, transfer_addr);
-        uint64_t borp = *(uint64_t*)&local_mem[source_addr];
-        *(uint64_t*)&local_mem[transfer_addr] = borp;
-        pixels_transferred += ppd;
-        transfer_addr += 8;
-        source_addr += 8;
-    }*/
-    pixels_transferred = 0;
-    TRXDIR = 3;
+    switch (format)
+    {
+        case 0x01:
+        case 0x31:
+            return 24;
+        case 0x1B:
+            return 8;
+        case 0x24:
+        case 0x2C:
+            return 4;
+        default:
+            return PSM_storage_bits(format);
+    }
 }
 
-void GraphicsSynthesizerThread::tex_lookup(uint16_t u, uint16_t v, const RGBAQ_REG& vtx_color, RGBAQ_REG& tex_color)
+static void PSM_block_size(int bits, uint32_t& block_width, uint32_t& block_height)
+{
+    block_width = (bits == 32) ? 8 : (bits == 4) ? 32 : 16;
+    block_height = (bits >= 16) ? 8 : 16;
+}
+
+//Formats stored in 32-bit words that only own part of each word
+static bool PSM_is_partial(uint8_t format)
+{
+    return format == 0x01 || format == 0x1B || format == 0x24 || format == 0x2C || format == 0x31;
+}
+
+//Extracts the pixel value of a 32-bit format from its word
+static uint32_t PSM_value(uint8_t format, uint32_t word)
 {
-    switch (current_ctx->clamp.wrap_s)
+    switch (format)
     {
-        case 0:
-            u %= current_ctx->tex0.tex_width;
-            break;
-        case 1:
-            if (u > current_ctx->tex0.tex_width)
-                u = current_ctx->tex0.tex_width;
-            break;
+        case 0x01:
+        case 0x31:
+            return word & 0x00FFFFFF;
+        case 0x1B:
+            return word >> 24;
+        case 0x24:
+            return (word >> 24) & 0xF;
+        case 0x2C:
+            return word >> 28;
+        default:
+            return word;
     }
-    switch (current_ctx->clamp.wrap_t)
+}
+
+//Places a pixel value into a word of a partial 32-bit format.
+//PSMCT24 clears the upper byte, as HWREG transfers always have.
+static uint32_t PSM_merge(uint8_t format, uint32_t word, uint32_t value)
+{
+    switch (format)
     {
-        case 0:
-            v %= current_ctx->tex0.tex_height;
-            break;
-        case 1:
-            if (v > current_ctx->tex0.tex_height)
-                v = current_ctx->tex0.tex_height;
-            break;
+        case 0x01:
+            return value & 0x00FFFFFF;
+        case 0x1B:
+            return (word & 0x00FFFFFF) | (value << 24);
+        case 0x24:
+            return (word & 0xF0FFFFFF) | ((value & 0xF) << 24);
+        case 0x2C:
+            return (word & 0x0FFFFFFF) | (value << 28);
+        case 0x31:
+            return (word & 0xFF000000) | (value & 0x00FFFFFF);
+        default:
+            return value;
     }
+}
 
-    uint32_t coord = u + (v * current_ctx->tex0.width);
-    uint32_t tex_base = current_ctx->tex0.texture_base;
-    switch (current_ctx->tex0.format)
+//Merges an 8x8 rectangle of pixel values into a block of a partial 32-bit format
+static void merge_block_32(uint8_t format, uint8_t* block, const uint32_t* values, uint32_t pitch)
+{
+    uint32_t words[64];
+    unswizzle_block_32(block, (uint8_t*)words, 32);
+    for (int y = 0; y < 8; y++)
+    {
+        for (int x = 0; x < 8; x++)
+            words[(y << 3) + x] = PSM_merge(format, words[(y << 3) + x], values[y * pitch + x]);
+    }
+    swizzle_block_32(block, (uint8_t*)words, 32);
+}
+
+uint32_t GraphicsSynthesizerThread::read_PSM_pixel(uint8_t format, uint32_t base, uint32_t width, uint32_t x, uint32_t y)
+{
+    switch (format)
     {
         case 0x00:
-        {
-            uint32_t color = read_PSMCT32_block(tex_base, current_ctx->tex0.width, u, v);
-            tex_color.r = color & 0xFF;
-            tex_color.g = (color >> 8) & 0xFF;
-            tex_color.b = (color >> 16) & 0xFF;
-            tex_color.a = color >> 24;
-        }
+        case 0x01:
+        case 0x1B:
+        case 0x24:
+        case 0x2C:
+            return PSM_value(format, read_PSMCT32_block(base, width, x, y));
+        case 0x02:
+            return read_PSMCT16_block(base, width, x, y);
+        case 0x0A:
+            return read_PSMCT16S_block(base, width, x, y);
+        case 0x13:
+            return read_PSMCT8_block(base, width, x, y);
+        case 0x14:
+            return read_PSMCT4_block(base, width, x, y);
+        case 0x30:
+        case 0x31:
+            return PSM_value(format, read_PSMCT32Z_block(base, width, x, y));
+        case 0x32:
+            return read_PSMCT16Z_block(base, width, x, y);
+        case 0x3A:
+            return read_PSMCT16SZ_block(base, width, x, y);
+        default:
+            Errors::die("[GS_t] Unrecognized local memory format $%02X\n", format);
+    }
+    return 0;
+}
+
+void GraphicsSynthesizerThread::write_PSM_pixel(uint8_t format, uint32_t base, uint32_t width, uint32_t x, uint32_t y,
+                                                uint32_t value)
+{
+    switch (format)
+    {
+        case 0x00:
+            write_PSMCT32_block(base, width, x, y, value);
             break;
         case 0x01:
-        {
-            uint32_t color = read_PSMCT32_block(tex_base, current_ctx->tex0.width, u, v);
-            tex_color.r = color & 0xFF;
-            tex_color.g = (color >> 8) & 0xFF;
-            tex_color.b = (color >> 16) & 0xFF;
-            tex_color.a = TEXA.alpha0;
-        }
+        case 0x1B:
+        case 0x24:
+        case 0x2C:
+            write_PSMCT32_block(base, width, x, y, PSM_merge(format, read_PSMCT32_block(base, width, x, y), value));
             break;
         case 0x02:
-        {
-            uint16_t color = read_PSMCT16_block(tex_base, current_ctx->tex0.width, u, v);
-            tex_color.r = (color & 0x1F) << 3;
-            tex_color.g = ((color >> 5) & 0x1F) << 3;
-            tex_color.b = ((color >> 10) & 0x1F) << 3;
+            write_PSMCT16_block(base, width, x, y, value);
+            break;
+        case 0x0A:
+            write_PSMCT16S_block(base, width, x, y, value);
+            break;
+        case 0x13:
+            write_PSMCT8_block(base, width, x, y, value);
+            break;
+        case 0x14:
+            write_PSMCT4_block(base, width, x, y, value);
+            break;
+        case 0x30:
+            write_PSMCT32Z_block(base, width, x, y, value);
+            break;
+        case 0x31:
+            write_PSMCT24Z_block(base, width, x, y, value & 0x00FFFFFF);
+            break;
+        case 0x32:
+            write_PSMCT16Z_block(base, width, x, y, value);
+            break;
+        case 0x3A:
+            write_PSMCT16SZ_block(base, width, x, y, value);
+            break;
+        default:
+            Errors::die("[GS_t] Unrecognized local memory format $%02X\n", format);
+    }
+}
 
-            if (!(color & 0x7FFF) && TEXA.trans_black)
-                tex_color.a = 0;
-            else
-            {
-                if (color & (1 << 15))
-                    tex_color.a = TEXA.alpha1;
-                else
-                    tex_color.a = TEXA.alpha0;
-            }
-            tex_color.a = ((color & (1 << 15)) != 0) << 7;
-        }
+//Returns the size in bits of a transferred pixel along with the size of its destination block,
+//or false if the format has no block path
+static bool HWREG_block_info(uint8_t format, int& bpp, uint32_t& block_width, uint32_t& block_height)
+{
+    block_width = 8;
+    block_height = 8;
+    switch (format)
+    {
+        case 0x00:
+            bpp = 32;
+            return true;
+        case 0x01:
+        case 0x31:
+            bpp = 24;
+            return true;
+        case 0x02:
+            bpp = 16;
+            block_width = 16;
+            return true;
+        case 0x13:
+            bpp = 8;
+            block_width = 16;
+            block_height = 16;
+            return true;
+        case 0x14:
+            bpp = 4;
+            block_width = 32;
+            block_height = 16;
+            return true;
+        case 0x1B:
+            bpp = 8;
+            return true;
+        case 0x24:
+        case 0x2C:
+            bpp = 4;
+            return true;
+        default:
+            return false;
+    }
+}
+
+//Reads pixel number index out of a packed host image
+static inline uint32_t read_image_pixel(const uint8_t* data, uint32_t index, int bpp)
+{
+    switch (bpp)
+    {
+        case 32:
+            return *(uint32_t*)&data[index << 2];
+        case 24:
+            index *= 3;
+            return data[index] | (data[index + 1] << 8) | (data[index + 2] << 16);
+        case 16:
+            return *(uint16_t*)&data[index << 1];
+        case 8:
+            return data[index];
+        default:
+            return (data[index >> 1] >> ((index & 1) << 2)) & 0xF;
+    }
+}
+
+//Stores pixel number index into a packed host image
+static inline void write_image_pixel(uint8_t* data, uint32_t index, int bpp, uint32_t value)
+{
+    switch (bpp)
+    {
+        case 32:
+            *(uint32_t*)&data[index << 2] = value;
             break;
-        case 0x09: //Invalid format??? FFX uses it
-            tex_color.r = 0;
-            tex_color.g = 0;
-            tex_color.b = 0;
-            tex_color.a = 0;
+        case 24:
+            index *= 3;
+            data[index] = value & 0xFF;
+            data[index + 1] = (value >> 8) & 0xFF;
+            data[index + 2] = (value >> 16) & 0xFF;
             break;
-        case 0x0A:
+        case 16:
+            *(uint16_t*)&data[index << 1] = value;
+            break;
+        case 8:
+            data[index] = value;
+            break;
+        default:
+            data[index >> 1] |= (value & 0xF) << ((index & 1) << 2);
+            break;
+    }
+}
+
+/**
+  * Writes a whole IMAGE mode GIF payload. Whenever the transfer is at the start of a row that is aligned to the
+  * destination's blocks, a band of rows as tall as a block is written at once, with the aligned middle of the band
+  * swizzled a block at a time. Anything else, such as the rows before the first aligned row or a band split
+  * across two payloads, goes through write_HWREG.
+  **/
+void GraphicsSynthesizerThread::write_HWREG_image(const uint64_t* data, uint32_t count)
+{
+    int bpp;
+    uint32_t block_width, block_height;
+    while (count && TRXDIR == 0)
+    {
+        if (HWREG_block_info(BITBLTBUF.dest_format, bpp, block_width, block_height) && TRXREG.width &&
+                TRXPOS.int_dest_x == TRXPOS.dest_x && !PSMCT24_unpacked_count &&
+                !(TRXPOS.dest_y & (block_height - 1)) && !(((TRXPOS.dest_x | TRXREG.width) * bpp) & 0x7))
         {
-            uint16_t color = read_PSMCT16S_block(tex_base, current_ctx->tex0.width, u, v);
-            tex_color.r = (color & 0x1F) << 3;
-            tex_color.g = ((color >> 5) & 0x1F) << 3;
-            tex_color.b = ((color >> 10) & 0x1F) << 3;
-            if (!(color & 0x7FFF) && TEXA.trans_black)
-                tex_color.a = 0;
-            else
+            uint32_t rows_left = TRXREG.height - pixels_transferred / TRXREG.width;
+            uint32_t band_size = (TRXREG.width * block_height * bpp) / 64;
+            if (rows_left >= block_height && band_size <= count)
             {
-                if (color & (1 << 15))
-                    tex_color.a = TEXA.alpha1;
-                else
-                    tex_color.a = TEXA.alpha0;
+                write_HWREG_band((const uint8_t*)data, bpp, block_width, block_height);
+                data += band_size;
+                count -= band_size;
+                end_HWREG_transfer();
+                continue;
             }
         }
-            break;
-        case 0x13:
+        write_HWREG(*data);
+        data++;
+        count--;
+    }
+}
+
+void GraphicsSynthesizerThread::write_HWREG_band(const uint8_t* data, int bpp, uint32_t block_width,
+                                                 uint32_t block_height)
+{
+    uint8_t format = BITBLTBUF.dest_format;
+    uint32_t left = TRXPOS.dest_x;
+    uint32_t right = left + TRXREG.width;
+    uint32_t pitch = (TRXREG.width * bpp) / 8;
+
+    //Pixels outside of [first_block, last_block) don't fill a block and are written one at a time
+    uint32_t first_block = (left + block_width - 1) & ~(block_width - 1);
+    uint32_t last_block = right & ~(block_width - 1);
+    if (last_block < first_block)
+    {
+        first_block = right;
+        last_block = right;
+    }
+
+    for (uint32_t row = 0; row < block_height; row++)
+    {
+        uint32_t y = TRXPOS.dest_y + row;
+        uint32_t row_start = row * TRXREG.width - left;
+        for (uint32_t x = left; x < first_block; x++)
+            write_HWREG_pixel(x, y, read_image_pixel(data, row_start + x, bpp));
+        for (uint32_t x = last_block; x < right; x++)
+            write_HWREG_pixel(x, y, read_image_pixel(data, row_start + x, bpp));
+    }
+
+    for (uint32_t x = first_block; x < last_block; x += block_width)
+    {
+        uint32_t addr = pixel_addr(format, BITBLTBUF.dest_base, BITBLTBUF.dest_width, x, TRXPOS.dest_y);
+        uint8_t* block = &local_mem[addr];
+        const uint8_t* source = data + ((x - left) * bpp) / 8;
+        stamp_page(addr);
+        switch (format)
         {
-            uint8_t entry = read_PSMCT8_block(tex_base, current_ctx->tex0.width, u, v);
-            if (current_ctx->tex0.use_CSM2)
+            case 0x00:
+                swizzle_block_32(block, source, pitch);
+                break;
+            case 0x02:
+                swizzle_block_16(block, source, pitch);
+                break;
+            case 0x13:
+                swizzle_block_8(block, source, pitch);
+                break;
+            case 0x14:
+                swizzle_block_4(block, source, pitch);
+                break;
+            default:
             {
-                tex_color.r = entry;
-                tex_color.g = entry;
-                tex_color.b = entry;
-                tex_color.a = (entry) ? 0x80 : 0x00;
+                //The remaining formats only replace part of each 32-bit word, so they are merged with the block
+                uint32_t values[64];
+                for (int y = 0; y < 8; y++)
+                {
+                    for (int i = 0; i < 8; i++)
+                        values[(y << 3) + i] = read_image_pixel(source + y * pitch, i, bpp);
+                }
+                merge_block_32(format, block, values, 8);
             }
+                break;
+        }
+    }
+
+    TRXPOS.dest_y += block_height;
+    pixels_transferred += TRXREG.width * block_height;
+}
+
+void GraphicsSynthesizerThread::unpack_PSMCT24(uint64_t data, int offset, bool z_format)
+{
+    int bytes_unpacked = 0;
+    for (int i = offset * 24; bytes_unpacked < 3 && i < 64; i += 8)
+    {
+        PSMCT24_color |= ((data >> i) & 0xFF) << (PSMCT24_unpacked_count * 8);
+        PSMCT24_unpacked_count++;
+        bytes_unpacked++;
+        if (PSMCT24_unpacked_count == 3)
+        {
+            if (z_format)
+                write_PSMCT24Z_block(BITBLTBUF.dest_base, BITBLTBUF.dest_width, TRXPOS.int_dest_x,
+                                     TRXPOS.dest_y, PSMCT24_color);
             else
-            {
-                clut_lookup(entry, tex_color, true);
-            }
-            //return get_word(addr);
+                write_PSMCT32_block(BITBLTBUF.dest_base, BITBLTBUF.dest_width, TRXPOS.int_dest_x,
+                                    TRXPOS.dest_y, PSMCT24_color);
+            PSMCT24_color = 0;
+            PSMCT24_unpacked_count = 0;
+            TRXPOS.int_dest_x++;
+            pixels_transferred++;
         }
-            break;
-        case 0x14:
+    }
+}
+
+/**
+  * Local-to-local transfer. Nothing is written until the whole source rectangle has been read, so overlapping
+  * rectangles copy correctly in any direction. Whole blocks are copied as-is when both rectangles use the same
+  * format and line up with its blocks. Otherwise pixel values go through transfer_buffer, using the block swizzle
+  * kernels on whichever side is block aligned.
+  **/
+void GraphicsSynthesizerThread::host_to_host()
+{
+    printf("TRXPOS Source: (%d, %d) Dest: (%d, %d)\n", TRXPOS.source_x, TRXPOS.source_y, TRXPOS.dest_x, TRXPOS.dest_y);
+    printf("TRXREG: (%d, %d)\n", TRXREG.width, TRXREG.height);
+    printf("Base: $%08X\n", BITBLTBUF.source_base);
+    if (TRXREG.width && TRXREG.height && !copy_local_blocks())
+    {
+        transfer_buffer.resize(TRXREG.width * TRXREG.height);
+        read_local_rect(transfer_buffer.data());
+        write_local_rect();
+    }
+    pixels_transferred = 0;
+    TRXDIR = 3;
+}
+
+bool GraphicsSynthesizerThread::copy_local_blocks()
+{
+    uint8_t format = BITBLTBUF.source_format;
+    if (format != BITBLTBUF.dest_format || PSM_is_partial(format))
+        return false;
+
+    int bits = PSM_storage_bits(format);
+    if (!bits)
+        return false;
+
+    uint32_t block_width, block_height;
+    PSM_block_size(bits, block_width, block_height);
+    uint32_t x_mask = block_width - 1, y_mask = block_height - 1;
+    if (((TRXPOS.source_x | TRXPOS.dest_x | TRXREG.width) & x_mask) ||
+            ((TRXPOS.source_y | TRXPOS.dest_y | TRXREG.height) & y_mask))
+        return false;
+
+    //Read every block before writing any in case the rectangles overlap
+    uint32_t blocks = (TRXREG.width / block_width) * (TRXREG.height / block_height);
+    transfer_buffer.resize(blocks * 64);
+    uint32_t* buffer = transfer_buffer.data();
+    for (uint32_t y = 0; y < TRXREG.height; y += block_height)
+    {
+        for (uint32_t x = 0; x < TRXREG.width; x += block_width, buffer += 64)
         {
-            uint8_t entry = read_PSMCT4_block(tex_base, current_ctx->tex0.width, u, v);
-            if (current_ctx->tex0.use_CSM2)
+            uint32_t addr = pixel_addr(format, BITBLTBUF.source_base, BITBLTBUF.source_width,
+                                       TRXPOS.source_x + x, TRXPOS.source_y + y);
+            memcpy(buffer, &local_mem[addr], 256);
+        }
+    }
+
+    buffer = transfer_buffer.data();
+    for (uint32_t y = 0; y < TRXREG.height; y += block_height)
+    {
+        for (uint32_t x = 0; x < TRXREG.width; x += block_width, buffer += 64)
+        {
+            uint32_t addr = pixel_addr(format, BITBLTBUF.dest_base, BITBLTBUF.dest_width,
+                                       TRXPOS.dest_x + x, TRXPOS.dest_y + y);
+            stamp_page(addr);
+            memcpy(&local_mem[addr], buffer, 256);
+        }
+    }
+    return true;
+}
+
+//Reads the source rectangle into values, one pixel value per word
+void GraphicsSynthesizerThread::read_local_rect(uint32_t* values)
+{
+    uint8_t format = BITBLTBUF.source_format;
+    uint32_t base = BITBLTBUF.source_base;
+    uint32_t width = BITBLTBUF.source_width;
+    uint32_t pitch = TRXREG.width;
+    int bits = PSM_storage_bits(format);
+    if (!bits)
+        Errors::die("[GS_t] Unrecognized BITBLTBUF source format $%02X\n", format);
+
+    uint32_t block_width, block_height;
+    PSM_block_size(bits, block_width, block_height);
+    if (((TRXPOS.source_x | TRXREG.width) & (block_width - 1)) ||
+            ((TRXPOS.source_y | TRXREG.height) & (block_height - 1)))
+    {
+        for (uint32_t y = 0; y < TRXREG.height; y++)
+        {
+            for (uint32_t x = 0; x < TRXREG.width; x++)
+                values[y * pitch + x] = read_PSM_pixel(format, base, width, TRXPOS.source_x + x, TRXPOS.source_y + y);
+        }
+        return;
+    }
+
+    uint8_t linear[256];
+    for (uint32_t by = 0; by < TRXREG.height; by += block_height)
+    {
+        for (uint32_t bx = 0; bx < TRXREG.width; bx += block_width)
+        {
+            const uint8_t* block = &local_mem[pixel_addr(format, base, width, TRXPOS.source_x + bx,
+                                                         TRXPOS.source_y + by)];
+            uint32_t* dest = &values[by * pitch + bx];
+            switch (bits)
             {
-                tex_color.r = entry << 4;
-                tex_color.g = entry << 4;
-                tex_color.b = entry << 4;
-                tex_color.a = (entry) ? 0x80 : 0x00;
+                case 32:
+                    unswizzle_block_32(block, (uint8_t*)dest, pitch * 4);
+                    if (PSM_is_partial(format))
+                    {
+                        for (uint32_t y = 0; y < 8; y++)
+                        {
+                            for (uint32_t x = 0; x < 8; x++)
+                                dest[y * pitch + x] = PSM_value(format, dest[y * pitch + x]);
+                        }
+                    }
+                    break;
+                case 16:
+                    unswizzle_block_16(block, linear, 32);
+                    for (uint32_t y = 0; y < 8; y++)
+                    {
+                        for (uint32_t x = 0; x < 16; x++)
+                            dest[y * pitch + x] = ((uint16_t*)linear)[y * 16 + x];
+                    }
+                    break;
+                case 8:
+                    unswizzle_block_8(block, linear, 16);
+                    for (uint32_t y = 0; y < 16; y++)
+                    {
+                        for (uint32_t x = 0; x < 16; x++)
+                            dest[y * pitch + x] = linear[y * 16 + x];
+                    }
+                    break;
+                case 4:
+                    unswizzle_block_4(block, linear, 16);
+                    for (uint32_t y = 0; y < 16; y++)
+                    {
+                        for (uint32_t x = 0; x < 32; x++)
+                            dest[y * pitch + x] = (linear[y * 16 + (x >> 1)] >> ((x & 1) << 2)) & 0xF;
+                    }
+                    break;
             }
-            else
-                clut_lookup(entry, tex_color, false);
         }
-            break;
-        case 0x1B:
+    }
+}
+
+//Writes the pixel values in transfer_buffer to the destination rectangle
+void GraphicsSynthesizerThread::write_local_rect()
+{
+    uint8_t format = BITBLTBUF.dest_format;
+    uint32_t base = BITBLTBUF.dest_base;
+    uint32_t width = BITBLTBUF.dest_width;
+    uint32_t pitch = TRXREG.width;
+    const uint32_t* values = transfer_buffer.data();
+    int bits = PSM_storage_bits(format);
+    if (!bits)
+        Errors::die("[GS_t] Unrecognized BITBLTBUF dest format $%02X\n", format);
+
+    uint32_t block_width, block_height;
+    PSM_block_size(bits, block_width, block_height);
+    if (((TRXPOS.dest_x | TRXREG.width) & (block_width - 1)) ||
+            ((TRXPOS.dest_y | TRXREG.height) & (block_height - 1)))
+    {
+        for (uint32_t y = 0; y < TRXREG.height; y++)
         {
-            uint8_t entry = read_PSMCT32_block(tex_base, current_ctx->tex0.width, u, v) >> 24;
-            if (current_ctx->tex0.use_CSM2)
+            for (uint32_t x = 0; x < TRXREG.width; x++)
+                write_PSM_pixel(format, base, width, TRXPOS.dest_x + x, TRXPOS.dest_y + y, values[y * pitch + x]);
+        }
+        return;
+    }
+
+    uint8_t linear[256];
+    for (uint32_t by = 0; by < TRXREG.height; by += block_height)
+    {
+        for (uint32_t bx = 0; bx < TRXREG.width; bx += block_width)
+        {
+            uint32_t addr = pixel_addr(format, base, width, TRXPOS.dest_x + bx, TRXPOS.dest_y + by);
+            uint8_t* block = &local_mem[addr];
+            const uint32_t* source = &values[by * pitch + bx];
+            stamp_page(addr);
+            switch (bits)
             {
-                tex_color.r = entry;
-                tex_color.g = entry;
-                tex_color.b = entry;
-                tex_color.a = (entry) ? 0x80 : 0x00;
+                case 32:
+                    if (PSM_is_partial(format))
+                        merge_block_32(format, block, source, pitch);
+                    else
+                        swizzle_block_32(block, (const uint8_t*)source, pitch * 4);
+                    break;
+                case 16:
+                    for (uint32_t y = 0; y < 8; y++)
+                    {
+                        for (uint32_t x = 0; x < 16; x++)
+                            ((uint16_t*)linear)[y * 16 + x] = source[y * pitch + x];
+                    }
+                    swizzle_block_16(block, linear, 32);
+                    break;
+                case 8:
+                    for (uint32_t y = 0; y < 16; y++)
+                    {
+                        for (uint32_t x = 0; x < 16; x++)
+                            linear[y * 16 + x] = source[y * pitch + x];
+                    }
+                    swizzle_block_8(block, linear, 16);
+                    break;
+                case 4:
+                    for (uint32_t y = 0; y < 16; y++)
+                    {
+                        for (uint32_t x = 0; x < 32; x += 2)
+                            linear[y * 16 + (x >> 1)] = (source[y * pitch + x] & 0xF) | (source[y * pitch + x + 1] << 4);
+                    }
+                    swizzle_block_4(block, linear, 16);
+                    break;
             }
-            else
-                clut_lookup(entry, tex_color, true);
         }
+    }
+}
+
+/**
+  * Local-to-host transfer. The source rectangle is deswizzled in one go into the EE's staging buffer, packed the
+  * way the host expects it in the source format. 32-bit formats are deswizzled straight into the staging buffer.
+  * Returns the number of quadwords written.
+  **/
+uint32_t GraphicsSynthesizerThread::local_to_host(uint128_t* target, uint32_t capacity)
+{
+    if (TRXDIR != 1)
+        return 0;
+
+    uint8_t format = BITBLTBUF.source_format;
+    int bpp = PSM_transfer_bits(format);
+
+    uint64_t pixels = TRXREG.width * TRXREG.height;
+    uint32_t quads = ((pixels * bpp + 127) / 128);
+    if (quads > capacity)
+    {
+        Errors::print_warning("[GS_t] Local-to-host transfer of %d quadwords truncated\n", quads);
+        quads = capacity;
+        pixels = ((uint64_t)quads * 128) / bpp;
+    }
+    printf("[GS_t] Local-to-host transfer: %d quadwords\n", quads);
+
+    if (bpp == 32 && pixels == TRXREG.width * TRXREG.height)
+        read_local_rect((uint32_t*)target);
+    else
+    {
+        transfer_buffer.resize(TRXREG.width * TRXREG.height);
+        read_local_rect(transfer_buffer.data());
+        uint8_t* data = (uint8_t*)target;
+        memset(data, 0, quads * 16);
+        for (uint32_t i = 0; i < pixels; i++)
+            write_image_pixel(data, i, bpp, transfer_buffer[i]);
+    }
+
+    pixels_transferred = 0;
+    TRXDIR = 3;
+    return quads;
+}
+
+//Applies the CLAMP wrap modes to a texel coordinate
+uint16_t GraphicsSynthesizerThread::clamp_u(uint16_t u)
+{
+    uint16_t tex_width = current_ctx->tex0.tex_width;
+    CLAMP& clamp = current_ctx->clamp;
+    switch (clamp.wrap_s)
+    {
+        case 0:
+            u %= tex_width;
             break;
-        case 0x24:
-        {
-            //printf("[GS_t] Format $24: Read from $%08X\n", tex_base + (coord << 2));
-            uint8_t entry = (read_PSMCT32_block(tex_base, current_ctx->tex0.width, u, v) >> 24) & 0xF;
-            if (current_ctx->tex0.use_CSM2)
-                clut_CSM2_lookup(entry, tex_color);
-            else
-                clut_lookup(entry, tex_color, false);
+        case 1:
+            if (u >= tex_width)
+                u = tex_width - 1;
             break;
-        }
+        case 2:
+            u = max(min(u, clamp.max_u), clamp.min_u);
             break;
-        case 0x2C:
-        {
-            uint8_t entry = read_PSMCT32_block(tex_base, current_ctx->tex0.width, u, v) >> 28;
-            if (current_ctx->tex0.use_CSM2)
-                clut_CSM2_lookup(entry, tex_color);
-            else
-                clut_lookup(entry, tex_color, false);
-        }
+        case 3:
+            u = (u & clamp.min_u) | clamp.max_u;
             break;
-        case 0x31:
-        {
-            uint32_t color = read_PSMCT32Z_block(tex_base, current_ctx->tex0.width, u, v);
-            tex_color.r = color & 0xFF;
-            tex_color.g = (color >> 8) & 0xFF;
-            tex_color.b = (color >> 16) & 0xFF;
-            tex_color.a = TEXA.alpha0;
-        }
+    }
+
+    //The region modes can still point outside of the decoded texture
+    return u & (tex_width - 1);
+}
+
+uint16_t GraphicsSynthesizerThread::clamp_v(uint16_t v)
+{
+    uint16_t tex_height = current_ctx->tex0.tex_height;
+    CLAMP& clamp = current_ctx->clamp;
+    switch (clamp.wrap_t)
+    {
+        case 0:
+            v %= tex_height;
+            break;
+        case 1:
+            if (v >= tex_height)
+                v = tex_height - 1;
+            break;
+        case 2:
+            v = max(min(v, clamp.max_v), clamp.min_v);
+            break;
+        case 3:
+            v = (v & clamp.min_v) | clamp.max_v;
             break;
-        default:
-            Errors::die("[GS_t] Unrecognized texture format $%02X\n", current_ctx->tex0.format);
     }
+    return v & (tex_height - 1);
+}
+
+void GraphicsSynthesizerThread::tex_lookup(uint16_t u, uint16_t v, const RGBAQ_REG& vtx_color, RGBAQ_REG& tex_color)
+{
+    uint16_t tex_width = current_ctx->tex0.tex_width;
+    u = clamp_u(u);
+    v = clamp_v(v);
+
+    uint32_t color = current_texture[u + (v * tex_width)];
+    tex_color.r = color & 0xFF;
+    tex_color.g = (color >> 8) & 0xFF;
+    tex_color.b = (color >> 16) & 0xFF;
+    tex_color.a = color >> 24;
 
     switch (current_ctx->tex0.color_function)
     {
@@ -1937,64 +3122,471 @@ void GraphicsSynthesizerThread::tex_lookup(uint16_t u, uint16_t v, const RGBAQ_R
     }
 }
 
-void GraphicsSynthesizerThread::clut_lookup(uint8_t entry, RGBAQ_REG &tex_color, bool eight_bit)
+//Decodes a single texel of the current context's texture to RGBA32
+uint32_t GraphicsSynthesizerThread::read_texel(uint16_t u, uint16_t v)
 {
-    uint32_t x, y;
-    if (eight_bit)
+    uint32_t tex_base = current_ctx->tex0.texture_base;
+    uint32_t width = current_ctx->tex0.width;
+    switch (current_ctx->tex0.format)
     {
-        x = entry & 0x7;
-        if (entry & 0x10)
-            x += 8;
-        y = (entry & 0xE0) / 0x10;
-        if (entry & 0x8)
-            y++;
+        case 0x00:
+            return read_PSMCT32_block(tex_base, width, u, v);
+        case 0x01:
+            return (read_PSMCT32_block(tex_base, width, u, v) & 0x00FFFFFF) | (TEXA.alpha0 << 24);
+        case 0x02:
+            return expand_PSMCT16(read_PSMCT16_block(tex_base, width, u, v));
+        case 0x09: //Invalid format??? FFX uses it
+            return 0;
+        case 0x0A:
+            return expand_PSMCT16S_texel(read_PSMCT16S_block(tex_base, width, u, v));
+        case 0x13:
+            return CLUT_palette[read_PSMCT8_block(tex_base, width, u, v)];
+        case 0x14:
+            return CLUT_palette[read_PSMCT4_block(tex_base, width, u, v)];
+        case 0x1B:
+            return CLUT_palette[read_PSMCT32_block(tex_base, width, u, v) >> 24];
+        case 0x24:
+            return CLUT_palette[(read_PSMCT32_block(tex_base, width, u, v) >> 24) & 0xF];
+        case 0x2C:
+            return CLUT_palette[read_PSMCT32_block(tex_base, width, u, v) >> 28];
+        case 0x31:
+            return (read_PSMCT32Z_block(tex_base, width, u, v) & 0x00FFFFFF) | (TEXA.alpha0 << 24);
+        default:
+            Errors::die("[GS_t] Unrecognized texture format $%02X\n", current_ctx->tex0.format);
     }
+    return 0;
+}
+
+//16-bit texels take their alpha from TEXA
+uint32_t GraphicsSynthesizerThread::expand_PSMCT16S_texel(uint16_t color)
+{
+    uint32_t r = (color & 0x1F) << 3;
+    uint32_t g = ((color >> 5) & 0x1F) << 3;
+    uint32_t b = ((color >> 10) & 0x1F) << 3;
+    uint32_t a;
+    if (!(color & 0x7FFF) && TEXA.trans_black)
+        a = 0;
     else
     {
-        x = entry & 0x7;
-        y = entry / 8;
+        if (color & (1 << 15))
+            a = TEXA.alpha1;
+        else
+            a = TEXA.alpha0;
     }
-    switch (current_ctx->tex0.CLUT_format)
+    return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+/**
+  * The GS does not read palettes from local memory while texturing. Instead, a TEX0/TEX2 write can load a palette
+  * into the 1 KB CLUT buffer, depending on its CLD field. The buffer holds 512 16-bit entries; a 32-bit entry keeps
+  * its low half at index n and its high half at index n + 256.
+  **/
+void GraphicsSynthesizerThread::load_CLUT(const TEX0& tex0)
+{
+    bool load = false;
+    switch (tex0.CLUT_control)
     {
-        //PSMCT32
-        case 0x00:
-        case 0x01:
+        case 1:
+            load = true;
+            break;
+        case 2:
+            load = true;
+            CBP0 = tex0.CLUT_base;
+            break;
+        case 3:
+            load = true;
+            CBP1 = tex0.CLUT_base;
+            break;
+        case 4:
+            if (CBP0 != tex0.CLUT_base)
+            {
+                load = true;
+                CBP0 = tex0.CLUT_base;
+            }
+            break;
+        case 5:
+            if (CBP1 != tex0.CLUT_base)
+            {
+                load = true;
+                CBP1 = tex0.CLUT_base;
+            }
+            break;
+    }
+    if (!load)
+        return;
+
+    bool eight_bit;
+    switch (tex0.format)
+    {
+        case 0x13:
+        case 0x1B:
+            eight_bit = true;
+            break;
+        case 0x14:
+        case 0x24:
+        case 0x2C:
+            eight_bit = false;
+            break;
+        default:
+            return;
+    }
+
+    int entries = (eight_bit) ? 256 : 16;
+    for (int i = 0; i < entries; i++)
+    {
+        uint32_t x, y;
+        if (tex0.use_CSM2)
         {
-            uint32_t color = read_PSMCT32_block(current_ctx->tex0.CLUT_base, 64, x, y);
-            tex_color.r = color & 0xFF;
-            tex_color.g = (color >> 8) & 0xFF;
-            tex_color.b = (color >> 16) & 0xFF;
-            tex_color.a = color >> 24;
+            //CSM2 - a linear row of 16-bit entries at TEXCLUT
+            uint16_t color = read_PSMCT16_block(tex0.CLUT_base, TEXCLUT.width, TEXCLUT.x + i, TEXCLUT.y);
+            CLUT_buffer[(tex0.CLUT_offset + i) & 0x1FF] = color;
+            continue;
         }
-            break;
-        //PSMCT16
-        case 0x02:
+
+        //CSM1 - 16x16 (8-bit) or 8x2 (4-bit) entries, with 8-bit palettes stored in a scrambled order
+        if (eight_bit)
+        {
+            x = i & 0x7;
+            if (i & 0x10)
+                x += 8;
+            y = (i & 0xE0) / 0x10;
+            if (i & 0x8)
+                y++;
+        }
+        else
+        {
+            x = i & 0x7;
+            y = i / 8;
+        }
+        switch (tex0.CLUT_format)
+        {
+            case 0x00:
+            case 0x01:
+            {
+                uint32_t color = read_PSMCT32_block(tex0.CLUT_base, 64, x, y);
+                uint32_t index = (tex0.CLUT_offset + i) & 0xFF;
+                CLUT_buffer[index] = color & 0xFFFF;
+                CLUT_buffer[index + 256] = color >> 16;
+            }
+                break;
+            case 0x02:
+                CLUT_buffer[(tex0.CLUT_offset + i) & 0x1FF] = read_PSMCT16_block(tex0.CLUT_base, 64, x, y);
+                break;
+            case 0x0A:
+                CLUT_buffer[(tex0.CLUT_offset + i) & 0x1FF] = read_PSMCT16S_block(tex0.CLUT_base, 64, x, y);
+                break;
+            default:
+                Errors::die("[GS_t] Unrecognized CLUT format $%02X\n", tex0.CLUT_format);
+        }
+    }
+    CLUT_palette_dirty = true;
+}
+
+//Expands the CLUT buffer into RGBA32 for the current context's CPSM, CSA and TEXA
+void GraphicsSynthesizerThread::update_palette()
+{
+    TEX0& tex0 = current_ctx->tex0;
+    bool is_32bit = tex0.CLUT_format == 0x00 || tex0.CLUT_format == 0x01;
+    if (!CLUT_palette_dirty && palette_format == tex0.CLUT_format && palette_offset == tex0.CLUT_offset)
+    {
+        if (is_32bit || (palette_TEXA.alpha0 == TEXA.alpha0 && palette_TEXA.alpha1 == TEXA.alpha1 &&
+                         palette_TEXA.trans_black == TEXA.trans_black))
+            return;
+    }
+
+    for (int i = 0; i < 256; i++)
+    {
+        if (is_32bit)
+        {
+            uint32_t index = (tex0.CLUT_offset + i) & 0xFF;
+            CLUT_palette[i] = CLUT_buffer[index] | (CLUT_buffer[index + 256] << 16);
+        }
+        else
         {
-            uint16_t color = read_PSMCT16_block(current_ctx->tex0.CLUT_base, 64, x, y);
-            tex_color.r = (color & 0x1F) << 3;
-            tex_color.g = ((color >> 5) & 0x1F) << 3;
-            tex_color.b = ((color >> 10) & 0x1F) << 3;
+            uint16_t color = CLUT_buffer[(tex0.CLUT_offset + i) & 0x1FF];
+            uint32_t r = (color & 0x1F) << 3;
+            uint32_t g = ((color >> 5) & 0x1F) << 3;
+            uint32_t b = ((color >> 10) & 0x1F) << 3;
+            uint32_t a;
             if (!(color & 0x7FFF) && TEXA.trans_black)
-                tex_color.a = 0;
+                a = 0;
             else
             {
                 if (color & (1 << 15))
-                    tex_color.a = TEXA.alpha1;
+                    a = TEXA.alpha1;
                 else
-                    tex_color.a = TEXA.alpha0;
+                    a = TEXA.alpha0;
+            }
+            CLUT_palette[i] = r | (g << 8) | (b << 16) | (a << 24);
+        }
+    }
+    palette_format = tex0.CLUT_format;
+    palette_offset = tex0.CLUT_offset;
+    palette_TEXA = TEXA;
+    CLUT_palette_dirty = false;
+    palette_generation++;
+}
+
+//Returns the local memory byte address of a pixel of any format, used to find the pages a texture occupies
+uint32_t GraphicsSynthesizerThread::pixel_addr(uint8_t format, uint32_t base, uint32_t width, uint32_t x, uint32_t y)
+{
+    switch (format)
+    {
+        case 0x02:
+            return addr_PSMCT16(base / 256, width / 64, x, y);
+        case 0x0A:
+            return addr_PSMCT16S(base / 256, width / 64, x, y);
+        case 0x13:
+            return addr_PSMCT8(base / 256, width / 64, x, y);
+        case 0x14:
+            return addr_PSMCT4(base / 256, width / 64, x, y) >> 1;
+        case 0x30:
+        case 0x31:
+            return addr_PSMCT32Z(base / 256, width / 64, x, y);
+        case 0x32:
+            return addr_PSMCT16Z(base / 256, width / 64, x, y);
+        case 0x3A:
+            return addr_PSMCT16SZ(base / 256, width / 64, x, y);
+        default:
+            return addr_PSMCT32(base / 256, width / 64, x, y);
+    }
+}
+
+/**
+  * Decoded texture cache
+  * Textures are expanded once into linear RGBA32 copies, palette lookups included, and reused for as long as
+  * none of the 8 KB GS pages they were decoded from are written to and the palette has not been rebuilt.
+  * Every write to local memory stamps its page with the current epoch. An entry is decoded at epoch E and the
+  * epoch is then advanced, so the entry is stale as soon as any of its pages carries a stamp greater than E.
+  **/
+static bool texture_uses_CLUT(uint8_t format)
+{
+    return format == 0x13 || format == 0x14 || format == 0x1B || format == 0x24 || format == 0x2C;
+}
+
+static bool texture_uses_TEXA(uint8_t format)
+{
+    return format == 0x01 || format == 0x0A || format == 0x31;
+}
+
+void GraphicsSynthesizerThread::make_texture_key(TextureCacheEntry& key)
+{
+    TEX0& tex0 = current_ctx->tex0;
+    key.texture_base = tex0.texture_base;
+    key.width = tex0.width;
+    key.format = tex0.format;
+    key.tex_width = tex0.tex_width;
+    key.tex_height = tex0.tex_height;
+
+    //Only keep the palette and TEXA state that actually affects the decoded texels
+    key.palette_generation = texture_uses_CLUT(tex0.format) ? palette_generation : 0;
+    if (texture_uses_TEXA(tex0.format))
+        key.texa = TEXA;
+    else
+        key.texa = {0, 0, false};
+}
+
+bool GraphicsSynthesizerThread::texture_key_matches(const TextureCacheEntry& a, const TextureCacheEntry& b)
+{
+    return a.texture_base == b.texture_base && a.width == b.width && a.format == b.format &&
+            a.tex_width == b.tex_width && a.tex_height == b.tex_height &&
+            a.palette_generation == b.palette_generation && a.texa.alpha0 == b.texa.alpha0 && a.texa.alpha1 == b.texa.alpha1 &&
+            a.texa.trans_black == b.texa.trans_black;
+}
+
+bool GraphicsSynthesizerThread::texture_is_stale(const TextureCacheEntry& entry)
+{
+    for (unsigned int i = 0; i < entry.pages.size(); i++)
+    {
+        if (page_stamps[entry.pages[i]] > entry.decode_stamp)
+            return true;
+    }
+    return false;
+}
+
+void GraphicsSynthesizerThread::decode_texture(TextureCacheEntry& entry)
+{
+    //Every GS block is at least 8x8 pixels and lies entirely within one page,
+    //so sampling every 8th pixel in each direction finds all pages of the texture
+    bool page_used[512] = {};
+    for (uint32_t v = 0; v < entry.tex_height; v += 8)
+    {
+        for (uint32_t u = 0; u < entry.tex_width; u += 8)
+            page_used[(pixel_addr(entry.format, entry.texture_base, entry.width, u, v) >> 13) & 0x1FF] = true;
+    }
+
+    entry.pages.clear();
+    for (uint16_t page = 0; page < 512; page++)
+    {
+        if (page_used[page])
+            entry.pages.push_back(page);
+    }
+
+    entry.texels.resize(entry.tex_width * entry.tex_height);
+
+    //Textures at least one block in size are a whole number of blocks, which are unswizzled in one go
+    uint32_t block_width, block_height;
+    switch (entry.format)
+    {
+        case 0x02:
+        case 0x0A:
+            block_width = 16;
+            block_height = 8;
+            break;
+        case 0x13:
+            block_width = 16;
+            block_height = 16;
+            break;
+        case 0x14:
+            block_width = 32;
+            block_height = 16;
+            break;
+        case 0x09:
+            block_width = 0;
+            block_height = 0;
+            break;
+        default:
+            block_width = 8;
+            block_height = 8;
+            break;
+    }
+
+    if (block_width && entry.tex_width >= block_width && entry.tex_height >= block_height)
+    {
+        for (uint32_t v = 0; v < entry.tex_height; v += block_height)
+        {
+            for (uint32_t u = 0; u < entry.tex_width; u += block_width)
+                decode_block(entry, u, v);
+        }
+    }
+    else
+    {
+        for (uint32_t v = 0; v < entry.tex_height; v++)
+        {
+            uint32_t* row = &entry.texels[v * entry.tex_width];
+            for (uint32_t u = 0; u < entry.tex_width; u++)
+                row[u] = read_texel(u, v);
+        }
+    }
+
+    entry.decode_stamp = write_epoch;
+    write_epoch++;
+}
+
+//Decodes the block whose top-left texel is (u, v) into the entry's texels
+void GraphicsSynthesizerThread::decode_block(TextureCacheEntry& entry, uint32_t u, uint32_t v)
+{
+    const uint8_t* block = &local_mem[pixel_addr(entry.format, entry.texture_base, entry.width, u, v)];
+    uint32_t pitch = entry.tex_width;
+    uint32_t* dest = &entry.texels[v * pitch + u];
+    uint8_t linear[256];
+    switch (entry.format)
+    {
+        case 0x00:
+            unswizzle_block_32(block, (uint8_t*)dest, pitch * 4);
+            break;
+        case 0x01:
+        case 0x31:
+            unswizzle_block_32(block, (uint8_t*)dest, pitch * 4);
+            for (int y = 0; y < 8; y++)
+            {
+                for (int x = 0; x < 8; x++)
+                    dest[y * pitch + x] = (dest[y * pitch + x] & 0x00FFFFFF) | (TEXA.alpha0 << 24);
+            }
+            break;
+        case 0x1B:
+        case 0x24:
+        case 0x2C:
+        {
+            int shift = (entry.format == 0x2C) ? 28 : 24;
+            uint32_t mask = (entry.format == 0x24) ? 0xF : 0xFF;
+            unswizzle_block_32(block, (uint8_t*)dest, pitch * 4);
+            for (int y = 0; y < 8; y++)
+            {
+                for (int x = 0; x < 8; x++)
+                    dest[y * pitch + x] = CLUT_palette[(dest[y * pitch + x] >> shift) & mask];
+            }
+        }
+            break;
+        case 0x02:
+        case 0x0A:
+        {
+            unswizzle_block_16(block, linear, 32);
+            const uint16_t* colors = (const uint16_t*)linear;
+            for (int y = 0; y < 8; y++)
+            {
+                for (int x = 0; x < 16; x++)
+                {
+                    uint16_t color = colors[y * 16 + x];
+                    if (entry.format == 0x02)
+                        dest[y * pitch + x] = expand_PSMCT16(color);
+                    else
+                        dest[y * pitch + x] = expand_PSMCT16S_texel(color);
+                }
             }
         }
             break;
+        case 0x13:
+            unswizzle_block_8(block, linear, 16);
+            for (int y = 0; y < 16; y++)
+            {
+                for (int x = 0; x < 16; x++)
+                    dest[y * pitch + x] = CLUT_palette[linear[y * 16 + x]];
+            }
+            break;
+        case 0x14:
+            unswizzle_block_4(block, linear, 16);
+            for (int y = 0; y < 16; y++)
+            {
+                for (int x = 0; x < 32; x++)
+                    dest[y * pitch + x] = CLUT_palette[(linear[y * 16 + (x >> 1)] >> ((x & 1) << 2)) & 0xF];
+            }
+            break;
         default:
-            Errors::die("[GS_t] Unrecognized CLUT format $%02X\n", current_ctx->tex0.CLUT_format);
+            Errors::die("[GS_t] Unrecognized texture format $%02X\n", entry.format);
     }
 }
 
-void GraphicsSynthesizerThread::clut_CSM2_lookup(uint8_t entry, RGBAQ_REG &tex_color)
+//Returns the decoded copy of the current context's texture, decoding it if necessary
+const uint32_t* GraphicsSynthesizerThread::get_texture()
 {
-    uint16_t color = read_PSMCT16_block(current_ctx->tex0.CLUT_base, TEXCLUT.width, TEXCLUT.x + entry, TEXCLUT.y);
-    tex_color.r = (color & 0x1F) << 3;
-    tex_color.g = ((color >> 5) & 0x1F) << 3;
-    tex_color.b = ((color >> 10) & 0x1F) << 3;
-    tex_color.a = (color & 0x8000) ? 0x80 : 0x00;
+    if (texture_uses_CLUT(current_ctx->tex0.format))
+        update_palette();
+
+    TextureCacheEntry key;
+    make_texture_key(key);
+    texcache_time++;
+
+    for (unsigned int i = 0; i < texture_cache.size(); i++)
+    {
+        TextureCacheEntry& entry = texture_cache[i];
+        if (!texture_key_matches(entry, key))
+            continue;
+        if (texture_is_stale(entry))
+            decode_texture(entry);
+        entry.last_used = texcache_time;
+        return entry.texels.data();
+    }
+
+    //Evict the least recently used textures until the new one fits
+    uint32_t texels = key.tex_width * key.tex_height;
+    while (texture_cache.size() && (texture_cache.size() >= MAX_CACHED_TEXTURES ||
+                                    texcache_texels + texels > MAX_CACHED_TEXELS))
+    {
+        unsigned int oldest = 0;
+        for (unsigned int i = 1; i < texture_cache.size(); i++)
+        {
+            if (texture_cache[i].last_used < texture_cache[oldest].last_used)
+                oldest = i;
+        }
+        texcache_texels -= texture_cache[oldest].texels.size();
+        texture_cache.erase(texture_cache.begin() + oldest);
+    }
+
+    texture_cache.push_back(key);
+    TextureCacheEntry& entry = texture_cache.back();
+    decode_texture(entry);
+    entry.last_used = texcache_time;
+    texcache_texels += texels;
+    return entry.texels.data();
 }
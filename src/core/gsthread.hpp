@@ -1,6 +1,7 @@
 #ifndef GSTHREAD_HPP
 #define GSTHREAD_HPP
 #include <cstdint>
+#include <vector>
 #include "gscontext.hpp"
 #include "gs.hpp"
 
@@ -70,6 +71,42 @@ struct TEXCLUT_REG
     uint16_t width, x, y;
 };
 
+//Linear RGBA32 copy of a texture, along with the state it was decoded from
+struct TextureCacheEntry
+{
+    uint32_t texture_base;
+    uint32_t width;
+    uint8_t format;
+    uint16_t tex_width, tex_height;
+    uint32_t palette_generation;
+    TEXA_REG texa;
+
+    uint32_t decode_stamp;
+    uint32_t last_used;
+    std::vector<uint16_t> pages;
+    std::vector<uint32_t> texels;
+};
+
+//Smallest Z value stored in a block of local memory, in the Z format it was read as
+struct DepthBlock
+{
+    bool valid;
+    uint8_t format;
+    uint32_t min_z;
+};
+
+//The display state and framebuffer pages that a CRT output buffer was last filled from
+struct CRTOutput
+{
+    uint32_t* target;
+    uint32_t stamp;
+    PMODE_REG PMODE;
+    SMODE SMODE2;
+    DISPFB dispfb;
+    DISPLAY display;
+    std::vector<uint16_t> pages;
+};
+
 struct Vertex
 {
     int32_t x, y, z;
@@ -89,6 +126,7 @@ class GraphicsSynthesizerThread
     private:
         bool frame_complete;
         int frame_count;
+        uint32_t primitive_count;//primitives drawn since the last CRT output
         uint8_t* local_mem;
         uint8_t CRT_mode;
 
@@ -106,6 +144,7 @@ class GraphicsSynthesizerThread
         TEXA_REG TEXA;
         TEXCLUT_REG TEXCLUT;
         bool DTHE;
+        int8_t DIMX[4][4];
         bool COLCLAMP;
         bool use_PRIM;
 
@@ -116,6 +155,13 @@ class GraphicsSynthesizerThread
         uint8_t BUSDIR;
         int pixels_transferred;
 
+        //Pixel values of a local-to-local transfer, held while the source is read
+        std::vector<uint32_t> transfer_buffer;
+
+        //Per-column and per-row texture coordinates of the current sprite, and its colors for direct writes
+        std::vector<uint16_t> sprite_u, sprite_v;
+        std::vector<uint32_t> sprite_buffer;
+
         //Used for unpacking PSMCT24
         uint32_t PSMCT24_color;
         int PSMCT24_unpacked_count;
@@ -128,6 +174,48 @@ class GraphicsSynthesizerThread
 
         static const unsigned int max_vertices[8];
 
+        //CLUT buffer and the RGBA32 palette expanded from it
+        uint16_t CLUT_buffer[512];
+        uint32_t CBP0, CBP1;
+        uint32_t CLUT_palette[256];
+        bool CLUT_palette_dirty;
+        uint8_t palette_format;
+        uint16_t palette_offset;
+        TEXA_REG palette_TEXA;
+        uint32_t palette_generation;
+
+        //Texture cache
+        static const unsigned int MAX_CACHED_TEXTURES = 64;
+        static const unsigned int MAX_CACHED_TEXELS = 1024 * 1024 * 8;
+        std::vector<TextureCacheEntry> texture_cache;
+        uint32_t texcache_texels;
+        uint32_t texcache_time;
+        const uint32_t* current_texture;
+
+        //Page write tracking, shared by the texture cache and CRT output
+        uint32_t write_epoch;
+        uint32_t page_stamps[512];
+
+        //Minimum Z of each 256-byte block, used to reject quads before they are shaded
+        DepthBlock depth_blocks[16384];
+        bool depth_block_rejects(int32_t x, int32_t y, uint32_t max_z);
+
+        //CRT output
+        CRTOutput CRT_outputs[2];
+        std::vector<uint32_t> CRT_columns;
+        std::vector<uint32_t> CRT_band;
+        bool CRT_output_current(const CRTOutput& output, uint32_t* target, const DISPFB& fb, const DISPLAY& display);
+        void decode_CRT_band(const DISPFB& fb, uint32_t y, bool* page_used);
+
+        void stamp_page(uint32_t addr);
+        uint32_t pixel_addr(uint8_t format, uint32_t base, uint32_t width, uint32_t x, uint32_t y);
+        void make_texture_key(TextureCacheEntry& key);
+        bool texture_key_matches(const TextureCacheEntry& a, const TextureCacheEntry& b);
+        bool texture_is_stale(const TextureCacheEntry& entry);
+        void decode_texture(TextureCacheEntry& entry);
+        void decode_block(TextureCacheEntry& entry, uint32_t u, uint32_t v);
+        const uint32_t* get_texture();
+
         uint32_t get_word(uint32_t addr);
         void set_word(uint32_t addr, uint32_t value);
 
@@ -169,27 +257,48 @@ class GraphicsSynthesizerThread
         void write_PSMCT8_block(uint32_t base, uint32_t width, uint32_t x, uint32_t y, uint8_t value);
         void write_PSMCT4_block(uint32_t base, uint32_t width, uint32_t x, uint32_t y, uint8_t value);
 
-        bool depth_test(int32_t x, int32_t y, uint32_t z);
-
+        uint16_t clamp_u(uint16_t u);
+        uint16_t clamp_v(uint16_t v);
         void tex_lookup(uint16_t u, uint16_t v, const RGBAQ_REG& vtx_color, RGBAQ_REG& tex_color);
-        void clut_lookup(uint8_t entry, RGBAQ_REG& tex_color, bool eight_bit);
-        void clut_CSM2_lookup(uint8_t entry, RGBAQ_REG& tex_color);
+        uint32_t read_texel(uint16_t u, uint16_t v);
+        uint32_t expand_PSMCT16S_texel(uint16_t color);
+        void load_CLUT(const TEX0& tex0);
+        void update_palette();
         void vertex_kick(bool drawing_kick);
         void draw_pixel(int32_t x, int32_t y, uint32_t z, RGBAQ_REG& color, bool alpha_blending);
+        void draw_quad(int32_t x, int32_t y, uint8_t coverage, const uint32_t* z, const RGBAQ_REG* colors,
+                       bool alpha_blending);
         void render_primitive();
         void render_point();
         void render_line();
         void render_triangle();
         void render_sprite();
+        bool draw_sprite_direct(int32_t x, int32_t y, uint32_t width, uint32_t height, uint32_t z,
+                                const RGBAQ_REG& vtx_color);
+        void write_sprite_rect(uint8_t format, uint32_t base, uint32_t width, uint32_t x, uint32_t y,
+                               uint32_t rect_width, uint32_t rect_height, const uint32_t* values, uint32_t pitch,
+                               uint32_t keep_mask);
         void write_HWREG(uint64_t data);
+        void write_HWREG_image(const uint64_t* data, uint32_t count);
+        void write_HWREG_band(const uint8_t* data, int bpp, uint32_t block_width, uint32_t block_height);
+        void write_HWREG_pixel(uint32_t x, uint32_t y, uint32_t value);
+        uint32_t read_PSM_pixel(uint8_t format, uint32_t base, uint32_t width, uint32_t x, uint32_t y);
+        void write_PSM_pixel(uint8_t format, uint32_t base, uint32_t width, uint32_t x, uint32_t y, uint32_t value);
+        void end_HWREG_transfer();
         void unpack_PSMCT24(uint64_t data, int offset, bool z_format);
         void host_to_host();
+        bool copy_local_blocks();
+        void read_local_rect(uint32_t* values);
+        void write_local_rect();
+        uint32_t local_to_host(uint128_t* target, uint32_t capacity);
 
         int32_t orient2D(const Vertex &v1, const Vertex &v2, const Vertex &v3);
 
         //called from event loop
         void reset();
         void memdump();
+        void load_state(std::istream& state);
+        void save_state(std::ostream& state);
         void render_CRT(uint32_t* target);
 
         void set_VBLANK(bool is_VBLANK);
@@ -221,4 +330,12 @@ inline void GraphicsSynthesizerThread::set_word(uint32_t addr, uint32_t value)
     *(uint32_t*)&local_mem[addr] = value;
 }
 
+//Records a write to the 8 KB page containing addr so that anything derived from it is regenerated
+//The Z range of the written block is dropped as well
+inline void GraphicsSynthesizerThread::stamp_page(uint32_t addr)
+{
+    page_stamps[(addr >> 13) & 0x1FF] = write_epoch;
+    depth_blocks[(addr >> 8) & 0x3FFF].valid = false;
+}
+
 #endif // GSTHREAD_HPP
@@ -1,6 +1,11 @@
+#include <algorithm>
+#include <cctype>
 #include <cstring>
+#include <vector>
 #include "../emulator.hpp"
 #include "cdvd.hpp"
+#include "cso_reader.hpp"
+#include "iso_reader.hpp"
 #include "../errors.hpp"
 
 using namespace std;
@@ -9,6 +14,8 @@ using namespace std;
 static uint64_t IOP_CLOCK = 36864000;
 static const int PSX_CD_READSPEED = 153600;
 static const int PSX_DVD_READSPEED = 1382400;
+//How many sectors the drive reads ahead of the DMA before it waits
+static const uint32_t READ_BUFFER_SECTORS = 16;
 
 uint32_t CDVD_Drive::get_block_timing(bool mode_DVD)
 {
@@ -18,13 +25,13 @@ uint32_t CDVD_Drive::get_block_timing(bool mode_DVD)
 
 CDVD_Drive::CDVD_Drive(Emulator* e) : e(e)
 {
-
+    container = nullptr;
+    logical_block_size = 2048;
 }
 
 CDVD_Drive::~CDVD_Drive()
 {
-    if (cdvd_file.is_open())
-        cdvd_file.close();
+    delete container;
 }
 
 void CDVD_Drive::reset()
@@ -45,6 +52,8 @@ void CDVD_Drive::reset()
     S_status = 0x40;
     S_out_params = 0;
     read_bytes_left = 0;
+    buffered_sectors = 0;
+    buffer_start = 0;
     ISTAT = 0;
     file_size = 0;
 }
@@ -56,30 +65,47 @@ int CDVD_Drive::get_block_size()
 
 int CDVD_Drive::bytes_left()
 {
-    return read_bytes_left;
+    return read_bytes_left + buffered_sectors * block_size;
 }
 
+/**
+  * Transfers every buffered sector that fits in bytes in one go.
+  * The command completes once the last sector of the read has been transferred.
+  **/
 uint32_t CDVD_Drive::read_to_RAM(uint8_t *RAM, uint32_t bytes)
 {
-    memcpy(RAM, read_buffer, block_size);
-    read_bytes_left -= block_size;
-    if (read_bytes_left <= 0)
+    uint32_t transferred;
+    if (read_bytes_left > 0)
     {
-        if (sectors_left == 0)
-        {
-            N_status = 0x4E;
-            ISTAT |= 0x3;
-            e->iop_request_IRQ(2);
-            drive_status = PAUSED;
-            active_N_command = NCOMMAND::NONE;
-        }
-        else
+        //The TOC is built in read_buffer
+        memcpy(RAM, read_buffer, block_size);
+        read_bytes_left = 0;
+        transferred = block_size;
+    }
+    else
+    {
+        uint32_t count = min(buffered_sectors, max(bytes / block_size, 1U));
+        for (uint32_t i = 0; i < count; i++)
         {
-            active_N_command = NCOMMAND::READ;
-            N_cycles_left = get_block_timing(N_command != 0x06);
+            if (N_command == 0x06)
+                copy_sector_data(RAM + i * block_size, buffer_start + i);
+            else
+                copy_DVD_sector(RAM + i * block_size, buffer_start + i);
         }
+        buffer_start += count;
+        buffered_sectors -= count;
+        transferred = count * block_size;
     }
-    return block_size;
+
+    if (!buffered_sectors && !sectors_left)
+    {
+        N_status = 0x4E;
+        ISTAT |= 0x3;
+        e->iop_request_IRQ(2);
+        drive_status = PAUSED;
+        active_N_command = NCOMMAND::NONE;
+    }
+    return transferred;
 }
 
 void CDVD_Drive::update(int cycles)
@@ -108,13 +134,10 @@ void CDVD_Drive::update(int cycles)
                     e->iop_request_IRQ(2);
                     break;
                 case NCOMMAND::READ:
-                    if (!read_bytes_left)
-                    {
-                        if (N_command == 0x06)
-                            read_CD_sector();
-                        else if (N_command == 0x08)
-                            read_DVD_sector();
-                    }
+                    if (!sectors_left)
+                        break;
+                    if (buffered_sectors < READ_BUFFER_SECTORS)
+                        buffer_sector();
                     else
                         N_cycles_left = 1000; //Check later to see if there's space in the buffer
                     break;
@@ -140,85 +163,140 @@ void CDVD_Drive::update(int cycles)
 
 bool CDVD_Drive::load_disc(const char *name)
 {
-    if (cdvd_file.is_open())
-        cdvd_file.close();
-
-    cdvd_file.open(name, ios::in | ios::binary | ifstream::ate);
-    if (!cdvd_file.is_open())
+    delete container;
+    string format = name;
+    format = format.length() >= 4 ? format.substr(format.length() - 4) : "";
+    transform(format.begin(), format.end(), format.begin(), ::tolower);
+    if (format == ".cso")
+        container = new CSO_Reader();
+    else
+        container = new ISO_Reader();
+    if (!container->open(name))
+    {
+        delete container;
+        container = nullptr;
         return false;
+    }
 
-    file_size = cdvd_file.tellg();
+    file_size = container->get_size();
+    file_index.clear();
 
     printf("[CDVD] Disc size: %lld bytes\n", file_size);
     printf("[CDVD] Locating Primary Volume Descriptor\n");
-    uint8_t type = 0;
-    int sector = 0x0F;
-    while (type != 1)
+
+    //Volume descriptors start at sector 16 and end with a terminator
+    uint8_t pvd_sector[2048];
+    uint32_t sector = 16;
+    while (true)
     {
+        if (container->read(pvd_sector, (uint64_t)sector * 2048, 2048) != 2048 || memcmp(pvd_sector + 1, "CD001", 5))
+            return false;
+        if (pvd_sector[0] == 1)
+            break;
+        if (pvd_sector[0] == 0xFF)
+            return false;
         sector++;
-        cdvd_file.seekg(sector * 2048);
-        cdvd_file >> type;
     }
     printf("[CDVD] Primary Volume Descriptor found at sector %d\n", sector);
 
-    cdvd_file.seekg(sector * 2048);
-    cdvd_file.read((char*)pvd_sector, 2048);
-
-    LBA = *(uint16_t*)&pvd_sector[128];
-    printf("[CDVD] PVD LBA: $%08X\n", LBA);
+    logical_block_size = *(uint16_t*)&pvd_sector[128];
+    if (!logical_block_size)
+        logical_block_size = 2048;
+    printf("[CDVD] Logical block size: $%04X\n", logical_block_size);
 
-    root_location = *(uint32_t*)&pvd_sector[156 + 2] * LBA;
-    root_len = *(uint32_t*)&pvd_sector[156 + 10];
-    printf("[CDVD] Root dir len: %d\n", *(uint16_t*)&pvd_sector[156]);
-    printf("[CDVD] Extent loc: $%08X\n", root_location);
-    printf("[CDVD] Extent len: $%08X\n", root_len);
+    uint32_t root_LBA = *(uint32_t*)&pvd_sector[156 + 2];
+    uint32_t root_len = *(uint32_t*)&pvd_sector[156 + 10];
+    printf("[CDVD] Root extent: $%08X, length $%08X\n", root_LBA, root_len);
+    index_directory(root_LBA, root_len, "", 0);
+    printf("[CDVD] Indexed %d files\n", (int)file_index.size());
     return true;
 }
 
-uint8_t* CDVD_Drive::read_file(string name, uint32_t& file_size)
+/**
+  * Paths are stored upper case, with '/' between components, without a leading separator and without the ";1"
+  * version suffix. Names from SYSTEM.CNF ("cdrom0:\DATA\MAIN.ELF;1") and plain names ("SYSTEM.CNF") both map to the
+  * same key.
+  **/
+string CDVD_Drive::normalize_path(const string& path)
 {
-    uint8_t* root_extent = new uint8_t[root_len];
-    cdvd_file.seekg(root_location);
-    cdvd_file.read((char*)root_extent, root_len);
-    uint32_t bytes = 0;
-    uint32_t file_location = 0;
-    uint8_t* file;
-    file_size = 0;
-    printf("[CDVD] Finding %s...\n", name.c_str());
-    while (bytes < root_len)
+    string key;
+    size_t start = path.find(':');
+    start = (start == string::npos) ? 0 : start + 1;
+    for (size_t i = start; i < path.length() && path[i] != ';'; i++)
     {
-        int directory_len = root_extent[bytes + 32];
-        if (name.length() == directory_len)
+        char c = path[i];
+        if (c == '\\')
+            c = '/';
+        if (c == '/' && (key.empty() || key.back() == '/'))
+            continue;
+        key += toupper(c);
+    }
+
+    //Names without an extension are recorded as "NAME."
+    if (key.length() && key.back() == '.')
+        key.pop_back();
+    return key;
+}
+
+void CDVD_Drive::index_directory(uint32_t LBA, uint32_t len, const string& prefix, int depth)
+{
+    //ISO9660 allows eight levels; the limit also stops a corrupt image from recursing forever
+    if (depth > 8)
+        return;
+
+    vector<uint8_t> extent(len);
+    len = container->read(extent.data(), (uint64_t)LBA * logical_block_size, len);
+
+    uint32_t pos = 0;
+    while (pos + 33 < len)
+    {
+        uint8_t record_len = extent[pos];
+
+        //Records don't cross sectors; the rest of the sector is zero padding
+        if (!record_len)
         {
-            bool match = true;
-            for (int i = 0; i < directory_len; i++)
-            {
-                if (name[i] != root_extent[bytes + 33 + i])
-                {
-                    match = false;
-                    break;
-                }
-            }
-            if (match)
-            {
-                printf("[CDVD] Match found!\n");
-                file_location = *(uint32_t*)&root_extent[bytes + 2] * LBA;
-                file_size = *(uint32_t*)&root_extent[bytes + 10];
-                printf("[CDVD] Location: $%08X\n", file_location);
-                printf("[CDVD] Size: $%08X\n", file_size);
-
-                file = new uint8_t[file_size];
-                cdvd_file.seekg(file_location);
-                cdvd_file.read((char*)file, file_size);
-                delete[] root_extent;
-                return file;
-            }
+            pos = (pos / 2048 + 1) * 2048;
+            continue;
         }
-        //Increment bytes by size of directory record
-        bytes += root_extent[bytes];
+        if (pos + record_len > len)
+            break;
+
+        uint32_t entry_LBA = *(uint32_t*)&extent[pos + 2];
+        uint32_t entry_size = *(uint32_t*)&extent[pos + 10];
+        uint8_t flags = extent[pos + 25];
+        uint8_t name_len = extent[pos + 32];
+        if (33 + name_len > record_len)
+            break;
+        string name((char*)&extent[pos + 33], name_len);
+        pos += record_len;
+
+        //Skip the "." and ".." entries
+        if (name_len == 1 && (name[0] == 0 || name[0] == 1))
+            continue;
+
+        string path = normalize_path(prefix + name);
+        if (flags & 0x2)
+            index_directory(entry_LBA, entry_size, path + "/", depth + 1);
+        else if (!file_index.count(path))
+            file_index[path] = { entry_LBA, entry_size };
     }
-    delete[] root_extent;
-    return nullptr;
+}
+
+uint8_t* CDVD_Drive::read_file(string name, uint32_t& file_size)
+{
+    file_size = 0;
+    printf("[CDVD] Finding %s...\n", name.c_str());
+    auto entry = file_index.find(normalize_path(name));
+    if (entry == file_index.end())
+        return nullptr;
+
+    file_size = entry->second.size;
+    printf("[CDVD] Location: $%08X\n", entry->second.LBA);
+    printf("[CDVD] Size: $%08X\n", file_size);
+
+    uint8_t* file = new uint8_t[file_size];
+    container->read(file, (uint64_t)entry->second.LBA * logical_block_size, file_size);
+    return file;
 }
 
 uint8_t CDVD_Drive::read_N_command()
@@ -455,6 +533,8 @@ void CDVD_Drive::prepare_S_outdata(int amount)
 
 void CDVD_Drive::start_seek()
 {
+    //Whatever the drive had buffered belongs to the previous command
+    buffered_sectors = 0;
     N_status = 0;
     is_reading = false;
     drive_status = PAUSED;
@@ -495,8 +575,9 @@ void CDVD_Drive::start_seek()
         //N_cycles_left = 10000;
     }
 
-    //Seek anyway. The program won't know the difference
-    cdvd_file.seekg(sector_pos * 2048);
+    //Let the container start fetching the sectors while the drive seeks
+    if (container)
+        container->prefetch(sector_pos, sectors_left);
 }
 
 void CDVD_Drive::N_command_read()
@@ -543,39 +624,48 @@ void CDVD_Drive::N_command_gettoc()
     drive_status = READING;
 }
 
-void CDVD_Drive::read_CD_sector()
+/**
+  * Sectors aren't copied anywhere when the drive reads them. The drive only counts them into its buffer, and the
+  * DMA copies them straight from the disc image into IOP RAM once it drains them.
+  **/
+void CDVD_Drive::buffer_sector()
 {
-    printf("[CDVD] Read CD sector - Sector: %d Size: %d\n", current_sector, block_size);
-    cdvd_file.read((char*)read_buffer, block_size);
-    read_bytes_left = block_size;
+    printf("[CDVD] Read %s sector - Sector: %d Size: %d\n", N_command == 0x06 ? "CD" : "DVD", current_sector, block_size);
+    if (!buffered_sectors)
+        buffer_start = current_sector;
+    buffered_sectors++;
+    if (container)
+        container->prefetch(current_sector, sectors_left);
     current_sector++;
     sectors_left--;
+
+    //Keep reading at the drive's speed while there's room in the buffer
+    if (sectors_left)
+        N_cycles_left = get_block_timing(N_command != 0x06);
 }
 
-void CDVD_Drive::read_DVD_sector()
-{
-    printf("[CDVD] Read DVD sector - Sector: %d Size: %d\n", current_sector, block_size);
-    uint32_t lsn = current_sector + 0x30000;
-    read_buffer[0] = 0x20;
-    read_buffer[1] = (lsn >> 16) & 0xFF;
-    read_buffer[2] = (lsn >> 8) & 0xFF;
-    read_buffer[3] = lsn & 0xFF;
-    read_buffer[4] = 0;
-    read_buffer[5] = 0;
-    read_buffer[6] = 0;
-    read_buffer[7] = 0;
-    read_buffer[8] = 0;
-    read_buffer[9] = 0;
-    read_buffer[10] = 0;
-    read_buffer[11] = 0;
-    cdvd_file.read((char*)&read_buffer[12], 2048);
-    read_buffer[2060] = 0;
-    read_buffer[2061] = 0;
-    read_buffer[2062] = 0;
-    read_buffer[2063] = 0;
-    read_bytes_left = 2064;
-    current_sector++;
-    sectors_left--;
+void CDVD_Drive::copy_sector_data(uint8_t* dest, uint32_t sector)
+{
+    uint64_t copied = 0;
+    if (container)
+        copied = container->read(dest, (uint64_t)sector * CDVD_Container::SECTOR_SIZE, CDVD_Container::SECTOR_SIZE);
+
+    //Reads past the end of the image return zeroes
+    if (copied < CDVD_Container::SECTOR_SIZE)
+        memset(dest + copied, 0, CDVD_Container::SECTOR_SIZE - copied);
+}
+
+//DVD sectors are 2064 bytes: a 12-byte header with the LSN, the data, and 4 bytes of EDC
+void CDVD_Drive::copy_DVD_sector(uint8_t* dest, uint32_t sector)
+{
+    uint32_t lsn = sector + 0x30000;
+    memset(dest, 0, 12);
+    dest[0] = 0x20;
+    dest[1] = (lsn >> 16) & 0xFF;
+    dest[2] = (lsn >> 8) & 0xFF;
+    dest[3] = lsn & 0xFF;
+    copy_sector_data(dest + 12, sector);
+    memset(dest + 2060, 0, 4);
 }
 
 void CDVD_Drive::S_command_sub(uint8_t func)
@@ -1,6 +1,10 @@
 #ifndef CDVD_HPP
 #define CDVD_HPP
 #include <fstream>
+#include <string>
+#include <unordered_map>
+
+#include "cdvd_container.hpp"
 
 class Emulator;
 
@@ -23,27 +27,36 @@ enum class NCOMMAND
     BREAK
 };
 
+struct ISO_File
+{
+    uint32_t LBA;
+    uint32_t size;
+};
+
 class CDVD_Drive
 {
     private:
         uint64_t last_read;
         uint64_t cycle_count;
         Emulator* e;
-        std::ifstream cdvd_file;
+        CDVD_Container* container;
         uint64_t file_size;
         int read_bytes_left;
         int speed;
 
-        uint8_t pvd_sector[2048];
-        uint16_t LBA;
-        uint32_t root_location;
-        uint32_t root_len;
+        //Built from the directory tree when the disc is loaded; keys come from normalize_path
+        std::unordered_map<std::string, ISO_File> file_index;
+        uint16_t logical_block_size;
 
         uint32_t current_sector;
         uint32_t sector_pos;
         uint32_t sectors_left;
         uint32_t block_size;
 
+        //Sectors the drive has read that the DMA hasn't transferred yet, starting at buffer_start
+        uint32_t buffered_sectors;
+        uint32_t buffer_start;
+        //Only holds the TOC; sector data goes straight from the disc image to IOP RAM
         uint8_t read_buffer[4096];
 
         uint8_t ISTAT;
@@ -68,11 +81,15 @@ class CDVD_Drive
 
         uint32_t get_block_timing(bool mode_DVD);
 
+        static std::string normalize_path(const std::string& path);
+        void index_directory(uint32_t LBA, uint32_t len, const std::string& prefix, int depth);
+
         void start_seek();
         void prepare_S_outdata(int amount);
 
-        void read_CD_sector();
-        void read_DVD_sector();
+        void buffer_sector();
+        void copy_sector_data(uint8_t* dest, uint32_t sector);
+        void copy_DVD_sector(uint8_t* dest, uint32_t sector);
 
         void N_command_read();
         void N_command_dvdread();
@@ -83,6 +100,8 @@ class CDVD_Drive
         ~CDVD_Drive();
 
         void reset();
+        void load_state(std::ifstream& state);
+        void save_state(std::ofstream& state);
         void update(int cycles);
         int get_block_size();
         int bytes_left();
@@ -0,0 +1,28 @@
+#ifndef CDVD_CONTAINER_HPP
+#define CDVD_CONTAINER_HPP
+#include <cstdint>
+#include <string>
+
+/**
+  * A disc image, as seen by the drive: a flat array of 2048-byte sectors.
+  * prefetch tells the container which sectors the drive is going to read next, so that it can get them ready off the
+  * emulation thread. Containers that can't do anything useful with it ignore it.
+  **/
+class CDVD_Container
+{
+    public:
+        static const uint32_t SECTOR_SIZE = 2048;
+
+        virtual ~CDVD_Container() {}
+
+        virtual bool open(const std::string& name) = 0;
+        virtual void close() = 0;
+        virtual bool is_open() = 0;
+        virtual uint64_t get_size() = 0;
+
+        //Returns the number of bytes copied, which is less than bytes past the end of the image
+        virtual uint64_t read(uint8_t* dest, uint64_t offset, uint64_t bytes) = 0;
+        virtual void prefetch(uint32_t /*sector*/, uint32_t /*count*/) {}
+};
+
+#endif // CDVD_CONTAINER_HPP
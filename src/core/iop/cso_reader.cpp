@@ -0,0 +1,267 @@
+#include <algorithm>
+#include <cstring>
+#include <zlib.h>
+#include "cso_reader.hpp"
+#include "../errors.hpp"
+
+using namespace std;
+
+const uint32_t CSO_Reader::DEFAULT_CACHE_MB;
+const uint32_t CSO_Reader::READ_AHEAD_SECTORS;
+
+struct CSO_Header
+{
+    char magic[4];
+    uint32_t header_size;
+    uint64_t total_bytes;
+    uint32_t block_size;
+    uint8_t version;
+    uint8_t index_shift;
+    uint8_t reserved[2];
+};
+
+CSO_Reader::CSO_Reader(uint32_t cache_MB)
+{
+    cache_bytes = (uint64_t)cache_MB * 1024 * 1024;
+    size = 0;
+    block_size = 0;
+    index_shift = 0;
+    max_cached_blocks = 0;
+    worker_stop = false;
+    worker_block = -1;
+    worker_sector = 0;
+    worker_pos = 0;
+    worker_end = 0;
+}
+
+CSO_Reader::~CSO_Reader()
+{
+    close();
+}
+
+bool CSO_Reader::open(const string& name)
+{
+    close();
+    file.open(name, ios::in | ios::binary);
+    if (!file.is_open())
+        return false;
+
+    CSO_Header header;
+    file.read((char*)&header, sizeof(header));
+    //Version 2 images store LZ4 blocks, which aren't supported
+    if (!file || strncmp(header.magic, "CISO", 4) || header.version > 1 || !header.block_size ||
+            header.block_size % SECTOR_SIZE || !header.total_bytes)
+    {
+        close();
+        return false;
+    }
+
+    size = header.total_bytes;
+    block_size = header.block_size;
+    index_shift = header.index_shift;
+
+    //The extra entry gives the end of the last block
+    uint64_t blocks = (size + block_size - 1) / block_size;
+    index.resize(blocks + 1);
+    file.read((char*)index.data(), index.size() * sizeof(uint32_t));
+    if (!file)
+    {
+        close();
+        return false;
+    }
+
+    //Always leave room for the read-ahead window, however small the cache is
+    uint64_t window_blocks = (uint64_t)READ_AHEAD_SECTORS * SECTOR_SIZE / block_size + 2;
+    max_cached_blocks = max(cache_bytes / block_size, window_blocks);
+
+    worker_stop = false;
+    worker_block = -1;
+    worker_sector = 0;
+    worker_pos = 0;
+    worker_end = 0;
+    worker_thread = thread(&CSO_Reader::worker_loop, this);
+    return true;
+}
+
+void CSO_Reader::close()
+{
+    if (worker_thread.joinable())
+    {
+        {
+            lock_guard<mutex> lock(cache_mutex);
+            worker_stop = true;
+        }
+        worker_cv.notify_one();
+        worker_thread.join();
+    }
+    if (file.is_open())
+        file.close();
+    index.clear();
+    cache.clear();
+    lru.clear();
+    size = 0;
+}
+
+bool CSO_Reader::is_open()
+{
+    return file.is_open();
+}
+
+uint64_t CSO_Reader::get_size()
+{
+    return size;
+}
+
+bool CSO_Reader::decompress_block(uint32_t block, vector<uint8_t>& dest)
+{
+    bool plain = index[block] & 0x80000000;
+    uint64_t start = (uint64_t)(index[block] & 0x7FFFFFFF) << index_shift;
+    uint64_t end = (uint64_t)(index[block + 1] & 0x7FFFFFFF) << index_shift;
+    if (end < start)
+        return false;
+
+    //Compressed blocks can be padded out to the index alignment, so raw blocks are read at exactly block_size
+    vector<uint8_t> src(plain ? block_size : end - start);
+    {
+        lock_guard<mutex> lock(file_mutex);
+        file.clear();
+        file.seekg(start);
+        file.read((char*)src.data(), src.size());
+        //The last block of an image can be short
+        if (file.gcount() <= 0)
+            return false;
+        src.resize(file.gcount());
+    }
+
+    dest.resize(block_size);
+    if (plain)
+    {
+        memcpy(dest.data(), src.data(), src.size());
+        memset(dest.data() + src.size(), 0, block_size - src.size());
+        return true;
+    }
+
+    //Blocks are raw deflate streams with no zlib header
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, -15) != Z_OK)
+        return false;
+    stream.next_in = src.data();
+    stream.avail_in = src.size();
+    stream.next_out = dest.data();
+    stream.avail_out = block_size;
+    int status = inflate(&stream, Z_FINISH);
+    inflateEnd(&stream);
+    if (status != Z_STREAM_END && status != Z_BUF_ERROR)
+        return false;
+    memset(dest.data() + block_size - stream.avail_out, 0, stream.avail_out);
+    return true;
+}
+
+//cache_mutex must be held
+void CSO_Reader::insert_block(uint32_t block, vector<uint8_t>& data)
+{
+    if (cache.count(block))
+        return;
+    while (cache.size() >= max_cached_blocks)
+    {
+        cache.erase(lru.back());
+        lru.pop_back();
+    }
+    lru.push_front(block);
+    Block& entry = cache[block];
+    entry.data.swap(data);
+    entry.lru_pos = lru.begin();
+}
+
+void CSO_Reader::read_block(uint32_t block, uint8_t* dest, uint32_t offset, uint32_t bytes)
+{
+    unique_lock<mutex> lock(cache_mutex);
+    //No point decompressing the block twice if the worker is already on it
+    block_ready.wait(lock, [this, block] { return worker_block != block; });
+
+    auto entry = cache.find(block);
+    if (entry == cache.end())
+    {
+        lock.unlock();
+        vector<uint8_t> data;
+        if (!decompress_block(block, data))
+            Errors::die("[CDVD] Failed to decompress CSO block %d\n", block);
+        lock.lock();
+        insert_block(block, data);
+        entry = cache.find(block);
+    }
+    else
+        lru.splice(lru.begin(), lru, entry->second.lru_pos);
+    memcpy(dest, entry->second.data.data() + offset, bytes);
+}
+
+uint64_t CSO_Reader::read(uint8_t* dest, uint64_t offset, uint64_t bytes)
+{
+    if (offset >= size)
+        return 0;
+    bytes = min(bytes, size - offset);
+
+    uint64_t copied = 0;
+    while (copied < bytes)
+    {
+        uint64_t pos = offset + copied;
+        uint32_t block = pos / block_size;
+        uint32_t block_offset = pos % block_size;
+        uint32_t count = min((uint64_t)(block_size - block_offset), bytes - copied);
+        read_block(block, dest + copied, block_offset, count);
+        copied += count;
+    }
+    return bytes;
+}
+
+/**
+  * Works the same way as the ISO_Reader window, in blocks rather than sectors: it only moves forward while reads are
+  * sequential, and a read anywhere else restarts it.
+  **/
+void CSO_Reader::prefetch(uint32_t sector, uint32_t count)
+{
+    uint64_t end_byte = min((uint64_t)(sector + min(count, READ_AHEAD_SECTORS)) * SECTOR_SIZE, size);
+    uint32_t first = (uint64_t)sector * SECTOR_SIZE / block_size;
+    uint32_t end = (end_byte + block_size - 1) / block_size;
+
+    lock_guard<mutex> lock(cache_mutex);
+    bool sequential = sector >= worker_sector && first <= worker_end;
+    worker_sector = sector;
+    if (sequential)
+    {
+        worker_pos = max(worker_pos, first);
+        if (end <= worker_end)
+            return;
+    }
+    else
+        worker_pos = first;
+    worker_end = end;
+    worker_cv.notify_one();
+}
+
+void CSO_Reader::worker_loop()
+{
+    vector<uint8_t> data;
+    unique_lock<mutex> lock(cache_mutex);
+    while (true)
+    {
+        worker_cv.wait(lock, [this] { return worker_stop || worker_pos < worker_end; });
+        if (worker_stop)
+            return;
+
+        uint32_t block = worker_pos++;
+        if (cache.count(block))
+            continue;
+
+        worker_block = block;
+        lock.unlock();
+        bool ok = decompress_block(block, data);
+        lock.lock();
+        //A bad block is left for the reader to fail on, where the error can be reported
+        if (ok)
+            insert_block(block, data);
+        worker_block = -1;
+        block_ready.notify_all();
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef CSO_READER_HPP
+#define CSO_READER_HPP
+#include <condition_variable>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "cdvd_container.hpp"
+
+/**
+  * CSO (compressed ISO) images. The image is split into fixed-size blocks, each stored either raw or deflated, and
+  * an index after the header gives the file offset of every block.
+  * Decompressed blocks are kept in an LRU cache. While the drive reads sequentially, a worker thread decompresses
+  * the blocks ahead of it, so that a sector read is normally a copy out of the cache.
+  **/
+class CSO_Reader : public CDVD_Container
+{
+    private:
+        struct Block
+        {
+            std::vector<uint8_t> data;
+            std::list<uint32_t>::iterator lru_pos;
+        };
+
+        std::ifstream file;
+        std::mutex file_mutex;
+        uint64_t size;
+        uint32_t block_size;
+        uint8_t index_shift;
+        std::vector<uint32_t> index;
+
+        //Most recently used blocks are at the front of lru
+        std::mutex cache_mutex;
+        std::condition_variable block_ready;
+        std::unordered_map<uint32_t, Block> cache;
+        std::list<uint32_t> lru;
+        uint64_t cache_bytes;
+        size_t max_cached_blocks;
+
+        std::thread worker_thread;
+        std::condition_variable worker_cv;
+        bool worker_stop;
+        //The block the worker is decompressing, or -1
+        int64_t worker_block;
+        //The drive last asked for worker_sector; blocks [worker_pos, worker_end) still have to be decompressed
+        uint32_t worker_sector;
+        uint32_t worker_pos, worker_end;
+
+        bool decompress_block(uint32_t block, std::vector<uint8_t>& dest);
+        void insert_block(uint32_t block, std::vector<uint8_t>& data);
+        void read_block(uint32_t block, uint8_t* dest, uint32_t offset, uint32_t bytes);
+        void worker_loop();
+    public:
+        static const uint32_t DEFAULT_CACHE_MB = 32;
+        //How far ahead of the drive the worker decompresses
+        static const uint32_t READ_AHEAD_SECTORS = 512;
+
+        CSO_Reader(uint32_t cache_MB = DEFAULT_CACHE_MB);
+        ~CSO_Reader();
+
+        bool open(const std::string& name) override;
+        void close() override;
+        bool is_open() override;
+        uint64_t get_size() override;
+
+        uint64_t read(uint8_t* dest, uint64_t offset, uint64_t bytes) override;
+        void prefetch(uint32_t sector, uint32_t count) override;
+};
+
+#endif // CSO_READER_HPP
@@ -1,6 +1,7 @@
 #ifndef GAMEPAD_HPP
 #define GAMEPAD_HPP
 #include <cstdint>
+#include <fstream>
 
 enum class PAD_BUTTON
 {
@@ -50,6 +51,8 @@ class Gamepad
         void set_result(const uint8_t* result);
 
         void reset();
+        void load_state(std::ifstream& state);
+        void save_state(std::ofstream& state);
         void press_button(PAD_BUTTON button);
         void release_button(PAD_BUTTON button);
 
@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <cstdlib>
 #include <cstdio>
+#include <fstream>
 #include "iop_cop0.hpp"
 
 class Emulator;
@@ -28,6 +29,8 @@ class IOP
         static const char* REG(int id);
 
         void reset();
+        void load_state(std::ifstream& state);
+        void save_state(std::ofstream& state);
         void run();
         void print_state();
         void set_disassembly(bool dis);
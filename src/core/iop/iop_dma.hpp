@@ -1,6 +1,7 @@
 #ifndef IOP_DMA_HPP
 #define IOP_DMA_HPP
 #include <cstdint>
+#include <fstream>
 
 struct IOP_DMA_Chan_Control
 {
@@ -71,6 +72,8 @@ class IOP_DMA
         IOP_DMA(Emulator* e, CDVD_Drive* cdvd, SubsystemInterface* sif, SIO2* sio2, SPU* spu, SPU* spu2);
 
         void reset(uint8_t* RAM);
+        void load_state(std::ifstream& state);
+        void save_state(std::ofstream& state);
         void run();
 
         uint32_t get_DPCR();
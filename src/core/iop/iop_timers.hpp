@@ -1,6 +1,7 @@
 #ifndef IOP_TIMERS_HPP
 #define IOP_TIMERS_HPP
 #include <cstdint>
+#include <fstream>
 
 struct IOP_Timer_Control
 {
@@ -38,6 +39,8 @@ class IOPTiming
         IOPTiming(Emulator* e);
 
         void reset();
+        void load_state(std::ifstream& state);
+        void save_state(std::ofstream& state);
         void run();
         uint32_t read_counter(int index);
         uint16_t read_control(int index);
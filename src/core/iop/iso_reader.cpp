@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <cstring>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "iso_reader.hpp"
+
+using namespace std;
+
+const uint32_t ISO_Reader::READ_AHEAD_SECTORS;
+
+ISO_Reader::ISO_Reader()
+{
+#ifndef _WIN32
+    fd = -1;
+    data = nullptr;
+#endif
+    size = 0;
+    read_ahead_stop = false;
+    read_ahead_sector = 0;
+    read_ahead_pos = 0;
+    read_ahead_end = 0;
+}
+
+ISO_Reader::~ISO_Reader()
+{
+    close();
+}
+
+bool ISO_Reader::open(const string& name)
+{
+    close();
+#ifdef _WIN32
+    file.open(name, ios::in | ios::binary | ios::ate);
+    if (!file.is_open())
+        return false;
+    size = file.tellg();
+    return true;
+#else
+    fd = ::open(name.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat info;
+    if (fstat(fd, &info) < 0 || !info.st_size)
+    {
+        close();
+        return false;
+    }
+    size = info.st_size;
+    void* map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        close();
+        return false;
+    }
+    data = (const uint8_t*)map;
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    read_ahead_stop = false;
+    read_ahead_sector = 0;
+    read_ahead_pos = 0;
+    read_ahead_end = 0;
+    read_ahead_thread = thread(&ISO_Reader::read_ahead_loop, this);
+    return true;
+#endif
+}
+
+void ISO_Reader::close()
+{
+    if (read_ahead_thread.joinable())
+    {
+        {
+            lock_guard<mutex> lock(read_ahead_mutex);
+            read_ahead_stop = true;
+        }
+        read_ahead_cv.notify_one();
+        read_ahead_thread.join();
+    }
+#ifdef _WIN32
+    if (file.is_open())
+        file.close();
+#else
+    if (data)
+        munmap((void*)data, size);
+    data = nullptr;
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+#endif
+    size = 0;
+}
+
+bool ISO_Reader::is_open()
+{
+#ifdef _WIN32
+    return file.is_open();
+#else
+    return data != nullptr;
+#endif
+}
+
+uint64_t ISO_Reader::get_size()
+{
+    return size;
+}
+
+uint64_t ISO_Reader::read(uint8_t* dest, uint64_t offset, uint64_t bytes)
+{
+    if (offset >= size)
+        return 0;
+    bytes = min(bytes, size - offset);
+#ifdef _WIN32
+    file.clear();
+    file.seekg(offset);
+    file.read((char*)dest, bytes);
+#else
+    memcpy(dest, data + offset, bytes);
+#endif
+    return bytes;
+}
+
+/**
+  * Called by the drive for every sector it starts reading, with the number of sectors left in the command.
+  * The window only moves forward while reads are sequential; a read anywhere else restarts it.
+  **/
+void ISO_Reader::prefetch(uint32_t sector, uint32_t count)
+{
+#ifndef _WIN32
+    uint32_t end = sector + min(count, READ_AHEAD_SECTORS);
+    lock_guard<mutex> lock(read_ahead_mutex);
+    bool sequential = sector >= read_ahead_sector && sector <= read_ahead_end;
+    read_ahead_sector = sector;
+    if (sequential)
+    {
+        //Nothing behind the drive needs touching any more
+        read_ahead_pos = max(read_ahead_pos, sector);
+        if (end <= read_ahead_end)
+            return;
+    }
+    else
+        read_ahead_pos = sector;
+    read_ahead_end = end;
+    read_ahead_cv.notify_one();
+#endif
+}
+
+void ISO_Reader::read_ahead_loop()
+{
+#ifndef _WIN32
+    const uint64_t page_size = 4096;
+    unique_lock<mutex> lock(read_ahead_mutex);
+    while (true)
+    {
+        read_ahead_cv.wait(lock, [this] { return read_ahead_stop || read_ahead_pos < read_ahead_end; });
+        if (read_ahead_stop)
+            return;
+
+        //Sectors are touched in small batches so that the window can move while the thread works
+        uint32_t start = read_ahead_pos;
+        uint32_t end = min(read_ahead_end, start + 32);
+        read_ahead_pos = end;
+        lock.unlock();
+
+        uint64_t begin = min((uint64_t)start * SECTOR_SIZE, size);
+        uint64_t finish = min((uint64_t)end * SECTOR_SIZE, size);
+        volatile uint8_t sink = 0;
+        for (uint64_t offset = begin & ~(page_size - 1); offset < finish; offset += page_size)
+            sink += data[offset];
+        (void)sink;
+
+        lock.lock();
+    }
+#endif
+}
@@ -0,0 +1,52 @@
+#ifndef ISO_READER_HPP
+#define ISO_READER_HPP
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#include "cdvd_container.hpp"
+
+/**
+  * Raw ISO images. The image is memory-mapped, so reads are copies out of the page cache with no seeking or
+  * buffering in between. A read-ahead thread touches the pages of the sectors the drive is about to read, which
+  * moves page faults on uncached parts of the image off the emulation thread.
+  * Platforms without mmap fall back to reading the file through a stream.
+  **/
+class ISO_Reader : public CDVD_Container
+{
+    private:
+#ifdef _WIN32
+        std::ifstream file;
+#else
+        int fd;
+        const uint8_t* data;
+#endif
+        uint64_t size;
+
+        std::thread read_ahead_thread;
+        std::mutex read_ahead_mutex;
+        std::condition_variable read_ahead_cv;
+        bool read_ahead_stop;
+        //The drive last asked for read_ahead_sector; sectors [read_ahead_pos, read_ahead_end) still have to be touched
+        uint32_t read_ahead_sector;
+        uint32_t read_ahead_pos, read_ahead_end;
+
+        void read_ahead_loop();
+    public:
+        //How far ahead of the drive the read-ahead thread goes
+        static const uint32_t READ_AHEAD_SECTORS = 512;
+
+        ISO_Reader();
+        ~ISO_Reader();
+
+        bool open(const std::string& name) override;
+        void close() override;
+        bool is_open() override;
+        uint64_t get_size() override;
+
+        uint64_t read(uint8_t* dest, uint64_t offset, uint64_t bytes) override;
+        void prefetch(uint32_t sector, uint32_t count) override;
+};
+
+#endif // ISO_READER_HPP
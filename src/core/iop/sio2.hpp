@@ -1,6 +1,7 @@
 #ifndef SIO2_HPP
 #define SIO2_HPP
 #include <cstdint>
+#include <fstream>
 #include <queue>
 
 enum class SIO_DEVICE
@@ -40,6 +41,8 @@ class SIO2
         SIO2(Emulator* e, Gamepad* pad);
 
         void reset();
+        void load_state(std::ifstream& state);
+        void save_state(std::ofstream& state);
 
         uint8_t read_serial();
         uint32_t get_control();
@@ -1,6 +1,7 @@
 #ifndef SPU_HPP
 #define SPU_HPP
 #include <cstdint>
+#include <fstream>
 
 struct Voice
 {
@@ -38,6 +39,8 @@ class SPU
         SPU(int id, Emulator* e);
 
         void reset(uint8_t* RAM);
+        void load_state(std::ifstream& state);
+        void save_state(std::ofstream& state);
         void finish_DMA();
 
         uint16_t read_mem();
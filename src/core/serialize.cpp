@@ -0,0 +1,821 @@
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include "emulator.hpp"
+#include "errors.hpp"
+#include "serialize.hpp"
+
+/**
+  * Full-machine save states.
+  * Each component saves and loads its own members here, in the order Emulator::save_state calls them. Pointers to
+  * other components and to Emulator-owned memory are never saved; pointers into a component's own tables are saved
+  * as indices. States must be saved and loaded between frames, when the GS thread has finished the last CRT output.
+  * The one exception is the boot snapshot, saved from inside a frame at the BIOS hand-off; see Emulator::skip_BIOS.
+  * load_state returns false without touching the machine if the file isn't a state of this version.
+  **/
+
+static const char STATE_MAGIC[8] = {'D', 'S', 'S', 'T', 'A', 'T', 'E', 0};
+
+bool Emulator::save_state(const char* file_name)
+{
+    std::ofstream state(file_name, std::ios::binary | std::ios::trunc);
+    if (!state.is_open())
+    {
+        printf("[Emulator] Failed to open save state %s\n", file_name);
+        return false;
+    }
+
+    state.write(STATE_MAGIC, sizeof(STATE_MAGIC));
+    state.write((char*)&STATE_VERSION, sizeof(STATE_VERSION));
+
+    save_state_memory(state, RDRAM, 1024 * 1024 * 32);
+    save_state_memory(state, IOP_RAM, 1024 * 1024 * 2);
+    save_state_memory(state, SPU_RAM, 1024 * 1024 * 2);
+    save_state_memory(state, scratchpad, sizeof(scratchpad));
+
+    state.write((char*)&frames, sizeof(frames));
+    state.write((char*)&INTC_read_count, sizeof(INTC_read_count));
+    state.write((char*)&VBLANK_sent, sizeof(VBLANK_sent));
+    state.write((char*)&MCH_RICM, sizeof(MCH_RICM));
+    state.write((char*)&MCH_DRD, sizeof(MCH_DRD));
+    state.write((char*)&rdram_sdevid, sizeof(rdram_sdevid));
+    state.write((char*)&instructions_run, sizeof(instructions_run));
+    state.write((char*)&IOP_POST, sizeof(IOP_POST));
+    state.write((char*)&IOP_I_STAT, sizeof(IOP_I_STAT));
+    state.write((char*)&IOP_I_MASK, sizeof(IOP_I_MASK));
+    state.write((char*)&IOP_I_CTRL, sizeof(IOP_I_CTRL));
+    state.write((char*)&iop_i_ctrl_delay, sizeof(iop_i_ctrl_delay));
+    state.write((char*)&skip_BIOS_hack, sizeof(skip_BIOS_hack));
+
+    cpu.save_state(state);
+    cp0.save_state(state);
+    fpu.save_state(state);
+    dmac.save_state(state);
+    timers.save_state(state);
+    intc.save_state(state);
+    ipu.save_state(state);
+    vif0.save_state(state);
+    vif1.save_state(state);
+    vu0.save_state(state);
+    vu1.save_state(state);
+    gif.save_state(state);
+    sif.save_state(state);
+
+    iop.save_state(state);
+    iop_dma.save_state(state);
+    iop_timers.save_state(state);
+    cdvd.save_state(state);
+    sio2.save_state(state);
+    spu.save_state(state);
+    spu2.save_state(state);
+    pad.save_state(state);
+
+    gs.save_state(state);
+
+    bool success = state.good();
+    state.close();
+    if (!success)
+        printf("[Emulator] Failed to write save state %s\n", file_name);
+    return success;
+}
+
+bool Emulator::load_state(const char* file_name)
+{
+    std::ifstream state(file_name, std::ios::binary);
+    if (!state.is_open())
+    {
+        printf("[Emulator] Failed to open save state %s\n", file_name);
+        return false;
+    }
+
+    char magic[sizeof(STATE_MAGIC)];
+    uint32_t version = 0;
+    state.read(magic, sizeof(magic));
+    state.read((char*)&version, sizeof(version));
+    if (!state.good() || memcmp(magic, STATE_MAGIC, sizeof(magic)))
+    {
+        printf("[Emulator] %s is not a save state\n", file_name);
+        return false;
+    }
+    if (version != STATE_VERSION)
+    {
+        printf("[Emulator] Save state %s has version %d, expected %d\n", file_name, version, STATE_VERSION);
+        return false;
+    }
+
+    load_state_memory(state, RDRAM, 1024 * 1024 * 32);
+    load_state_memory(state, IOP_RAM, 1024 * 1024 * 2);
+    load_state_memory(state, SPU_RAM, 1024 * 1024 * 2);
+    load_state_memory(state, scratchpad, sizeof(scratchpad));
+
+    state.read((char*)&frames, sizeof(frames));
+    state.read((char*)&INTC_read_count, sizeof(INTC_read_count));
+    state.read((char*)&VBLANK_sent, sizeof(VBLANK_sent));
+    state.read((char*)&MCH_RICM, sizeof(MCH_RICM));
+    state.read((char*)&MCH_DRD, sizeof(MCH_DRD));
+    state.read((char*)&rdram_sdevid, sizeof(rdram_sdevid));
+    state.read((char*)&instructions_run, sizeof(instructions_run));
+    state.read((char*)&IOP_POST, sizeof(IOP_POST));
+    state.read((char*)&IOP_I_STAT, sizeof(IOP_I_STAT));
+    state.read((char*)&IOP_I_MASK, sizeof(IOP_I_MASK));
+    state.read((char*)&IOP_I_CTRL, sizeof(IOP_I_CTRL));
+    state.read((char*)&iop_i_ctrl_delay, sizeof(iop_i_ctrl_delay));
+    state.read((char*)&skip_BIOS_hack, sizeof(skip_BIOS_hack));
+
+    cpu.load_state(state);
+    cp0.load_state(state);
+    fpu.load_state(state);
+    dmac.load_state(state);
+    timers.load_state(state);
+    intc.load_state(state);
+    ipu.load_state(state);
+    vif0.load_state(state);
+    vif1.load_state(state);
+    vu0.load_state(state);
+    vu1.load_state(state);
+    gif.load_state(state);
+    sif.load_state(state);
+
+    iop.load_state(state);
+    iop_dma.load_state(state);
+    iop_timers.load_state(state);
+    cdvd.load_state(state);
+    sio2.load_state(state);
+    spu.load_state(state);
+    spu2.load_state(state);
+    pad.load_state(state);
+
+    gs.load_state(state);
+
+    //Part of the machine has already been overwritten, so it can't keep running
+    if (!state.good())
+        Errors::die("[Emulator] Save state %s is truncated\n", file_name);
+    return true;
+}
+
+void EmotionEngine::save_state(std::ofstream& state)
+{
+    state.write((char*)&gpr, sizeof(gpr));
+    state.write((char*)&LO, sizeof(LO));
+    state.write((char*)&HI, sizeof(HI));
+    state.write((char*)&LO1, sizeof(LO1));
+    state.write((char*)&HI1, sizeof(HI1));
+    state.write((char*)&PC, sizeof(PC));
+    state.write((char*)&new_PC, sizeof(new_PC));
+    state.write((char*)&SA, sizeof(SA));
+    state.write((char*)&increment_PC, sizeof(increment_PC));
+    state.write((char*)&branch_on, sizeof(branch_on));
+    state.write((char*)&delay_slot, sizeof(delay_slot));
+    state.write((char*)&deci2handlers, sizeof(deci2handlers));
+    state.write((char*)&deci2size, sizeof(deci2size));
+}
+
+void EmotionEngine::load_state(std::ifstream& state)
+{
+    state.read((char*)&gpr, sizeof(gpr));
+    state.read((char*)&LO, sizeof(LO));
+    state.read((char*)&HI, sizeof(HI));
+    state.read((char*)&LO1, sizeof(LO1));
+    state.read((char*)&HI1, sizeof(HI1));
+    state.read((char*)&PC, sizeof(PC));
+    state.read((char*)&new_PC, sizeof(new_PC));
+    state.read((char*)&SA, sizeof(SA));
+    state.read((char*)&increment_PC, sizeof(increment_PC));
+    state.read((char*)&branch_on, sizeof(branch_on));
+    state.read((char*)&delay_slot, sizeof(delay_slot));
+    state.read((char*)&deci2handlers, sizeof(deci2handlers));
+    state.read((char*)&deci2size, sizeof(deci2size));
+}
+
+void Cop0::save_state(std::ofstream& state)
+{
+    state.write((char*)&gpr, sizeof(gpr));
+    state.write((char*)&status, sizeof(status));
+    state.write((char*)&cause, sizeof(cause));
+    state.write((char*)&EPC, sizeof(EPC));
+    state.write((char*)&ErrorEPC, sizeof(ErrorEPC));
+}
+
+void Cop0::load_state(std::ifstream& state)
+{
+    state.read((char*)&gpr, sizeof(gpr));
+    state.read((char*)&status, sizeof(status));
+    state.read((char*)&cause, sizeof(cause));
+    state.read((char*)&EPC, sizeof(EPC));
+    state.read((char*)&ErrorEPC, sizeof(ErrorEPC));
+}
+
+void Cop1::save_state(std::ofstream& state)
+{
+    state.write((char*)&control, sizeof(control));
+    state.write((char*)&gpr, sizeof(gpr));
+    state.write((char*)&accumulator, sizeof(accumulator));
+}
+
+void Cop1::load_state(std::ifstream& state)
+{
+    state.read((char*)&control, sizeof(control));
+    state.read((char*)&gpr, sizeof(gpr));
+    state.read((char*)&accumulator, sizeof(accumulator));
+}
+
+void DMAC::save_state(std::ofstream& state)
+{
+    state.write((char*)&channels, sizeof(channels));
+    state.write((char*)&control, sizeof(control));
+    state.write((char*)&interrupt_stat, sizeof(interrupt_stat));
+    state.write((char*)&PCR, sizeof(PCR));
+    state.write((char*)&RBOR, sizeof(RBOR));
+    state.write((char*)&RBSR, sizeof(RBSR));
+    state.write((char*)&mfifo_empty_triggered, sizeof(mfifo_empty_triggered));
+    state.write((char*)&master_disable, sizeof(master_disable));
+}
+
+void DMAC::load_state(std::ifstream& state)
+{
+    state.read((char*)&channels, sizeof(channels));
+    state.read((char*)&control, sizeof(control));
+    state.read((char*)&interrupt_stat, sizeof(interrupt_stat));
+    state.read((char*)&PCR, sizeof(PCR));
+    state.read((char*)&RBOR, sizeof(RBOR));
+    state.read((char*)&RBSR, sizeof(RBSR));
+    state.read((char*)&mfifo_empty_triggered, sizeof(mfifo_empty_triggered));
+    state.read((char*)&master_disable, sizeof(master_disable));
+}
+
+void EmotionTiming::save_state(std::ofstream& state)
+{
+    state.write((char*)&timers, sizeof(timers));
+}
+
+void EmotionTiming::load_state(std::ifstream& state)
+{
+    state.read((char*)&timers, sizeof(timers));
+}
+
+void INTC::save_state(std::ofstream& state)
+{
+    state.write((char*)&INTC_MASK, sizeof(INTC_MASK));
+    state.write((char*)&INTC_STAT, sizeof(INTC_STAT));
+}
+
+void INTC::load_state(std::ifstream& state)
+{
+    state.read((char*)&INTC_MASK, sizeof(INTC_MASK));
+    state.read((char*)&INTC_STAT, sizeof(INTC_STAT));
+}
+
+//Stored oldest quadword first, the same way save_state_queue stores a queue
+void IPU_FIFO::save_state(std::ofstream& state)
+{
+    state.write((char*)&count, sizeof(count));
+    for (uint32_t i = 0; i < count; i++)
+        state.write((char*)&ring[(head + i) & (ring.size() - 1)], sizeof(uint128_t));
+    state.write((char*)&bit_pointer, sizeof(bit_pointer));
+}
+
+void IPU_FIFO::load_state(std::ifstream& state)
+{
+    reset();
+    uint32_t size = 0;
+    state.read((char*)&size, sizeof(size));
+    for (uint32_t i = 0; i < size && state.good(); i++)
+    {
+        uint128_t quad;
+        state.read((char*)&quad, sizeof(quad));
+        push(quad);
+    }
+    state.read((char*)&bit_pointer, sizeof(bit_pointer));
+}
+
+void ImageProcessingUnit::save_state(std::ofstream& state)
+{
+    //The VLC tables hold no state; only which one is in use is saved
+    int dct_coeff_index = 0;
+    if (dct_coeff == &dct_coeff0)
+        dct_coeff_index = 1;
+    else if (dct_coeff == &dct_coeff1)
+        dct_coeff_index = 2;
+    state.write((char*)&dct_coeff_index, sizeof(dct_coeff_index));
+
+    VLC_Table* VDEC_tables[] = {nullptr, &macroblock_increment, &macroblock_I_pic, &macroblock_P_pic,
+                                &macroblock_B_pic, &motioncode};
+    int VDEC_table_index = 0;
+    for (int i = 0; i < 6; i++)
+    {
+        if (VDEC_table == VDEC_tables[i])
+            VDEC_table_index = i;
+    }
+    state.write((char*)&VDEC_table_index, sizeof(VDEC_table_index));
+
+    in_FIFO.save_state(state);
+    out_FIFO.save_state(state);
+
+    state.write((char*)&intra_IQ, sizeof(intra_IQ));
+    state.write((char*)&nonintra_IQ, sizeof(nonintra_IQ));
+    state.write((char*)&VQCLUT, sizeof(VQCLUT));
+    state.write((char*)&TH0, sizeof(TH0));
+    state.write((char*)&TH1, sizeof(TH1));
+
+    state.write((char*)&ctrl, sizeof(ctrl));
+    state.write((char*)&command_decoding, sizeof(command_decoding));
+    state.write((char*)&command, sizeof(command));
+    state.write((char*)&command_option, sizeof(command_option));
+    state.write((char*)&command_output, sizeof(command_output));
+    state.write((char*)&bytes_left, sizeof(bytes_left));
+
+    state.write((char*)&bdec, sizeof(bdec));
+    int cur_block_index = bdec.cur_block ? (bdec.cur_block - bdec.blocks[0]) / 64 : -1;
+    state.write((char*)&cur_block_index, sizeof(cur_block_index));
+    state.write((char*)&vdec_state, sizeof(vdec_state));
+    state.write((char*)&fdec_state, sizeof(fdec_state));
+    state.write((char*)&csc, sizeof(csc));
+}
+
+void ImageProcessingUnit::load_state(std::ifstream& state)
+{
+    if (speculating)
+        stop_ahead();
+
+    int dct_coeff_index = 0;
+    state.read((char*)&dct_coeff_index, sizeof(dct_coeff_index));
+    DCT_Coeff* dct_coeff_tables[] = {nullptr, &dct_coeff0, &dct_coeff1};
+    dct_coeff = dct_coeff_tables[dct_coeff_index % 3];
+
+    int VDEC_table_index = 0;
+    state.read((char*)&VDEC_table_index, sizeof(VDEC_table_index));
+    VLC_Table* VDEC_tables[] = {nullptr, &macroblock_increment, &macroblock_I_pic, &macroblock_P_pic,
+                                &macroblock_B_pic, &motioncode};
+    VDEC_table = VDEC_tables[VDEC_table_index % 6];
+
+    in_FIFO.load_state(state);
+    out_FIFO.load_state(state);
+
+    state.read((char*)&intra_IQ, sizeof(intra_IQ));
+    state.read((char*)&nonintra_IQ, sizeof(nonintra_IQ));
+    state.read((char*)&VQCLUT, sizeof(VQCLUT));
+    state.read((char*)&TH0, sizeof(TH0));
+    state.read((char*)&TH1, sizeof(TH1));
+
+    state.read((char*)&ctrl, sizeof(ctrl));
+    state.read((char*)&command_decoding, sizeof(command_decoding));
+    state.read((char*)&command, sizeof(command));
+    state.read((char*)&command_option, sizeof(command_option));
+    state.read((char*)&command_output, sizeof(command_output));
+    state.read((char*)&bytes_left, sizeof(bytes_left));
+
+    state.read((char*)&bdec, sizeof(bdec));
+    int cur_block_index = -1;
+    state.read((char*)&cur_block_index, sizeof(cur_block_index));
+    bdec.cur_block = (cur_block_index >= 0 && cur_block_index < 6) ? bdec.blocks[cur_block_index] : nullptr;
+    state.read((char*)&vdec_state, sizeof(vdec_state));
+    state.read((char*)&fdec_state, sizeof(fdec_state));
+    state.read((char*)&csc, sizeof(csc));
+
+    if (async && ctrl.busy && decodes_ahead(command))
+        start_ahead();
+}
+
+void VectorInterface::save_state(std::ofstream& state)
+{
+    save_state_queue(state, FIFO);
+    state.write((char*)&imm, sizeof(imm));
+    state.write((char*)&command, sizeof(command));
+    state.write((char*)&mpg, sizeof(mpg));
+    state.write((char*)&unpack, sizeof(unpack));
+    state.write((char*)&wait_for_VU, sizeof(wait_for_VU));
+    state.write((char*)&flush_stall, sizeof(flush_stall));
+    state.write((char*)&wait_cmd_value, sizeof(wait_cmd_value));
+    state.write((char*)&buffer, sizeof(buffer));
+    state.write((char*)&buffer_size, sizeof(buffer_size));
+    state.write((char*)&DBF, sizeof(DBF));
+    state.write((char*)&CYCLE, sizeof(CYCLE));
+    state.write((char*)&OFST, sizeof(OFST));
+    state.write((char*)&BASE, sizeof(BASE));
+    state.write((char*)&TOPS, sizeof(TOPS));
+    state.write((char*)&TOP, sizeof(TOP));
+    state.write((char*)&ITOPS, sizeof(ITOPS));
+    state.write((char*)&ITOP, sizeof(ITOP));
+    state.write((char*)&MODE, sizeof(MODE));
+    state.write((char*)&MASK, sizeof(MASK));
+    state.write((char*)&ROW, sizeof(ROW));
+    state.write((char*)&COL, sizeof(COL));
+    state.write((char*)&command_len, sizeof(command_len));
+}
+
+void VectorInterface::load_state(std::ifstream& state)
+{
+    load_state_queue(state, FIFO);
+    state.read((char*)&imm, sizeof(imm));
+    state.read((char*)&command, sizeof(command));
+    state.read((char*)&mpg, sizeof(mpg));
+    state.read((char*)&unpack, sizeof(unpack));
+    state.read((char*)&wait_for_VU, sizeof(wait_for_VU));
+    state.read((char*)&flush_stall, sizeof(flush_stall));
+    state.read((char*)&wait_cmd_value, sizeof(wait_cmd_value));
+    state.read((char*)&buffer, sizeof(buffer));
+    state.read((char*)&buffer_size, sizeof(buffer_size));
+    state.read((char*)&DBF, sizeof(DBF));
+    state.read((char*)&CYCLE, sizeof(CYCLE));
+    state.read((char*)&OFST, sizeof(OFST));
+    state.read((char*)&BASE, sizeof(BASE));
+    state.read((char*)&TOPS, sizeof(TOPS));
+    state.read((char*)&TOP, sizeof(TOP));
+    state.read((char*)&ITOPS, sizeof(ITOPS));
+    state.read((char*)&ITOP, sizeof(ITOP));
+    state.read((char*)&MODE, sizeof(MODE));
+    state.read((char*)&MASK, sizeof(MASK));
+    state.read((char*)&ROW, sizeof(ROW));
+    state.read((char*)&COL, sizeof(COL));
+    state.read((char*)&command_len, sizeof(command_len));
+}
+
+void VectorUnit::save_state(std::ofstream& state)
+{
+    state.write((char*)&instr_mem, sizeof(instr_mem));
+    state.write((char*)&data_mem, sizeof(data_mem));
+    state.write((char*)&running, sizeof(running));
+    state.write((char*)&PC, sizeof(PC));
+    state.write((char*)&new_PC, sizeof(new_PC));
+    state.write((char*)&branch_on, sizeof(branch_on));
+    state.write((char*)&finish_on, sizeof(finish_on));
+    state.write((char*)&delay_slot, sizeof(delay_slot));
+
+    state.write((char*)&XGKICK_cycles, sizeof(XGKICK_cycles));
+    state.write((char*)&GIF_addr, sizeof(GIF_addr));
+    state.write((char*)&transferring_GIF, sizeof(transferring_GIF));
+    state.write((char*)&XGKICK_stall, sizeof(XGKICK_stall));
+    state.write((char*)&stalled_GIF_addr, sizeof(stalled_GIF_addr));
+
+    state.write((char*)&gpr, sizeof(gpr));
+    state.write((char*)&int_gpr, sizeof(int_gpr));
+    state.write((char*)&ACC, sizeof(ACC));
+    state.write((char*)&status, sizeof(status));
+    state.write((char*)&clip_flags, sizeof(clip_flags));
+    state.write((char*)&R, sizeof(R));
+    state.write((char*)&I, sizeof(I));
+    state.write((char*)&Q, sizeof(Q));
+    state.write((char*)&P, sizeof(P));
+
+    state.write((char*)&MAC_pipeline, sizeof(MAC_pipeline));
+    state.write((char*)&new_MAC_flags, sizeof(new_MAC_flags));
+    state.write((char*)&Q_Pipeline, sizeof(Q_Pipeline));
+    state.write((char*)&new_Q_instance, sizeof(new_Q_instance));
+}
+
+void VectorUnit::load_state(std::ifstream& state)
+{
+    state.read((char*)&instr_mem, sizeof(instr_mem));
+    state.read((char*)&data_mem, sizeof(data_mem));
+    state.read((char*)&running, sizeof(running));
+    state.read((char*)&PC, sizeof(PC));
+    state.read((char*)&new_PC, sizeof(new_PC));
+    state.read((char*)&branch_on, sizeof(branch_on));
+    state.read((char*)&finish_on, sizeof(finish_on));
+    state.read((char*)&delay_slot, sizeof(delay_slot));
+
+    state.read((char*)&XGKICK_cycles, sizeof(XGKICK_cycles));
+    state.read((char*)&GIF_addr, sizeof(GIF_addr));
+    state.read((char*)&transferring_GIF, sizeof(transferring_GIF));
+    state.read((char*)&XGKICK_stall, sizeof(XGKICK_stall));
+    state.read((char*)&stalled_GIF_addr, sizeof(stalled_GIF_addr));
+
+    state.read((char*)&gpr, sizeof(gpr));
+    state.read((char*)&int_gpr, sizeof(int_gpr));
+    state.read((char*)&ACC, sizeof(ACC));
+    state.read((char*)&status, sizeof(status));
+    state.read((char*)&clip_flags, sizeof(clip_flags));
+    state.read((char*)&R, sizeof(R));
+    state.read((char*)&I, sizeof(I));
+    state.read((char*)&Q, sizeof(Q));
+    state.read((char*)&P, sizeof(P));
+
+    state.read((char*)&MAC_pipeline, sizeof(MAC_pipeline));
+    state.read((char*)&new_MAC_flags, sizeof(new_MAC_flags));
+    state.read((char*)&Q_Pipeline, sizeof(Q_Pipeline));
+    state.read((char*)&new_Q_instance, sizeof(new_Q_instance));
+}
+
+void GraphicsInterface::save_state(std::ofstream& state)
+{
+    state.write((char*)&current_tag, sizeof(current_tag));
+    state.write((char*)&processing_GIF_prim, sizeof(processing_GIF_prim));
+    state.write((char*)&active_path, sizeof(active_path));
+    state.write((char*)&path_queue, sizeof(path_queue));
+
+    //A partially collected IMAGE transfer
+    bool has_image = image_data != nullptr;
+    state.write((char*)&has_image, sizeof(has_image));
+    if (has_image)
+    {
+        state.write((char*)&image_size, sizeof(image_size));
+        state.write((char*)image_data, image_size * sizeof(uint64_t));
+    }
+}
+
+void GraphicsInterface::load_state(std::ifstream& state)
+{
+    state.read((char*)&current_tag, sizeof(current_tag));
+    state.read((char*)&processing_GIF_prim, sizeof(processing_GIF_prim));
+    state.read((char*)&active_path, sizeof(active_path));
+    state.read((char*)&path_queue, sizeof(path_queue));
+
+    delete[] image_data;
+    image_data = nullptr;
+    image_size = 0;
+    bool has_image = false;
+    state.read((char*)&has_image, sizeof(has_image));
+    if (has_image)
+    {
+        state.read((char*)&image_size, sizeof(image_size));
+        image_data = new uint64_t[current_tag.NLOOP * 2];
+        if (image_size > current_tag.NLOOP * 2u)
+            image_size = current_tag.NLOOP * 2;
+        state.read((char*)image_data, image_size * sizeof(uint64_t));
+    }
+}
+
+void SubsystemInterface::save_state(std::ofstream& state)
+{
+    state.write((char*)&mscom, sizeof(mscom));
+    state.write((char*)&smcom, sizeof(smcom));
+    state.write((char*)&msflag, sizeof(msflag));
+    state.write((char*)&smflag, sizeof(smflag));
+    state.write((char*)&control, sizeof(control));
+    save_state_queue(state, SIF0_FIFO);
+    save_state_queue(state, SIF1_FIFO);
+}
+
+void SubsystemInterface::load_state(std::ifstream& state)
+{
+    state.read((char*)&mscom, sizeof(mscom));
+    state.read((char*)&smcom, sizeof(smcom));
+    state.read((char*)&msflag, sizeof(msflag));
+    state.read((char*)&smflag, sizeof(smflag));
+    state.read((char*)&control, sizeof(control));
+    load_state_queue(state, SIF0_FIFO);
+    load_state_queue(state, SIF1_FIFO);
+}
+
+void IOP::save_state(std::ofstream& state)
+{
+    state.write((char*)&cop0, sizeof(cop0));
+    state.write((char*)&gpr, sizeof(gpr));
+    state.write((char*)&PC, sizeof(PC));
+    state.write((char*)&LO, sizeof(LO));
+    state.write((char*)&HI, sizeof(HI));
+    state.write((char*)&new_PC, sizeof(new_PC));
+    state.write((char*)&load_delay, sizeof(load_delay));
+    state.write((char*)&will_branch, sizeof(will_branch));
+    state.write((char*)&inc_PC, sizeof(inc_PC));
+}
+
+void IOP::load_state(std::ifstream& state)
+{
+    state.read((char*)&cop0, sizeof(cop0));
+    state.read((char*)&gpr, sizeof(gpr));
+    state.read((char*)&PC, sizeof(PC));
+    state.read((char*)&LO, sizeof(LO));
+    state.read((char*)&HI, sizeof(HI));
+    state.read((char*)&new_PC, sizeof(new_PC));
+    state.read((char*)&load_delay, sizeof(load_delay));
+    state.read((char*)&will_branch, sizeof(will_branch));
+    state.read((char*)&inc_PC, sizeof(inc_PC));
+}
+
+void IOP_DMA::save_state(std::ofstream& state)
+{
+    state.write((char*)&channels, sizeof(channels));
+    state.write((char*)&DPCR, sizeof(DPCR));
+    state.write((char*)&DICR, sizeof(DICR));
+}
+
+void IOP_DMA::load_state(std::ifstream& state)
+{
+    state.read((char*)&channels, sizeof(channels));
+    state.read((char*)&DPCR, sizeof(DPCR));
+    state.read((char*)&DICR, sizeof(DICR));
+}
+
+void IOPTiming::save_state(std::ofstream& state)
+{
+    state.write((char*)&cycles_since_IRQ, sizeof(cycles_since_IRQ));
+    state.write((char*)&timers, sizeof(timers));
+}
+
+void IOPTiming::load_state(std::ifstream& state)
+{
+    state.read((char*)&cycles_since_IRQ, sizeof(cycles_since_IRQ));
+    state.read((char*)&timers, sizeof(timers));
+}
+
+//The disc itself isn't saved; the same image has to be loaded before the state
+void CDVD_Drive::save_state(std::ofstream& state)
+{
+    state.write((char*)&last_read, sizeof(last_read));
+    state.write((char*)&cycle_count, sizeof(cycle_count));
+    state.write((char*)&read_bytes_left, sizeof(read_bytes_left));
+    state.write((char*)&speed, sizeof(speed));
+
+    state.write((char*)&current_sector, sizeof(current_sector));
+    state.write((char*)&sector_pos, sizeof(sector_pos));
+    state.write((char*)&sectors_left, sizeof(sectors_left));
+    state.write((char*)&block_size, sizeof(block_size));
+    state.write((char*)&buffered_sectors, sizeof(buffered_sectors));
+    state.write((char*)&buffer_start, sizeof(buffer_start));
+    state.write((char*)&read_buffer, sizeof(read_buffer));
+
+    state.write((char*)&ISTAT, sizeof(ISTAT));
+    state.write((char*)&drive_status, sizeof(drive_status));
+    state.write((char*)&is_spinning, sizeof(is_spinning));
+    state.write((char*)&is_reading, sizeof(is_reading));
+
+    state.write((char*)&active_N_command, sizeof(active_N_command));
+    state.write((char*)&N_command, sizeof(N_command));
+    state.write((char*)&N_command_params, sizeof(N_command_params));
+    state.write((char*)&N_params, sizeof(N_params));
+    state.write((char*)&N_status, sizeof(N_status));
+    state.write((char*)&N_cycles_left, sizeof(N_cycles_left));
+
+    state.write((char*)&S_command, sizeof(S_command));
+    state.write((char*)&S_command_params, sizeof(S_command_params));
+    state.write((char*)&S_outdata, sizeof(S_outdata));
+    state.write((char*)&S_params, sizeof(S_params));
+    state.write((char*)&S_out_params, sizeof(S_out_params));
+    state.write((char*)&S_status, sizeof(S_status));
+}
+
+void CDVD_Drive::load_state(std::ifstream& state)
+{
+    state.read((char*)&last_read, sizeof(last_read));
+    state.read((char*)&cycle_count, sizeof(cycle_count));
+    state.read((char*)&read_bytes_left, sizeof(read_bytes_left));
+    state.read((char*)&speed, sizeof(speed));
+
+    state.read((char*)&current_sector, sizeof(current_sector));
+    state.read((char*)&sector_pos, sizeof(sector_pos));
+    state.read((char*)&sectors_left, sizeof(sectors_left));
+    state.read((char*)&block_size, sizeof(block_size));
+    state.read((char*)&buffered_sectors, sizeof(buffered_sectors));
+    state.read((char*)&buffer_start, sizeof(buffer_start));
+    state.read((char*)&read_buffer, sizeof(read_buffer));
+
+    state.read((char*)&ISTAT, sizeof(ISTAT));
+    state.read((char*)&drive_status, sizeof(drive_status));
+    state.read((char*)&is_spinning, sizeof(is_spinning));
+    state.read((char*)&is_reading, sizeof(is_reading));
+
+    state.read((char*)&active_N_command, sizeof(active_N_command));
+    state.read((char*)&N_command, sizeof(N_command));
+    state.read((char*)&N_command_params, sizeof(N_command_params));
+    state.read((char*)&N_params, sizeof(N_params));
+    state.read((char*)&N_status, sizeof(N_status));
+    state.read((char*)&N_cycles_left, sizeof(N_cycles_left));
+
+    state.read((char*)&S_command, sizeof(S_command));
+    state.read((char*)&S_command_params, sizeof(S_command_params));
+    state.read((char*)&S_outdata, sizeof(S_outdata));
+    state.read((char*)&S_params, sizeof(S_params));
+    state.read((char*)&S_out_params, sizeof(S_out_params));
+    state.read((char*)&S_status, sizeof(S_status));
+}
+
+void SIO2::save_state(std::ofstream& state)
+{
+    state.write((char*)&send1, sizeof(send1));
+    state.write((char*)&send2, sizeof(send2));
+    state.write((char*)&send3, sizeof(send3));
+    state.write((char*)&RECV1, sizeof(RECV1));
+    state.write((char*)&RECV3, sizeof(RECV3));
+    save_state_queue(state, FIFO);
+    state.write((char*)&control, sizeof(control));
+    state.write((char*)&new_command, sizeof(new_command));
+    state.write((char*)&active_command, sizeof(active_command));
+    state.write((char*)&command_length, sizeof(command_length));
+    state.write((char*)&send3_port, sizeof(send3_port));
+}
+
+void SIO2::load_state(std::ifstream& state)
+{
+    state.read((char*)&send1, sizeof(send1));
+    state.read((char*)&send2, sizeof(send2));
+    state.read((char*)&send3, sizeof(send3));
+    state.read((char*)&RECV1, sizeof(RECV1));
+    state.read((char*)&RECV3, sizeof(RECV3));
+    load_state_queue(state, FIFO);
+    state.read((char*)&control, sizeof(control));
+    state.read((char*)&new_command, sizeof(new_command));
+    state.read((char*)&active_command, sizeof(active_command));
+    state.read((char*)&command_length, sizeof(command_length));
+    state.read((char*)&send3_port, sizeof(send3_port));
+}
+
+void SPU::save_state(std::ofstream& state)
+{
+    state.write((char*)&voices, sizeof(voices));
+    state.write((char*)&core_att, sizeof(core_att));
+    state.write((char*)&status, sizeof(status));
+    state.write((char*)&transfer_addr, sizeof(transfer_addr));
+    state.write((char*)&current_addr, sizeof(current_addr));
+    state.write((char*)&autodma_ctrl, sizeof(autodma_ctrl));
+    state.write((char*)&ADMA_in_progress, sizeof(ADMA_in_progress));
+}
+
+void SPU::load_state(std::ifstream& state)
+{
+    state.read((char*)&voices, sizeof(voices));
+    state.read((char*)&core_att, sizeof(core_att));
+    state.read((char*)&status, sizeof(status));
+    state.read((char*)&transfer_addr, sizeof(transfer_addr));
+    state.read((char*)&current_addr, sizeof(current_addr));
+    state.read((char*)&autodma_ctrl, sizeof(autodma_ctrl));
+    state.read((char*)&ADMA_in_progress, sizeof(ADMA_in_progress));
+}
+
+//Held buttons follow the host and aren't saved
+void Gamepad::save_state(std::ofstream& state)
+{
+    state.write((char*)&command_buffer, sizeof(command_buffer));
+    state.write((char*)&rumble_values, sizeof(rumble_values));
+    state.write((char*)&command, sizeof(command));
+    state.write((char*)&command_length, sizeof(command_length));
+    state.write((char*)&data_count, sizeof(data_count));
+    state.write((char*)&LED_value, sizeof(LED_value));
+    state.write((char*)&analog_mode, sizeof(analog_mode));
+    state.write((char*)&config_mode, sizeof(config_mode));
+    state.write((char*)&halfwords_transfer, sizeof(halfwords_transfer));
+}
+
+void Gamepad::load_state(std::ifstream& state)
+{
+    state.read((char*)&command_buffer, sizeof(command_buffer));
+    state.read((char*)&rumble_values, sizeof(rumble_values));
+    state.read((char*)&command, sizeof(command));
+    state.read((char*)&command_length, sizeof(command_length));
+    state.read((char*)&data_count, sizeof(data_count));
+    state.read((char*)&LED_value, sizeof(LED_value));
+    state.read((char*)&analog_mode, sizeof(analog_mode));
+    state.read((char*)&config_mode, sizeof(config_mode));
+    state.read((char*)&halfwords_transfer, sizeof(halfwords_transfer));
+}
+
+/**
+  * The GS thread writes its own state into the stream. The EE waits for it to finish, which also means every
+  * message sent before the save has been processed.
+  **/
+void GraphicsSynthesizer::save_state(std::ofstream& state)
+{
+    //The rest of a pending readback is saved rather than its request
+    if (readback_pending)
+    {
+        while (!readback_ready)
+            std::this_thread::yield();
+    }
+
+    state.write((char*)&frame_complete, sizeof(frame_complete));
+    state.write((char*)&frame_count, sizeof(frame_count));
+    state.write((char*)&reg, sizeof(reg));
+    state.write((char*)&readback_pending, sizeof(readback_pending));
+    if (readback_pending)
+    {
+        state.write((char*)&readback_quads, sizeof(readback_quads));
+        state.write((char*)&readback_pos, sizeof(readback_pos));
+        state.write((char*)&readback_buffer[readback_pos], (readback_quads - readback_pos) * sizeof(uint128_t));
+    }
+
+    std::atomic<bool> ready(false);
+    GS_message_payload payload;
+    payload.save_state_payload = { &state, &ready };
+    send_message(GS_command::save_state_t, payload);
+    while (!ready)
+        std::this_thread::yield();
+}
+
+void GraphicsSynthesizer::load_state(std::ifstream& state)
+{
+    //Whatever was captured so far doesn't lead up to the loaded state
+    stop_capture();
+
+    state.read((char*)&frame_complete, sizeof(frame_complete));
+    state.read((char*)&frame_count, sizeof(frame_count));
+    state.read((char*)&reg, sizeof(reg));
+    state.read((char*)&readback_pending, sizeof(readback_pending));
+    readback_quads = 0;
+    readback_pos = 0;
+    if (readback_pending)
+    {
+        state.read((char*)&readback_quads, sizeof(readback_quads));
+        state.read((char*)&readback_pos, sizeof(readback_pos));
+        if (readback_quads > READBACK_QUADS || readback_pos > readback_quads)
+            readback_quads = readback_pos = 0;
+        state.read((char*)&readback_buffer[readback_pos], (readback_quads - readback_pos) * sizeof(uint128_t));
+    }
+    readback_ready = readback_pending;
+
+    std::atomic<bool> ready(false);
+    GS_message_payload payload;
+    payload.load_state_payload = { &state, &ready };
+    send_message(GS_command::load_state_t, payload);
+    while (!ready)
+        std::this_thread::yield();
+}
@@ -0,0 +1,146 @@
+#ifndef SERIALIZE_HPP
+#define SERIALIZE_HPP
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <queue>
+#include <vector>
+#include <zlib.h>
+
+/**
+  * Helpers shared by the save state code of every component.
+  * Save states are a stream of raw member values in a fixed order, so any change to what a component saves must
+  * bump STATE_VERSION; states from other versions are rejected instead of being misread.
+  * Large memories are stored in 4 KB chunks. A bitmap says which chunks hold any nonzero data, and only those are
+  * written, each run of consecutive chunks deflated as one zlib stream. Most of a running machine's memory is zero,
+  * so skipping it is where nearly all of the size and time of a save goes; deflating what is left at the fastest
+  * level shrinks it further for little extra time.
+  **/
+
+static const uint32_t STATE_VERSION = 5;
+static const uint32_t STATE_CHUNK_SIZE = 4096;
+
+inline bool state_chunk_used(const uint8_t* chunk)
+{
+    const uint64_t* words = (const uint64_t*)chunk;
+    uint64_t used = 0;
+    for (uint32_t i = 0; i < STATE_CHUNK_SIZE / 8; i++)
+        used |= words[i];
+    return used != 0;
+}
+
+/**
+  * Each run of used chunks is written as its deflated size followed by the zlib stream. A size of zero means the run
+  * is stored as is, which only happens if zlib runs out of memory. The GS thread saves and loads its memory here
+  * too, and nothing on that side could catch an error, so neither function throws.
+  * size must be a multiple of STATE_CHUNK_SIZE.
+  **/
+inline void save_state_memory(std::ostream& state, const uint8_t* mem, uint32_t size)
+{
+    uint32_t chunks = size / STATE_CHUNK_SIZE;
+    std::vector<uint8_t> used(chunks);
+    for (uint32_t i = 0; i < chunks; i++)
+        used[i] = state_chunk_used(mem + i * STATE_CHUNK_SIZE);
+    state.write((const char*)used.data(), chunks);
+
+    std::vector<uint8_t> packed;
+    uint32_t i = 0;
+    while (i < chunks)
+    {
+        if (!used[i])
+        {
+            i++;
+            continue;
+        }
+        uint32_t start = i;
+        while (i < chunks && used[i])
+            i++;
+
+        uLong run_size = (i - start) * STATE_CHUNK_SIZE;
+        uLongf packed_size = compressBound(run_size);
+        packed.resize(packed_size);
+        const uint8_t* run = mem + start * STATE_CHUNK_SIZE;
+        uint32_t stored_size = 0;
+        if (compress2(packed.data(), &packed_size, run, run_size, Z_BEST_SPEED) == Z_OK)
+            stored_size = packed_size;
+        state.write((char*)&stored_size, sizeof(stored_size));
+        if (stored_size)
+            state.write((const char*)packed.data(), stored_size);
+        else
+            state.write((const char*)run, run_size);
+    }
+}
+
+inline void load_state_memory(std::istream& state, uint8_t* mem, uint32_t size)
+{
+    uint32_t chunks = size / STATE_CHUNK_SIZE;
+    std::vector<uint8_t> used(chunks);
+    state.read((char*)used.data(), chunks);
+
+    std::vector<uint8_t> packed;
+    uint32_t i = 0;
+    while (i < chunks)
+    {
+        uint32_t start = i;
+        bool run_used = used[i];
+        while (i < chunks && (bool)used[i] == run_used)
+            i++;
+
+        uLongf run_size = (i - start) * STATE_CHUNK_SIZE;
+        if (!run_used)
+        {
+            memset(mem + start * STATE_CHUNK_SIZE, 0, run_size);
+            continue;
+        }
+
+        uint8_t* run = mem + start * STATE_CHUNK_SIZE;
+        uint32_t stored_size = 0;
+        state.read((char*)&stored_size, sizeof(stored_size));
+        if (!stored_size)
+        {
+            state.read((char*)run, run_size);
+            continue;
+        }
+
+        bool ok = state.good() && stored_size <= compressBound(run_size);
+        if (ok)
+        {
+            packed.resize(stored_size);
+            state.read((char*)packed.data(), stored_size);
+            uLongf unpacked_size = run_size;
+            ok = uncompress(run, &unpacked_size, packed.data(), stored_size) == Z_OK && unpacked_size == run_size;
+        }
+        if (!ok)
+        {
+            printf("[Emulator] Save state memory is corrupt\n");
+            memset(run, 0, run_size);
+        }
+    }
+}
+
+template <typename T> void save_state_queue(std::ofstream& state, std::queue<T> queue)
+{
+    uint32_t size = queue.size();
+    state.write((char*)&size, sizeof(size));
+    while (!queue.empty())
+    {
+        state.write((char*)&queue.front(), sizeof(T));
+        queue.pop();
+    }
+}
+
+template <typename T> void load_state_queue(std::ifstream& state, std::queue<T>& queue)
+{
+    queue = std::queue<T>();
+    uint32_t size = 0;
+    state.read((char*)&size, sizeof(size));
+    for (uint32_t i = 0; i < size && state.good(); i++)
+    {
+        T value;
+        state.read((char*)&value, sizeof(T));
+        queue.push(value);
+    }
+}
+
+#endif // SERIALIZE_HPP
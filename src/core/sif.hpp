@@ -1,6 +1,7 @@
 #ifndef SIF_HPP
 #define SIF_HPP
 #include <cstdint>
+#include <fstream>
 #include <queue>
 
 #include "int128.hpp"
@@ -21,6 +22,8 @@ class SubsystemInterface
         SubsystemInterface();
 
         void reset();
+        void load_state(std::ifstream& state);
+        void save_state(std::ofstream& state);
         int get_SIF0_size();
         int get_SIF1_size();
 
@@ -0,0 +1,197 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../core/gscapture.hpp"
+#include "../core/gsthread.hpp"
+
+using namespace std;
+
+/**
+  * Replays a GS capture through the GS thread without the rest of the machine.
+  * Each frame ends with a CRT output; its replay time is measured from the first message sent for it until the GS
+  * thread has finished the output, and the displayed image is hashed so that rasterizer changes can be checked
+  * against a previous run.
+  **/
+
+static uint64_t hash_output(const uint32_t* data, size_t count)
+{
+    //64-bit FNV-1a
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < count * 4; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+//Returns false if the GS thread died
+static bool wait_for_render(gs_return_fifo* return_fifo)
+{
+    GS_return_message data;
+    while (true)
+    {
+        if (!return_fifo->pop(data))
+        {
+            this_thread::yield();
+            continue;
+        }
+        if (data.type == render_complete_t)
+            return true;
+        if (data.type == death_error_t)
+        {
+            fprintf(stderr, "GS thread error: %s\n", data.payload.death_error_payload.error_str);
+            delete[] data.payload.death_error_payload.error_str;
+        }
+        return false;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: gsreplay <capture> [-loops n] [-frames n]\n");
+        return 1;
+    }
+
+    int loops = 1;
+    int max_frames = 0;
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        if (!strcmp(argv[i], "-loops"))
+            loops = atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "-frames"))
+            max_frames = atoi(argv[i + 1]);
+        else
+        {
+            printf("Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    GSCaptureReader capture;
+    if (!capture.open(argv[1]))
+    {
+        printf("Failed to open GS capture %s\n", argv[1]);
+        return 1;
+    }
+
+    gs_fifo* fifo = new gs_fifo();
+    gs_return_fifo* return_fifo = new gs_return_fifo();
+    thread gs_thread(&GraphicsSynthesizerThread::event_loop, fifo, return_fifo);
+
+    vector<uint32_t> output(1920 * 1280);
+    mutex output_mutex;
+    vector<uint128_t> readback(1024 * 1024 * 4 / 16);
+    uint32_t readback_quads;
+    atomic<bool> readback_ready;
+
+    //The resolution of the output follows the privileged registers, the same way the EE side tracks it
+    GS_REGISTERS reg;
+
+    bool failed = false;
+    int total_frames = 0;
+    double total_ms = 0.0;
+    vector<uint64_t> image;
+    for (int loop = 0; loop < loops && !failed; loop++)
+    {
+        //Every loop starts from the whole recorded state, so that each replays the same frames
+        istringstream snapshot(capture.state, ios::in | ios::binary);
+        atomic<bool> snapshot_ready(false);
+        GS_message_payload payload;
+        payload.load_state_payload = { &snapshot, &snapshot_ready };
+        fifo->push({ GS_command::load_state_t, payload });
+        while (!snapshot_ready)
+            this_thread::yield();
+        reg = capture.reg;
+        capture.rewind();
+
+        int frame = 0;
+        GS_message message;
+        chrono::steady_clock::time_point frame_start = chrono::steady_clock::now();
+        while ((!max_frames || frame < max_frames) && capture.next_message(message, image))
+        {
+            switch (message.type)
+            {
+                case write_image_t:
+                    //The GS thread deletes image data once it has been written
+                    message.payload.image_payload.data = new uint64_t[image.size()];
+                    memcpy(message.payload.image_payload.data, image.data(), image.size() * sizeof(uint64_t));
+                    break;
+                case readback_t:
+                    message.payload.readback_payload = { readback.data(), (uint32_t)readback.size(),
+                                                         &readback_quads, &readback_ready };
+                    break;
+                case render_crt_t:
+                    message.payload.render_payload = { output.data(), &output_mutex };
+                    break;
+                case write64_privileged_t:
+                    reg.write64_privileged(message.payload.write64_payload.addr, message.payload.write64_payload.value);
+                    break;
+                case write32_privileged_t:
+                    reg.write32_privileged(message.payload.write32_payload.addr, message.payload.write32_payload.value);
+                    break;
+                case set_crt_t:
+                    reg.set_CRT(message.payload.crt_payload.interlaced, message.payload.crt_payload.mode,
+                                message.payload.crt_payload.frame_mode);
+                    break;
+                default:
+                    break;
+            }
+            fifo->push(message);
+            if (message.type != render_crt_t)
+                continue;
+
+            if (!wait_for_render(return_fifo))
+            {
+                failed = true;
+                break;
+            }
+            chrono::steady_clock::time_point now = chrono::steady_clock::now();
+            double ms = chrono::duration<double, milli>(now - frame_start).count();
+            frame_start = now;
+
+            int w, h;
+            reg.get_inner_resolution(w, h);
+            uint64_t hash;
+            {
+                lock_guard<mutex> lock(output_mutex);
+                hash = hash_output(output.data(), min((size_t)w * h, output.size()));
+            }
+            printf("frame %d: %.3f ms %dx%d hash %016llx\n", frame, ms, w, h, (unsigned long long)hash);
+            total_ms += ms;
+            total_frames++;
+            frame++;
+        }
+    }
+
+    if (failed)
+    {
+        gs_thread.detach();
+        return 1;
+    }
+
+    GS_message_payload payload;
+    payload.no_payload = { 0 };
+    fifo->push({ GS_command::die_t, payload });
+    gs_thread.join();
+    delete fifo;
+    delete return_fifo;
+
+    if (total_frames)
+    {
+        printf("replayed %d frames in %.3f ms, %.3f ms per frame, %.1f FPS\n", total_frames, total_ms,
+               total_ms / total_frames, 1000.0 * total_frames / total_ms);
+    }
+    return 0;
+}
@@ -0,0 +1,321 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../core/emulator.hpp"
+#include "../core/errors.hpp"
+
+using namespace std;
+
+/**
+  * Runs the emulator without a GUI so that it can be benchmarked on machines without a display.
+  * A BIOS and optional ELF/ISO/CSO are booted the same way the Qt frontend does it, then frames are run until the frame
+  * count or the wall-clock limit is reached. The results are written as JSON: host time, EE instructions and GS
+  * primitives for every frame, plus the rates over the whole run. The core logs to stdout, so the JSON goes to stderr,
+  * or to the file given with -json. With -hashes each displayed image is hashed as well,
+  * so that runs of different builds can be compared.
+  * -loadstate starts the run from a save state, so that every run begins at the same point; -savestate saves one
+  * once the run ends. -bootcache keeps snapshots of the BIOS hand-off in a directory, so that only the first run with
+  * a given BIOS has to boot it.
+  **/
+
+struct FrameStats
+{
+    double ms;
+    uint32_t instructions;
+    uint32_t primitives;
+    int width, height;
+    uint64_t hash;
+};
+
+static uint64_t hash_output(const uint32_t* data, size_t count)
+{
+    //64-bit FNV-1a, the same hash gsreplay prints
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < count * 4; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+static string json_string(const string& str)
+{
+    string out = "\"";
+    for (char c : str)
+    {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        if ((unsigned char)c < 0x20)
+        {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            out += escape;
+            continue;
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+static bool load_file(const char* name, vector<uint8_t>& data)
+{
+    ifstream file(name, ios::binary | ios::ate);
+    if (!file.is_open())
+        return false;
+    data.resize(file.tellg());
+    file.seekg(0);
+    file.read((char*)data.data(), data.size());
+    return file.good();
+}
+
+static int load_exec(Emulator& e, const char* file_name, bool skip_BIOS)
+{
+    string file_string = file_name;
+    string format = file_string.length() >= 4 ? file_string.substr(file_string.length() - 4) : "";
+    transform(format.begin(), format.end(), format.begin(), ::tolower);
+
+    if (format == ".elf")
+    {
+        vector<uint8_t> ELF;
+        if (!load_file(file_name, ELF))
+        {
+            fprintf(stderr, "Failed to load %s\n", file_name);
+            return 1;
+        }
+        e.reset();
+        e.load_ELF(ELF.data(), ELF.size());
+        if (skip_BIOS)
+            e.set_skip_BIOS_hack(SKIP_HACK::LOAD_ELF);
+    }
+    else if (format == ".iso" || format == ".cso")
+    {
+        e.reset();
+        if (!e.load_CDVD(file_name))
+        {
+            fprintf(stderr, "Failed to load %s\n", file_name);
+            return 1;
+        }
+        if (skip_BIOS)
+            e.set_skip_BIOS_hack(SKIP_HACK::LOAD_DISC);
+    }
+    else
+    {
+        fprintf(stderr, "Unrecognized file format %s\n", format.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+static string json_ms(double ms)
+{
+    if (ms < 0.0)
+        return "null";
+    char str[32];
+    snprintf(str, sizeof(str), "%.3f", ms);
+    return str;
+}
+
+static void write_json(FILE* out, const char* bios_name, const char* exec_name, const vector<FrameStats>& frames,
+                       double total_seconds, bool hashes, double startup_ms, const char* boot_snapshot,
+                       double load_state_ms, double save_state_ms, const string& error)
+{
+    uint64_t total_instructions = 0, total_primitives = 0;
+    for (const FrameStats& frame : frames)
+    {
+        total_instructions += frame.instructions;
+        total_primitives += frame.primitives;
+    }
+    double seconds = total_seconds > 0.0 ? total_seconds : 1.0;
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"bios\": %s,\n", json_string(bios_name).c_str());
+    fprintf(out, "  \"exec\": %s,\n", exec_name ? json_string(exec_name).c_str() : "null");
+    fprintf(out, "  \"frames\": %zu,\n", frames.size());
+    fprintf(out, "  \"seconds\": %.6f,\n", total_seconds);
+    fprintf(out, "  \"fps\": %.3f,\n", frames.size() / seconds);
+    fprintf(out, "  \"ee_instructions\": %llu,\n", (unsigned long long)total_instructions);
+    fprintf(out, "  \"ee_instructions_per_second\": %.1f,\n", total_instructions / seconds);
+    fprintf(out, "  \"gs_primitives\": %llu,\n", (unsigned long long)total_primitives);
+    fprintf(out, "  \"gs_primitives_per_second\": %.1f,\n", total_primitives / seconds);
+    fprintf(out, "  \"startup_ms\": %.3f,\n", startup_ms);
+    fprintf(out, "  \"boot_snapshot\": %s,\n", boot_snapshot ? json_string(boot_snapshot).c_str() : "null");
+    fprintf(out, "  \"load_state_ms\": %s,\n", json_ms(load_state_ms).c_str());
+    fprintf(out, "  \"save_state_ms\": %s,\n", json_ms(save_state_ms).c_str());
+    fprintf(out, "  \"error\": %s,\n", error.length() ? json_string(error).c_str() : "null");
+    fprintf(out, "  \"frame_stats\": [");
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        const FrameStats& frame = frames[i];
+        fprintf(out, "%s\n    {\"frame\": %zu, \"ms\": %.3f, \"ee_instructions\": %u, \"gs_primitives\": %u, "
+                "\"width\": %d, \"height\": %d", i ? "," : "", i, frame.ms, frame.instructions, frame.primitives,
+                frame.width, frame.height);
+        if (hashes)
+            fprintf(out, ", \"hash\": \"%016llx\"", (unsigned long long)frame.hash);
+        fprintf(out, "}");
+    }
+    fprintf(out, "%s]\n}\n", frames.size() ? "\n  " : "");
+}
+
+int main(int argc, char** argv)
+{
+    chrono::steady_clock::time_point launch = chrono::steady_clock::now();
+    if (argc < 2)
+    {
+        printf("Usage: headless <BIOS> [ELF/ISO/CSO] [-skip] [-frames n] [-seconds s] [-hashes] [-json file] "
+               "[-loadstate file] [-savestate file] [-bootcache dir] [-ipuasync]\n"
+               "The JSON report goes to stderr unless -json is given, as emulator logging goes to stdout.\n");
+        return 1;
+    }
+
+    const char* bios_name = argv[1];
+    const char* exec_name = nullptr;
+    const char* json_name = nullptr;
+    const char* load_state_name = nullptr;
+    const char* save_state_name = nullptr;
+    const char* boot_cache_dir = nullptr;
+    bool skip_BIOS = false;
+    bool hashes = false;
+    bool IPU_async = false;
+    int max_frames = 0;
+    double max_seconds = 0.0;
+    for (int i = 2; i < argc; i++)
+    {
+        bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "-skip"))
+            skip_BIOS = true;
+        else if (!strcmp(argv[i], "-hashes"))
+            hashes = true;
+        else if (!strcmp(argv[i], "-ipuasync"))
+            IPU_async = true;
+        else if (!strcmp(argv[i], "-frames") && has_value)
+            max_frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-seconds") && has_value)
+            max_seconds = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-json") && has_value)
+            json_name = argv[++i];
+        else if (!strcmp(argv[i], "-loadstate") && has_value)
+            load_state_name = argv[++i];
+        else if (!strcmp(argv[i], "-savestate") && has_value)
+            save_state_name = argv[++i];
+        else if (!strcmp(argv[i], "-bootcache") && has_value)
+            boot_cache_dir = argv[++i];
+        else if (argv[i][0] != '-' && !exec_name)
+            exec_name = argv[i];
+        else
+        {
+            printf("Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    //Without any limit, run for ten seconds of NTSC time
+    if (!max_frames && max_seconds <= 0.0)
+        max_frames = 600;
+
+    vector<uint8_t> BIOS;
+    if (!load_file(bios_name, BIOS) || BIOS.size() < 1024 * 1024 * 4)
+    {
+        fprintf(stderr, "Failed to load PS2 BIOS from %s\n", bios_name);
+        return 1;
+    }
+
+    //The emulator is too large to live on the stack
+    Emulator* e = new Emulator();
+    vector<FrameStats> frames;
+    string error;
+    double startup_ms = 0.0, load_state_ms = -1.0, save_state_ms = -1.0;
+    const char* boot_snapshot = nullptr;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    try
+    {
+        e->reset();
+        e->set_IPU_async(IPU_async);
+        e->load_BIOS(BIOS.data());
+        if (exec_name && load_exec(*e, exec_name, skip_BIOS))
+        {
+            delete e;
+            return 1;
+        }
+
+        if (boot_cache_dir)
+        {
+            e->set_boot_cache(boot_cache_dir);
+            boot_snapshot = e->fast_boot() ? "loaded" : "missed";
+        }
+
+        if (load_state_name)
+        {
+            chrono::steady_clock::time_point load_start = chrono::steady_clock::now();
+            if (!e->load_state(load_state_name))
+                Errors::die("Failed to load save state %s\n", load_state_name);
+            load_state_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - load_start).count();
+        }
+
+        start = chrono::steady_clock::now();
+        startup_ms = chrono::duration<double, milli>(start - launch).count();
+        chrono::steady_clock::time_point frame_start = start;
+        while (!max_frames || (int)frames.size() < max_frames)
+        {
+            e->run();
+            uint32_t* output = e->get_framebuffer();
+
+            FrameStats frame;
+            e->get_inner_resolution(frame.width, frame.height);
+            frame.instructions = e->get_frame_instructions();
+            frame.primitives = e->get_frame_primitives();
+            frame.hash = 0;
+            if (hashes && output)
+                frame.hash = hash_output(output, min(frame.width * frame.height, 1920 * 1280));
+
+            chrono::steady_clock::time_point now = chrono::steady_clock::now();
+            frame.ms = chrono::duration<double, milli>(now - frame_start).count();
+            frame_start = now;
+            frames.push_back(frame);
+
+            if (max_seconds > 0.0 && chrono::duration<double>(now - start).count() >= max_seconds)
+                break;
+        }
+    }
+    catch (Emulation_error& err)
+    {
+        error = err.what();
+    }
+    double total_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    if (save_state_name && !error.length())
+    {
+        chrono::steady_clock::time_point save_start = chrono::steady_clock::now();
+        if (e->save_state(save_state_name))
+            save_state_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - save_start).count();
+        else
+            error = string("Failed to write save state ") + save_state_name;
+    }
+
+    //Everything the core prints goes to stdout, so the report has to go elsewhere to stay parseable
+    FILE* out = stderr;
+    if (json_name)
+    {
+        out = fopen(json_name, "w");
+        if (!out)
+        {
+            fprintf(stderr, "Failed to open %s\n", json_name);
+            delete e;
+            return 1;
+        }
+    }
+    write_json(out, bios_name, exec_name, frames, total_seconds, hashes, startup_ms, boot_snapshot, load_state_ms,
+               save_state_ms, error);
+    if (out != stderr)
+        fclose(out);
+
+    delete e;
+    return error.length() ? 1 : 0;
+}
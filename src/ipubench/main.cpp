@@ -0,0 +1,685 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../core/ee/ipu/csc.hpp"
+#include "../core/ee/ipu/idct.hpp"
+#include "../core/ee/ipu/ipu.hpp"
+#include "../core/errors.hpp"
+
+using namespace std;
+
+/**
+  * Benchmarks the IPU on its own and checks what it decodes.
+  * The input comes from a small MPEG-2 encoder in this file, seeded the same way on every run. Each workload is fed
+  * through write_command and write_FIFO the way the DMAC would. Its output is hashed and compared with the hash the
+  * decoder is known to produce, so any change to what the IPU outputs shows up as a failure.
+  * The encoder only knows the handful of VLCs below and escapes everything else. That is enough to cover every
+  * decoding path, and a wrong code makes the decoder lose its place in the stream, which is caught as well.
+  * Before that, the IDCT kernels are held to the IEEE 1180 accuracy limits against IDCT::reference, and the IDCT and
+  * CSC kernels are each checked to give identical output to their scalar versions.
+  * The IPU logs to stdout, so the report goes to stderr: run it as ipubench > /dev/null.
+  **/
+
+struct Golden
+{
+    const char* name;
+    uint64_t hash;
+};
+
+static const Golden goldens[] =
+{
+    {"BDEC table 0", 0x18183E6115F12376ULL},
+    {"BDEC table 1", 0x562310EBB57C39FDULL},
+    {"VDEC MBAI", 0xD2438A09AC9EEB94ULL},
+    {"CSC RGB32", 0x2294F0E8CB974234ULL},
+    {"CSC RGB16", 0x473E60EC13B5962DULL}
+};
+
+static uint64_t hash_bytes(uint64_t hash, const void* data, size_t size)
+{
+    //64-bit FNV-1a
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+class Random
+{
+    private:
+        uint64_t state;
+    public:
+        Random(uint64_t seed) : state(seed) {}
+
+        uint32_t next()
+        {
+            //xorshift64
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            return (uint32_t)(state >> 16);
+        }
+
+        int range(int low, int high)
+        {
+            return low + (int)(next() % (uint32_t)(high - low + 1));
+        }
+};
+
+class BitWriter
+{
+    private:
+        vector<uint8_t> bytes;
+        uint64_t bit_count;
+    public:
+        BitWriter() : bit_count(0) {}
+
+        void put(uint32_t value, int bits)
+        {
+            for (int i = bits - 1; i >= 0; i--)
+            {
+                if (!(bit_count & 0x7))
+                    bytes.push_back(0);
+                if ((value >> i) & 0x1)
+                    bytes.back() |= 0x80 >> (bit_count & 0x7);
+                bit_count++;
+            }
+        }
+
+        uint64_t size() const
+        {
+            return bit_count;
+        }
+
+        //Pads to whole quadwords, with a spare one so that lookahead past the last code never runs dry
+        vector<uint128_t> quads() const
+        {
+            vector<uint128_t> result((bytes.size() + 15) / 16 + 1);
+            memset(result.data(), 0, result.size() * sizeof(uint128_t));
+            memcpy(result.data(), bytes.data(), bytes.size());
+            return result;
+        }
+};
+
+struct VLC_Code
+{
+    uint32_t code;
+    int bits;
+};
+
+//ISO/IEC 13818-2 tables B.12 and B.13, indexed by dct_dc_size
+static const VLC_Code dc_size_lum[12] =
+{
+    {0x4, 3}, {0x0, 2}, {0x1, 2}, {0x5, 3}, {0x6, 3}, {0xE, 4},
+    {0x1E, 5}, {0x3E, 6}, {0x7E, 7}, {0xFE, 8}, {0x1FE, 9}, {0x1FF, 9}
+};
+
+static const VLC_Code dc_size_chrom[12] =
+{
+    {0x0, 2}, {0x1, 2}, {0x2, 2}, {0x6, 3}, {0xE, 4}, {0x1E, 5},
+    {0x3E, 6}, {0x7E, 7}, {0xFE, 8}, {0x1FE, 9}, {0x3FE, 10}, {0x3FF, 10}
+};
+
+struct RunLevelCode
+{
+    int run, level;
+    VLC_Code vlc;
+};
+
+//Part of tables B.14 and B.15; sign bits follow each code
+static const RunLevelCode table0_codes[] =
+{
+    {0, 1, {0x3, 2}}, {1, 1, {0x3, 3}}, {0, 2, {0x4, 4}}, {2, 1, {0x5, 4}}, {0, 3, {0x5, 5}}, {3, 1, {0x7, 5}},
+    {4, 1, {0x6, 5}}, {1, 2, {0x6, 6}}, {5, 1, {0x7, 6}}, {6, 1, {0x5, 6}}, {7, 1, {0x4, 6}}
+};
+
+static const RunLevelCode table1_codes[] =
+{
+    {0, 1, {0x2, 2}}, {1, 1, {0x2, 3}}, {0, 2, {0x6, 3}}, {2, 1, {0x5, 5}}, {0, 3, {0x7, 4}}, {3, 1, {0x7, 5}},
+    {4, 1, {0x6, 6}}, {1, 2, {0x6, 5}}, {5, 1, {0x7, 6}}, {6, 1, {0x6, 7}}, {7, 1, {0x4, 7}}, {0, 4, {0x1C, 5}}
+};
+
+static const VLC_Code escape_code = {0x1, 6};
+static const VLC_Code table0_EOB = {0x2, 2};
+static const VLC_Code table1_EOB = {0x6, 4};
+
+//Table B.1, for increments of 1 to 9
+static const VLC_Code MBAI_codes[10] =
+{
+    {0, 0}, {0x1, 1}, {0x3, 3}, {0x2, 3}, {0x3, 4}, {0x2, 4}, {0x3, 5}, {0x2, 5}, {0x7, 7}, {0x6, 7}
+};
+
+//The default intra quantiser matrix
+static const uint8_t default_intra_IQ[64] =
+{
+    8, 16, 19, 22, 26, 27, 29, 34,
+    16, 16, 22, 24, 27, 29, 34, 37,
+    19, 22, 26, 27, 29, 34, 34, 38,
+    22, 22, 26, 27, 29, 34, 37, 40,
+    22, 26, 27, 29, 32, 35, 40, 48,
+    26, 27, 29, 32, 35, 40, 48, 58,
+    26, 27, 29, 34, 38, 46, 56, 69,
+    27, 29, 35, 38, 46, 56, 69, 83
+};
+
+static void encode_DC(BitWriter& stream, int diff, bool chroma)
+{
+    int size = 0;
+    while ((abs(diff) >> size) && size < 11)
+        size++;
+    const VLC_Code& code = chroma ? dc_size_chrom[size] : dc_size_lum[size];
+    stream.put(code.code, code.bits);
+    if (size)
+        stream.put(diff > 0 ? diff : diff + (1 << size) - 1, size);
+}
+
+static void encode_AC(BitWriter& stream, int run, int level, bool table1)
+{
+    const RunLevelCode* codes = table1 ? table1_codes : table0_codes;
+    int count = table1 ? sizeof(table1_codes) / sizeof(RunLevelCode) : sizeof(table0_codes) / sizeof(RunLevelCode);
+    for (int i = 0; i < count; i++)
+    {
+        if (codes[i].run == run && codes[i].level == abs(level))
+        {
+            stream.put(codes[i].vlc.code, codes[i].vlc.bits);
+            stream.put(level < 0, 1);
+            return;
+        }
+    }
+    stream.put(escape_code.code, escape_code.bits);
+    stream.put(run, 6);
+    stream.put(level & 0xFFF, 12);
+}
+
+/**
+  * Intra macroblocks with an 8-bit DC, as BDEC reads them after its FB skip: six blocks, each a DC difference
+  * followed by run/level pairs and an end of block. Most coefficients are small enough for a VLC; the rest are
+  * escaped. A DC reset is requested every eight macroblocks, the way a slice would start.
+  **/
+static vector<uint32_t> encode_intra_macroblocks(BitWriter& stream, Random& random, int count, bool table1)
+{
+    vector<uint32_t> commands;
+    int predictor[3] = {128, 128, 128};
+    for (int mb = 0; mb < count; mb++)
+    {
+        bool reset_DC = !(mb % 8);
+        if (reset_DC)
+            predictor[0] = predictor[1] = predictor[2] = 128;
+
+        for (int block = 0; block < 6; block++)
+        {
+            int channel = block < 4 ? 0 : block - 3;
+            int DC = random.range(0, 255);
+            encode_DC(stream, DC - predictor[channel], channel != 0);
+            predictor[channel] = DC;
+
+            int density = random.range(2, 24);
+            int pos = 1;
+            while (true)
+            {
+                int run = 0;
+                while (pos + run < 64 && random.range(0, 63) >= density)
+                    run++;
+                if (pos + run >= 64)
+                    break;
+                int level = random.range(1, 100) <= 85 ? random.range(1, 4) : random.range(5, 300);
+                if (random.next() & 0x1)
+                    level = -level;
+                encode_AC(stream, run, level, table1);
+                pos += run + 1;
+            }
+            const VLC_Code& EOB = table1 ? table1_EOB : table0_EOB;
+            stream.put(EOB.code, EOB.bits);
+        }
+        commands.push_back((0x2 << 28) | (1 << 27) | (reset_DC << 26) | (random.range(1, 31) << 16));
+    }
+    return commands;
+}
+
+struct Workload
+{
+    string name;
+    vector<uint32_t> setup;
+    vector<uint128_t> setup_input;
+    vector<uint32_t> commands;
+    vector<uint128_t> input;
+    uint64_t stream_bits;
+    uint32_t control;
+    int macroblocks;
+};
+
+/**
+  * Runs each command to completion, feeding the input FIFO whenever it has room and draining the output FIFO, as
+  * the DMAC does. VDEC and FDEC results are hashed along with the output FIFO. Returns false if the IPU stops
+  * making progress; otherwise consumed_bits is how far into the input it read.
+  **/
+static bool run_commands(ImageProcessingUnit& ipu, const vector<uint32_t>& commands, const vector<uint128_t>& input,
+                         uint64_t& hash, uint64_t& consumed_bits)
+{
+    size_t pos = 0;
+    for (size_t i = 0; i < commands.size(); i++)
+    {
+        ipu.write_command(commands[i]);
+        int idle_runs = 0;
+        while (ipu.read_control() >> 31)
+        {
+            bool fed = false;
+            while (pos < input.size() && ipu.can_write_FIFO())
+            {
+                ipu.write_FIFO(input[pos]);
+                pos++;
+                fed = true;
+            }
+            ipu.run();
+
+            bool drained = false;
+            while (ipu.can_read_FIFO())
+            {
+                uint128_t quad = ipu.read_FIFO();
+                hash = hash_bytes(hash, &quad, sizeof(quad));
+                drained = true;
+            }
+
+            if (fed || drained)
+                idle_runs = 0;
+            else if (++idle_runs > 16)
+                return false;
+        }
+        uint32_t result = (uint32_t)ipu.read_command();
+        uint8_t command = commands[i] >> 28;
+        if (command == 0x3 || command == 0x4)
+            hash = hash_bytes(hash, &result, sizeof(result));
+    }
+
+    //BP counts a partly read quadword separately from the rest of the FIFO
+    uint32_t BP = ipu.read_BP();
+    uint64_t quads_left = ((BP >> 8) & 0xF) + ((BP >> 16) & 0x3);
+    consumed_bits = (pos * 128) - (quads_left * 128) + (BP & 0x7F);
+    return true;
+}
+
+static vector<Workload> build_workloads()
+{
+    vector<Workload> workloads;
+
+    //SETIQ reads the matrix as four quadwords
+    vector<uint128_t> IQ_quads(4);
+    memcpy(IQ_quads.data(), default_intra_IQ, sizeof(default_intra_IQ));
+
+    for (int table = 0; table < 2; table++)
+    {
+        Workload bdec;
+        Random random(0x1234 + table);
+        BitWriter stream;
+        bdec.name = table ? "BDEC table 1" : "BDEC table 0";
+        bdec.setup.push_back(0x5 << 28);
+        bdec.setup_input = IQ_quads;
+        bdec.macroblocks = 1200;
+        bdec.commands = encode_intra_macroblocks(stream, random, bdec.macroblocks, table);
+        bdec.input = stream.quads();
+        bdec.stream_bits = stream.size();
+        //I picture, 8-bit DC, MPEG-2; the second table also uses the alternate scan
+        bdec.control = (1 << 24) | (table ? (1 << 21) | (1 << 20) : 0);
+        workloads.push_back(bdec);
+    }
+
+    Workload vdec;
+    Random vdec_random(0x5678);
+    BitWriter vdec_stream;
+    vdec.name = "VDEC MBAI";
+    vdec.macroblocks = 20000;
+    for (int i = 0; i < vdec.macroblocks; i++)
+    {
+        const VLC_Code& code = MBAI_codes[vdec_random.range(1, 9)];
+        vdec_stream.put(code.code, code.bits);
+        vdec.commands.push_back(0x3 << 28);
+    }
+    vdec.input = vdec_stream.quads();
+    vdec.stream_bits = vdec_stream.size();
+    vdec.control = 1 << 24;
+    workloads.push_back(vdec);
+
+    for (int RGB16 = 0; RGB16 < 2; RGB16++)
+    {
+        Workload csc;
+        Random random(0x9ABC + RGB16);
+        csc.name = RGB16 ? "CSC RGB16" : "CSC RGB32";
+        csc.setup.push_back((0x9 << 28) | (0x60 << 16) | 0x20);
+        csc.macroblocks = 2400;
+        //Each macroblock is 0x180 bytes, 24 quadwords
+        csc.input.resize(csc.macroblocks * 24);
+        uint8_t* bytes = (uint8_t*)csc.input.data();
+        for (size_t i = 0; i < csc.input.size() * 16; i++)
+            bytes[i] = random.next();
+        csc.stream_bits = csc.input.size() * 128;
+        for (int i = 0; i < csc.macroblocks; i += 64)
+        {
+            int count = min(64, csc.macroblocks - i);
+            csc.commands.push_back((0x7 << 28) | (RGB16 << 27) | (RGB16 << 26) | count);
+        }
+        csc.control = 0;
+        workloads.push_back(csc);
+    }
+    return workloads;
+}
+
+/**
+  * The IEEE 1180-1990 accuracy test. Blocks of random samples from the standard's generator are run through a
+  * double-precision forward DCT, and the kernel's inverse is compared with IDCT::reference. Both are clipped to
+  * [-256, 255], as the standard requires.
+  **/
+class IEEE1180_Random
+{
+    private:
+        uint32_t randx;
+    public:
+        IEEE1180_Random() : randx(1) {}
+
+        int next(int L, int H)
+        {
+            randx = (randx * 1103515245) + 12345;
+            double x = (double)(randx & 0x7FFFFFFE) / (double)0x7FFFFFFF;
+            return (int)(x * (L + H + 1)) - L;
+        }
+};
+
+struct IEEE1180_Result
+{
+    int peak_error;
+    double worst_pixel_mse, overall_mse;
+    double worst_pixel_mean, overall_mean;
+    bool zero_ok;
+};
+
+struct DCT_Basis
+{
+    double basis[8][8];
+
+    DCT_Basis()
+    {
+        for (int freq = 0; freq < 8; freq++)
+        {
+            double scale = (freq == 0) ? sqrt(0.125) : 0.5;
+            for (int time = 0; time < 8; time++)
+                basis[freq][time] = scale * cos((3.14159265358979323846 / 8.0) * freq * (time + 0.5));
+        }
+    }
+};
+
+static void forward_DCT(const int* in, int16_t* out)
+{
+    static const DCT_Basis dct;
+    const double (*basis)[8] = dct.basis;
+    for (int v = 0; v < 8; v++)
+    {
+        for (int u = 0; u < 8; u++)
+        {
+            double sum = 0.0;
+            for (int y = 0; y < 8; y++)
+            {
+                for (int x = 0; x < 8; x++)
+                    sum += basis[v][y] * basis[u][x] * in[(y * 8) + x];
+            }
+            int coeff = (int)floor(sum + 0.5);
+            out[(v * 8) + u] = (int16_t)max(-2048, min(2047, coeff));
+        }
+    }
+}
+
+static int clip_pixel(int value)
+{
+    return max(-256, min(255, value));
+}
+
+//Runs the standard's 10000 blocks for one input range and sign. Every kernel must also match kernels[0] exactly.
+static IEEE1180_Result IEEE1180_test(const vector<IDCT::Kernel>& kernels, int L, int H, int sign, bool& kernels_match)
+{
+    const int BLOCKS = 10000;
+    IEEE1180_Random random;
+    int64_t error_sum[64] = {}, error_squares[64] = {};
+    IEEE1180_Result result = {};
+
+    for (int block = 0; block < BLOCKS; block++)
+    {
+        int samples[64];
+        int16_t coeffs[64], expected[64], actual[64], other[64];
+        for (int i = 0; i < 64; i++)
+            samples[i] = random.next(L, H) * sign;
+        forward_DCT(samples, coeffs);
+
+        IDCT::reference(coeffs, expected);
+        kernels[0](coeffs, actual);
+        for (size_t k = 1; k < kernels.size(); k++)
+        {
+            kernels[k](coeffs, other);
+            if (memcmp(actual, other, sizeof(actual)))
+                kernels_match = false;
+        }
+
+        for (int i = 0; i < 64; i++)
+        {
+            int error = clip_pixel(actual[i]) - clip_pixel(expected[i]);
+            result.peak_error = max(result.peak_error, abs(error));
+            error_sum[i] += error;
+            error_squares[i] += error * error;
+        }
+    }
+
+    int64_t total_sum = 0, total_squares = 0;
+    for (int i = 0; i < 64; i++)
+    {
+        result.worst_pixel_mse = max(result.worst_pixel_mse, (double)error_squares[i] / BLOCKS);
+        result.worst_pixel_mean = max(result.worst_pixel_mean, fabs((double)error_sum[i] / BLOCKS));
+        total_sum += error_sum[i];
+        total_squares += error_squares[i];
+    }
+    result.overall_mse = (double)total_squares / (BLOCKS * 64.0);
+    result.overall_mean = fabs((double)total_sum / (BLOCKS * 64.0));
+
+    int16_t zero[64] = {}, out[64];
+    kernels[0](zero, out);
+    result.zero_ok = true;
+    for (int i = 0; i < 64; i++)
+    {
+        if (out[i])
+            result.zero_ok = false;
+    }
+    return result;
+}
+
+/**
+  * Checks the fastest IDCT kernel against the IEEE 1180 limits, and checks that every kernel this host can run
+  * gives exactly the same output. Besides the IEEE blocks, that comparison covers dense random blocks over the full
+  * 12-bit coefficient range, which no valid stream produces but a corrupt one can.
+  **/
+static bool check_IDCT()
+{
+    const char* name;
+    vector<IDCT::Kernel> kernels;
+    vector<string> names;
+    kernels.push_back(IDCT::select(name));
+    names.push_back(name);
+    if (kernels[0] != &IDCT::SSE2)
+    {
+        kernels.push_back(&IDCT::SSE2);
+        names.push_back("SSE2");
+    }
+    kernels.push_back(&IDCT::scalar);
+    names.push_back("scalar");
+
+    static const int ranges[3][2] = {{256, 255}, {5, 5}, {300, 300}};
+    bool passed = true, kernels_match = true;
+    for (int r = 0; r < 3; r++)
+    {
+        for (int sign = 1; sign >= -1; sign -= 2)
+        {
+            int L = ranges[r][0], H = ranges[r][1];
+            IEEE1180_Result result = IEEE1180_test(kernels, L, H, sign, kernels_match);
+            bool ok = result.peak_error <= 1 && result.worst_pixel_mse <= 0.06 && result.overall_mse <= 0.02 &&
+                      result.worst_pixel_mean <= 0.015 && result.overall_mean <= 0.0015 && result.zero_ok;
+            if (!ok)
+                passed = false;
+            fprintf(stderr, "IEEE 1180 %s [%d, %d]%s: peak %d, pmse %.4f, omse %.4f, pme %.4f, ome %.5f %s\n",
+                    names[0].c_str(), -L, H, sign < 0 ? " negated" : "", result.peak_error, result.worst_pixel_mse,
+                    result.overall_mse, result.worst_pixel_mean, result.overall_mean, ok ? "ok" : "FAILED");
+        }
+    }
+
+    Random random(0xDC7);
+    for (int block = 0; block < 100000; block++)
+    {
+        int16_t coeffs[64], expected[64], actual[64];
+        for (int i = 0; i < 64; i++)
+            coeffs[i] = random.range(-2048, 2047);
+        kernels[0](coeffs, expected);
+        for (size_t k = 1; k < kernels.size(); k++)
+        {
+            kernels[k](coeffs, actual);
+            if (memcmp(expected, actual, sizeof(actual)))
+                kernels_match = false;
+        }
+    }
+
+    string list = names[0];
+    for (size_t k = 1; k < names.size(); k++)
+        list += ", " + names[k];
+    fprintf(stderr, "IDCT kernels (%s) %s\n", list.c_str(), kernels_match ? "match" : "DIFFER");
+    return passed && kernels_match;
+}
+
+/**
+  * Checks that the SSE2 CSC kernels the IPU runs give exactly what the scalar ones do, on random macroblocks and
+  * thresholds. The RGB16 kernels are fed random words so that every alpha value is covered, not just the three
+  * RGB32 produces.
+  **/
+static bool check_CSC()
+{
+    Random random(0xC5C);
+    bool RGB32_match = true, RGB16_match = true;
+    for (int block = 0; block < 20000; block++)
+    {
+        uint8_t YCbCr[BLOCK_SIZE];
+        for (int i = 0; i < BLOCK_SIZE; i++)
+            YCbCr[i] = random.next();
+
+        //The thresholds are nine bits. Small ones are favoured, since those are where the alpha rules kick in.
+        uint16_t TH0 = random.range(0, 0x1FF) >> random.range(0, 3);
+        uint16_t TH1 = random.range(0, 0x1FF) >> random.range(0, 3);
+
+        uint32_t expected[256], actual[256];
+        CSC::RGB32_scalar(YCbCr, expected, TH0, TH1);
+        CSC::RGB32_SSE2(YCbCr, actual, TH0, TH1);
+        if (memcmp(expected, actual, sizeof(actual)))
+            RGB32_match = false;
+
+        uint32_t pixels[256];
+        for (int i = 0; i < 256; i++)
+            pixels[i] = random.next() ^ (random.next() << 16);
+        for (int dither = 0; dither < 2; dither++)
+        {
+            uint16_t expected16[256], actual16[256];
+            CSC::RGB16_scalar(pixels, expected16, dither);
+            CSC::RGB16_SSE2(pixels, actual16, dither);
+            if (memcmp(expected16, actual16, sizeof(actual16)))
+                RGB16_match = false;
+        }
+    }
+
+    fprintf(stderr, "CSC RGB32 kernels (SSE2, scalar) %s\n", RGB32_match ? "match" : "DIFFER");
+    fprintf(stderr, "CSC RGB16 kernels (SSE2, scalar) %s\n", RGB16_match ? "match" : "DIFFER");
+    return RGB32_match && RGB16_match;
+}
+
+int main(int argc, char** argv)
+{
+    int loops = 1;
+    bool async = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-loops") && i + 1 < argc)
+            loops = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-async"))
+            async = true;
+        else
+        {
+            fprintf(stderr, "Usage: ipubench [-loops n] [-async]\n");
+            return 1;
+        }
+    }
+
+    bool failed = !check_IDCT();
+    if (!check_CSC())
+        failed = true;
+
+    vector<Workload> workloads = build_workloads();
+    ImageProcessingUnit* ipu = new ImageProcessingUnit(nullptr);
+    ipu->set_async(async);
+
+    fprintf(stderr, "%-14s %8s %10s %12s  %-16s\n", "Workload", "MBs", "ms", "MBs/s", "Hash");
+    for (size_t w = 0; w < workloads.size(); w++)
+    {
+        const Workload& work = workloads[w];
+        uint64_t first_hash = 0;
+        double best_ms = 0.0;
+        string status;
+        try
+        {
+            for (int loop = 0; loop < loops; loop++)
+            {
+                ipu->reset();
+                ipu->write_control(work.control);
+                uint64_t setup_hash = 0, consumed_bits = 0;
+                if (!run_commands(*ipu, work.setup, work.setup_input, setup_hash, consumed_bits))
+                    Errors::die("Setup stalled");
+
+                uint64_t hash = 0xCBF29CE484222325ULL;
+                chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                bool finished = run_commands(*ipu, work.commands, work.input, hash, consumed_bits);
+                double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+                if (!finished)
+                    Errors::die("IPU stalled; the stream is out of step with the decoder");
+                if (consumed_bits != work.stream_bits)
+                    Errors::die("IPU read %llu bits of a %llu-bit stream", (unsigned long long)consumed_bits,
+                                (unsigned long long)work.stream_bits);
+
+                if (!loop || ms < best_ms)
+                    best_ms = ms;
+                if (!loop)
+                    first_hash = hash;
+                else if (hash != first_hash)
+                    Errors::die("Output changed between loops");
+            }
+
+            status = "no golden";
+            for (size_t g = 0; g < sizeof(goldens) / sizeof(Golden); g++)
+            {
+                if (work.name == goldens[g].name && goldens[g].hash)
+                    status = goldens[g].hash == first_hash ? "ok" : "MISMATCH";
+            }
+        }
+        catch (Emulation_error& error)
+        {
+            status = string("error: ") + error.what();
+        }
+        if (status != "ok" && status != "no golden")
+            failed = true;
+
+        double rate = best_ms > 0.0 ? work.macroblocks / (best_ms / 1000.0) : 0.0;
+        fprintf(stderr, "%-14s %8d %10.2f %12.0f  %016llx %s\n", work.name.c_str(), work.macroblocks, best_ms, rate,
+                (unsigned long long)first_hash, status.c_str());
+    }
+    //IDEC has no implementation in the IPU yet; it finishes as soon as it starts
+    fprintf(stderr, "%-14s %8s\n", "IDEC", "not implemented");
+
+    delete ipu;
+    return failed ? 1 : 0;
+}
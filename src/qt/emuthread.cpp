@@ -47,6 +47,40 @@ void EmuThread::load_CDVD(const char* name)
     load_mutex.unlock();
 }
 
+//Taking emu_mutex makes the capture start and stop between frames
+bool EmuThread::start_GS_capture(const std::string& path)
+{
+    QMutexLocker locker(&emu_mutex);
+    return e.start_GS_capture(path);
+}
+
+void EmuThread::stop_GS_capture()
+{
+    QMutexLocker locker(&emu_mutex);
+    e.stop_GS_capture();
+}
+
+bool EmuThread::save_state(const char* file_name)
+{
+    QMutexLocker locker(&emu_mutex);
+    return e.save_state(file_name);
+}
+
+bool EmuThread::load_state(const char* file_name)
+{
+    QMutexLocker locker(&emu_mutex);
+    try
+    {
+        return e.load_state(file_name);
+    }
+    catch (Emulation_error &err)
+    {
+        emit emu_error(QString(err.what()));
+        pause(PAUSE_EVENT::GAME_NOT_LOADED);
+        return true;
+    }
+}
+
 void EmuThread::run()
 {
     forever
@@ -35,6 +35,10 @@ class EmuThread : public QThread
         void load_BIOS(uint8_t* BIOS);
         void load_ELF(uint8_t* ELF, uint64_t ELF_size);
         void load_CDVD(const char* name);
+        bool start_GS_capture(const std::string& path);
+        void stop_GS_capture();
+        bool save_state(const char* file_name);
+        bool load_state(const char* file_name);
     protected:
         void run() override;
     signals:
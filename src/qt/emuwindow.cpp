@@ -24,6 +24,7 @@ EmuWindow::EmuWindow(QWidget *parent) : QMainWindow(parent)
     old_frametime = chrono::system_clock::now();
     old_update_time = chrono::system_clock::now();
     framerate_avg = 0.0;
+    capturing_GS = false;
 
     QWidget* widget = new QWidget;
     setCentralWidget(widget);
@@ -65,7 +66,7 @@ int EmuWindow::init(int argc, char** argv)
 {
     if (argc < 2)
     {
-        printf("Args: [BIOS] (Optional)[ELF/ISO]\n");
+        printf("Args: [BIOS] (Optional)[ELF/ISO/CSO]\n");
         return 1;
     }
 
@@ -147,7 +148,7 @@ int EmuWindow::load_exec(const char* file_name, bool skip_BIOS)
         if (skip_BIOS)
             emuthread.set_skip_BIOS_hack(SKIP_HACK::LOAD_ELF);
     }
-    else if (format == ".iso")
+    else if (format == ".iso" || format == ".cso")
     {
         exec_file.close();
         emuthread.load_CDVD(file_name);
@@ -174,12 +175,24 @@ void EmuWindow::create_menu()
     load_bios_action = new QAction(tr("&Load ROM... (Boot BIOS)"), this);
     connect(load_bios_action, &QAction::triggered, this, &EmuWindow::open_file_no_skip);
 
+    GS_capture_action = new QAction(tr("Start &GS capture..."), this);
+    connect(GS_capture_action, &QAction::triggered, this, &EmuWindow::toggle_GS_capture);
+
+    save_state_action = new QAction(tr("&Save state..."), this);
+    connect(save_state_action, &QAction::triggered, this, &EmuWindow::save_state);
+
+    load_state_action = new QAction(tr("Load s&tate..."), this);
+    connect(load_state_action, &QAction::triggered, this, &EmuWindow::load_state);
+
     exit_action = new QAction(tr("&Exit"), this);
     connect(exit_action, &QAction::triggered, this, &QWidget::close);
 
     file_menu = menuBar()->addMenu(tr("&File"));
     file_menu->addAction(load_rom_action);
     file_menu->addAction(load_bios_action);
+    file_menu->addAction(GS_capture_action);
+    file_menu->addAction(save_state_action);
+    file_menu->addAction(load_state_action);
     file_menu->addAction(exit_action);
 }
 
@@ -325,7 +338,7 @@ void EmuWindow::contextMenuEvent(QContextMenuEvent* event)
 void EmuWindow::open_file_no_skip()
 {
     emuthread.pause(PAUSE_EVENT::FILE_DIALOG);
-    QString file_name = QFileDialog::getOpenFileName(this, tr("Open Rom"), "", tr("ROM Files (*.elf *.iso)"));
+    QString file_name = QFileDialog::getOpenFileName(this, tr("Open Rom"), "", tr("ROM Files (*.elf *.iso *.cso)"));
     load_exec(file_name.toStdString().c_str(), false);
     emuthread.unpause(PAUSE_EVENT::FILE_DIALOG);
 }
@@ -333,7 +346,50 @@ void EmuWindow::open_file_no_skip()
 void EmuWindow::open_file_skip()
 {
     emuthread.pause(PAUSE_EVENT::FILE_DIALOG);
-    QString file_name = QFileDialog::getOpenFileName(this, tr("Open Rom"), "", tr("ROM Files (*.elf *.iso)"));
+    QString file_name = QFileDialog::getOpenFileName(this, tr("Open Rom"), "", tr("ROM Files (*.elf *.iso *.cso)"));
     load_exec(file_name.toStdString().c_str(), true);
     emuthread.unpause(PAUSE_EVENT::FILE_DIALOG);
 }
+
+void EmuWindow::toggle_GS_capture()
+{
+    if (capturing_GS)
+    {
+        emuthread.stop_GS_capture();
+        capturing_GS = false;
+        GS_capture_action->setText(tr("Start &GS capture..."));
+        return;
+    }
+
+    emuthread.pause(PAUSE_EVENT::FILE_DIALOG);
+    QString file_name = QFileDialog::getSaveFileName(this, tr("Save GS capture"), "", tr("GS captures (*.gscap)"));
+    if (!file_name.isEmpty())
+    {
+        if (emuthread.start_GS_capture(file_name.toStdString()))
+        {
+            capturing_GS = true;
+            GS_capture_action->setText(tr("Stop &GS capture"));
+        }
+        else
+            emu_error(QString("Unable to write ") + file_name);
+    }
+    emuthread.unpause(PAUSE_EVENT::FILE_DIALOG);
+}
+
+void EmuWindow::save_state()
+{
+    emuthread.pause(PAUSE_EVENT::FILE_DIALOG);
+    QString file_name = QFileDialog::getSaveFileName(this, tr("Save state"), "", tr("Save states (*.dsstate)"));
+    if (!file_name.isEmpty() && !emuthread.save_state(file_name.toStdString().c_str()))
+        emu_error(QString("Unable to write ") + file_name);
+    emuthread.unpause(PAUSE_EVENT::FILE_DIALOG);
+}
+
+void EmuWindow::load_state()
+{
+    emuthread.pause(PAUSE_EVENT::FILE_DIALOG);
+    QString file_name = QFileDialog::getOpenFileName(this, tr("Load state"), "", tr("Save states (*.dsstate)"));
+    if (!file_name.isEmpty() && !emuthread.load_state(file_name.toStdString().c_str()))
+        emu_error(QString("Unable to load ") + file_name);
+    emuthread.unpause(PAUSE_EVENT::FILE_DIALOG);
+}
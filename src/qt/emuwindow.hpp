@@ -23,7 +23,11 @@ class EmuWindow : public QMainWindow
         QMenu* file_menu;
         QAction* load_rom_action;
         QAction* load_bios_action;
+        QAction* GS_capture_action;
+        QAction* save_state_action;
+        QAction* load_state_action;
         QAction* exit_action;
+        bool capturing_GS;
 
     public:
         explicit EmuWindow(QWidget *parent = nullptr);
@@ -51,6 +55,9 @@ class EmuWindow : public QMainWindow
         void draw_frame(uint32_t* buffer, int inner_w, int inner_h, int final_w, int final_h);
         void open_file_no_skip();
         void open_file_skip();
+        void toggle_GS_capture();
+        void save_state();
+        void load_state();
         void emu_error(QString err);
 };
 